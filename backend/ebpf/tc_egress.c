@@ -1,42 +1,187 @@
 //go:build ignore
 
 // TC Egress Connection Tracking
-// Tracks outbound connections from Origin servers (via WireGuard tunnel)
+// Tracks outbound flows from Origin servers (via WireGuard tunnel)
 // so that XDP can bypass filtering for their responses.
 
 #include <linux/bpf.h>
 #include <linux/pkt_cls.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/in.h>
 #include <linux/udp.h>
 #include <linux/tcp.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>
 
-// Active connections map - shared with XDP via pinning
-// Key: destination IP (external server)
-// Value: last_seen timestamp (nanoseconds, monotonic)
+// Flow table - shared with XDP via pinning (v2.1)
+// Key: 5-tuple seen from our side (remote = external server)
+// Value: last egress timestamp, TCP state and XDP's per-flow bucket
+// Definitions must match xdp_filter.c.
+struct flow_key {
+    __u32 remote_ip;    // network byte order
+    __u32 local_ip;
+    __u16 remote_port;  // host byte order
+    __u16 local_port;
+    __u8  proto;
+    __u8  pad[3];
+};
+
+struct flow_state {
+    __u64 last_seen;    // Last egress packet (ns)
+    __u64 tokens;       // Per-flow bucket, refilled by XDP on ingress
+    __u64 last_refill;
+    __u32 state;        // FLOW_*
+    __u32 pad;
+};
+
+#define FLOW_UDP         0
+#define FLOW_SYN_SENT    1
+#define FLOW_ESTABLISHED 2
+#define FLOW_CLOSING     3
+
 struct {
     __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, 300000); // Expanded for stability
-    __type(key, __u32);    // dest_ip (network byte order)
-    __type(value, __u64);  // last_seen (ns)
+    __type(key, struct flow_key);
+    __type(value, struct flow_state);
     __uint(pinning, LIBBPF_PIN_BY_NAME);  // Pin to /sys/fs/bpf/
-} active_connections SEC(".maps");
+} flows SEC(".maps");
+
+// IPv6 flows (v2.1), keyed by exact addresses
+struct flow_key6 {
+    __u8  remote_ip[16];
+    __u8  local_ip[16];
+    __u16 remote_port;  // host byte order
+    __u16 local_port;
+    __u8  proto;
+    __u8  pad[3];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct flow_key6);
+    __type(value, struct flow_state);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} flows6 SEC(".maps");
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_ACK 0x10
+
+// Only rewrite a flow's timestamp once it is this old (or its state changes).
+// XDP's shortest flow timeout is 10s, so 1s of staleness is harmless.
+#define FLOW_REFRESH_NS (1ULL * 1000000000ULL)
+
+// Statistics for monitoring (v2.1)
+// One per-CPU struct bumped with plain adds; the loader sums the CPUs.
+// The flow_* counters show the egress map traffic and what throttling saves.
+struct tc_egress_stats {
+    __u64 total_packets;
+    __u64 tracked;       // TCP/UDP packets considered for tracking
+    __u64 tcp_tracked;
+    __u64 udp_tracked;
+    __u64 flow_inserts;  // New flows entries
+    __u64 flow_writes;   // In-place refreshes of an existing entry
+    __u64 flow_skipped;  // Refreshes skipped: fresh timestamp, same state
+};
 
-// Statistics for monitoring
 struct {
-    __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, 4);
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
     __type(key, __u32);
-    __type(value, __u64);
+    __type(value, struct tc_egress_stats);
 } tc_stats SEC(".maps");
 
-#define STAT_TRACKED_CONNECTIONS 0
-#define STAT_TCP_TRACKED         1
-#define STAT_UDP_TRACKED         2
-#define STAT_TOTAL_PACKETS       3
+// track_flow records an egress TCP/UDP packet in flows or flows6. l4 must
+// have 4 bytes of ports available; key must already hold the addresses.
+static __always_inline void track_flow(struct tc_egress_stats *st, void *map, void *key,
+                                       __u8 protocol, __u8 *l4, void *data_end) {
+    __u32 state = FLOW_UDP;
+    __u8 flags = 0;
+    if (protocol == IPPROTO_TCP) {
+        if ((void *)(l4 + 14) > data_end)
+            return;
+        flags = l4[13];
+        if (flags & (TCP_FLAG_FIN | TCP_FLAG_RST))
+            state = FLOW_CLOSING;
+        else if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN)
+            state = FLOW_SYN_SENT;
+        else
+            state = FLOW_ESTABLISHED;
+    }
+
+    // Update protocol-specific stats
+    st->tracked += 1;
+    if (protocol == IPPROTO_TCP)
+        st->tcp_tracked += 1;
+    else
+        st->udp_tracked += 1;
+
+    // Record this flow as active. The entry is shared with every XDP
+    // CPU, so leave its cache line alone unless something changed.
+    __u64 now = bpf_ktime_get_ns();
+    struct flow_state *flow = bpf_map_lookup_elem(map, key);
+    if (flow) {
+        // A new SYN restarts the handshake; otherwise only move forward,
+        // since XDP promotes SYN_SENT on the SYN-ACK
+        int advance = state != flow->state && (state == FLOW_SYN_SENT || state > flow->state);
+        if (advance || now - flow->last_seen >= FLOW_REFRESH_NS) {
+            flow->last_seen = now;
+            if (advance)
+                flow->state = state;
+            st->flow_writes += 1;
+        } else {
+            st->flow_skipped += 1;
+        }
+    } else {
+        struct flow_state new_flow = { .last_seen = now, .state = state };
+        bpf_map_update_elem(map, key, &new_flow, BPF_ANY);
+        st->flow_inserts += 1;
+    }
+}
+
+// track_ipv6 handles IPv6 egress. Only TCP/UDP directly after the fixed
+// header is tracked; our own stack does not add extension headers to them.
+static __always_inline int track_ipv6(struct ipv6hdr *ip6, void *data_end) {
+    if ((void *)(ip6 + 1) > data_end)
+        return TC_ACT_OK;
+
+    // Skip link-local fe80::/10, unique local fc00::/7, multicast ff00::/8 and ::1
+    __u8 *daddr = (__u8 *)&ip6->daddr;
+    if ((daddr[0] == 0xFE && (daddr[1] & 0xC0) == 0x80) || (daddr[0] & 0xFE) == 0xFC || daddr[0] == 0xFF)
+        return TC_ACT_OK;
+    if (ip6->daddr.in6_u.u6_addr32[0] == 0 && ip6->daddr.in6_u.u6_addr32[1] == 0 &&
+        ip6->daddr.in6_u.u6_addr32[2] == 0 && ip6->daddr.in6_u.u6_addr32[3] == bpf_htonl(1))
+        return TC_ACT_OK;
+
+    __u32 zero = 0;
+    struct tc_egress_stats *st = bpf_map_lookup_elem(&tc_stats, &zero);
+    if (!st)
+        return TC_ACT_OK;
+    st->total_packets += 1;
+
+    __u8 protocol = ip6->nexthdr;
+    if (protocol != IPPROTO_TCP && protocol != IPPROTO_UDP)
+        return TC_ACT_OK;
+
+    __u8 *l4 = (void *)(ip6 + 1);
+    if ((void *)(l4 + 4) > data_end)
+        return TC_ACT_OK;
+
+    struct flow_key6 key = {
+        .remote_port = ((__u16)l4[2] << 8) | l4[3],
+        .local_port = ((__u16)l4[0] << 8) | l4[1],
+        .proto = protocol,
+    };
+    __builtin_memcpy(key.remote_ip, &ip6->daddr, 16);
+    __builtin_memcpy(key.local_ip, &ip6->saddr, 16);
+    track_flow(st, &flows6, &key, protocol, l4, data_end);
+    return TC_ACT_OK;
+}
 
 SEC("tc")
 int tc_egress_track(struct __sk_buff *skb) {
@@ -48,7 +193,8 @@ int tc_egress_track(struct __sk_buff *skb) {
     if ((void *)(eth + 1) > data_end)
         return TC_ACT_OK;
     
-    // Only process IPv4
+    if (eth->h_proto == bpf_htons(ETH_P_IPV6))
+        return track_ipv6((void *)(eth + 1), data_end);
     if (eth->h_proto != bpf_htons(ETH_P_IP))
         return TC_ACT_OK;
     
@@ -78,34 +224,33 @@ int tc_egress_track(struct __sk_buff *skb) {
         return TC_ACT_OK;
     
     // Update statistics
-    __u32 stat_key = STAT_TOTAL_PACKETS;
-    __u64 *cnt = bpf_map_lookup_elem(&tc_stats, &stat_key);
-    if (cnt) __sync_fetch_and_add(cnt, 1);
+    __u32 zero = 0;
+    struct tc_egress_stats *st = bpf_map_lookup_elem(&tc_stats, &zero);
+    if (!st)
+        return TC_ACT_OK;
+    st->total_packets += 1;
     
     // Track based on protocol
     __u8 protocol = ip->protocol;
     
     if (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) {
-        // Record this destination IP as an active connection
-        __u64 now = bpf_ktime_get_ns();
-        
-        // Update or insert the connection
-        bpf_map_update_elem(&active_connections, &dest_ip, &now, BPF_ANY);
-        
-        // Update protocol-specific stats
-        stat_key = STAT_TRACKED_CONNECTIONS;
-        cnt = bpf_map_lookup_elem(&tc_stats, &stat_key);
-        if (cnt) __sync_fetch_and_add(cnt, 1);
-        
-        if (protocol == IPPROTO_TCP) {
-            stat_key = STAT_TCP_TRACKED;
-            cnt = bpf_map_lookup_elem(&tc_stats, &stat_key);
-            if (cnt) __sync_fetch_and_add(cnt, 1);
-        } else {
-            stat_key = STAT_UDP_TRACKED;
-            cnt = bpf_map_lookup_elem(&tc_stats, &stat_key);
-            if (cnt) __sync_fetch_and_add(cnt, 1);
-        }
+        // Non-first fragments carry no ports to key the flow on
+        if (ip->frag_off & bpf_htons(0x1FFF))
+            return TC_ACT_OK;
+
+        __u8 ihl = (*((__u8 *)ip)) & 0x0F;
+        __u8 *l4 = (void *)ip + (ihl * 4);
+        if ((void *)(l4 + 4) > data_end)
+            return TC_ACT_OK;
+
+        struct flow_key key = {
+            .remote_ip = dest_ip,
+            .local_ip = ip->saddr,
+            .remote_port = ((__u16)l4[2] << 8) | l4[3],
+            .local_port = ((__u16)l4[0] << 8) | l4[1],
+            .proto = protocol,
+        };
+        track_flow(st, &flows, &key, protocol, l4, data_end);
     }
     
     // Always allow the packet to pass (we're just tracking)
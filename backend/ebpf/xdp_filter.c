@@ -3,6 +3,7 @@
 #include <linux/bpf.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/in.h>
 #include <linux/udp.h>
 #include <linux/tcp.h>
@@ -16,7 +17,7 @@
 // 1. Private Network + Management Ports (SSH, WireGuard) -> PASS
 // 2. Whitelist -> PASS
 // 3. Blacklist -> DROP
-// 4. Connection Tracking (Response from servers we connected to) -> PASS
+// 4. Connection Tracking (Return traffic of flows we opened) -> PASS
 // 5. Steam A2S Query -> PASS
 // 6. PPS Rate Limit -> DROP if exceeded
 // 7. GeoIP -> DROP if not in allowed countries
@@ -37,13 +38,20 @@ struct {
     __uint(max_entries, 300000); // Optimized for 2CPU VPS
     __type(key, __u32);
     __type(value, struct packet_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
 } ip_stats SEC(".maps");
 
 // Ring Buffer Event
+// Only carries drops that did not fit in event_counts; count is the sampling
+// weight, i.e. how many drops this one record stands for.
+// Attack mode transitions (reason EVENT_ATTACK_MODE) reuse the layout: src_ip
+// is the new mode, count and aux the window's packets/s and Mbit/s.
 struct event_data {
     __u32 src_ip;
     __u32 reason;
     __u64 timestamp;
+    __u32 count;
+    __u32 aux;
 };
 
 struct {
@@ -51,6 +59,30 @@ struct {
     __uint(max_entries, 256 * 1024); // 256KB Ring Buffer
 } events SEC(".maps");
 
+// Per-CPU drop counters, drained by userspace every aggregation interval
+struct event_key {
+    __u32 src_ip;
+    __u32 reason;
+};
+
+struct event_count {
+    __u64 count;
+    __u64 first_seen;
+    __u64 last_seen;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, struct event_key);
+    __type(value, struct event_count);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} event_counts SEC(".maps");
+
+#define EVENT_WAKEUP_BYTES   (64 * sizeof(struct event_data)) // Wake the reader once this much is queued
+#define EVENT_SAMPLE_STEP    (32 * 1024) // Each 32KB of backlog halves the overflow sampling rate
+#define EVENT_SAMPLE_MAX_SHIFT 7         // At most 1 in 128
+
 // LPM Trie Key
 struct lpm_key {
     __u32 prefixlen;
@@ -86,8 +118,32 @@ struct block_entry {
 #define BLOCK_REASON_RATE_LIMIT 2
 #define BLOCK_REASON_GEOIP      3
 #define BLOCK_REASON_FLOOD      4
+#define BLOCK_REASON_SIGNATURE  5
+
+// Blacklist /32 fast path (v2.1)
+// Nearly every block is a single host. Manual blocks from the loader go to
+// manual_hosts, a preallocated plain hash that never evicts, so no number of
+// auto-blocks can push an operator block out. Rate-limit auto-blocks from
+// this program go to blocked_hosts, a preallocated LRU hash that never
+// allocates under attack. Each is one exact-match lookup, manual first.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u32);
+    __type(value, struct block_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} manual_hosts SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 300000);
+    __type(key, __u32);
+    __type(value, struct block_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} blocked_hosts SEC(".maps");
 
 // Blacklist (block) - Now with TTL support
+// Only real prefixes (shorter than /32) live here since v2.1
 struct {
     __uint(type, BPF_MAP_TYPE_LPM_TRIE);
     __uint(max_entries, 300000); // Expanded
@@ -96,25 +152,122 @@ struct {
     __type(value, struct block_entry);
 } blocked_ips SEC(".maps");
 
-// GeoIP allowed countries
+// GeoIP allowed countries (v2.1: map-in-map)
+// Slot 0 points at the active LPM trie. The loader fills a fresh inner trie
+// off to the side and swaps it in with one update, so a refresh never
+// exposes a half-populated trie and stale prefixes go away with the old one.
 struct {
-    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
-    __uint(max_entries, 600000);
-    __uint(map_flags, BPF_F_NO_PREALLOC);
-    __type(key, struct lpm_key);
-    __type(value, __u32);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(max_entries, 600000);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+        __type(key, struct lpm_key);
+        __type(value, __u32);
+    });
 } geo_allowed SEC(".maps");
 
-// Active connections (TC egress tracking)
+// GeoIP /24 bitmap (v2.1, optional engine)
+// One bit pair per /24 block: "full" means the whole /24 is allowed, "mixed"
+// means only part of it is, and the remaining sub-/24 prefixes live in
+// geo_allowed. A lookup is then a single array load for the common case
+// instead of a trie walk. Swapped in the same way as geo_allowed; when no
+// bitmap is published the filter uses the trie alone.
+struct geo_word {
+    __u64 full;
+    __u64 mixed;
+};
+
+#define GEO_BITMAP_WORDS ((1 << 24) / 64)
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_ARRAY);
+        __uint(max_entries, GEO_BITMAP_WORDS);
+        __type(key, __u32);
+        __type(value, struct geo_word);
+    });
+} geo_bitmap SEC(".maps");
+
+// Unified policy trie (v2.1)
+// The loader compiles whitelist, blacklist and GeoIP prefixes into one trie
+// whose value carries the union of flags of every prefix covering it, so a
+// single longest-prefix match answers all three. 0.0.0.0/0 is always present,
+// which makes every lookup hit; RULE_GEO_LOADED on it says the trie carries
+// GeoIP. White_list/blocked_ips remain the fallback when nothing is published;
+// single-host blocks always stay in manual_hosts/blocked_hosts.
+#define RULE_ALLOW      1
+#define RULE_BLOCK      2
+#define RULE_GEO        4  // inside an allowed country
+#define RULE_GEO_LOADED 8
+
+struct policy_rule {
+    __u32 flags;       // RULE_*
+    __u32 pad;
+    __u64 expires_at;  // RULE_BLOCK expiry, 0 = permanent
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(max_entries, 1000000);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+        __type(key, struct lpm_key);
+        __type(value, struct policy_rule);
+    });
+} policy_rules SEC(".maps");
+
+// Connection tracking flow table (v2.1, TC egress tracking)
+// One entry per 5-tuple we sent traffic on, written by tc_egress_track and
+// read here. Only return traffic of that exact flow is bypassed, subject to
+// TCP state and a per-flow token bucket, instead of everything from the
+// remote IP. Definitions must match tc_egress.c.
+struct flow_key {
+    __u32 remote_ip;    // network byte order
+    __u32 local_ip;
+    __u16 remote_port;  // host byte order
+    __u16 local_port;
+    __u8  proto;
+    __u8  pad[3];
+};
+
+struct flow_state {
+    __u64 last_seen;    // Last egress packet (ns)
+    __u64 tokens;       // Per-flow bucket, refilled on ingress
+    __u64 last_refill;
+    __u32 state;        // FLOW_*
+    __u32 pad;
+};
+
+#define FLOW_UDP         0
+#define FLOW_SYN_SENT    1
+#define FLOW_ESTABLISHED 2
+#define FLOW_CLOSING     3
+
 struct {
     __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, 300000); // Expanded for stability
-    __type(key, __u32);
-    __type(value, __u64);
+    __type(key, struct flow_key);
+    __type(value, struct flow_state);
     __uint(pinning, LIBBPF_PIN_BY_NAME);
-} active_connections SEC(".maps");
+} flows SEC(".maps");
 
-#define CONN_TRACK_TTL_NS (180ULL * 1000000000ULL)
+#define CONN_TRACK_TTL_NS   (180ULL * 1000000000ULL)  // UDP and established TCP
+#define FLOW_SYN_TTL_NS     (10ULL * 1000000000ULL)   // Unanswered SYN
+#define FLOW_CLOSING_TTL_NS (10ULL * 1000000000ULL)   // After FIN/RST
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_ACK 0x10
 
 // Rate limiting
 struct rate_limit_entry {
@@ -127,404 +280,2753 @@ struct {
     __uint(max_entries, 100000);
     __type(key, __u32);
     __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
 } rate_limits SEC(".maps");
 
-// Global statistics
+// Per-CPU rate limiting (v2.1)
+// Each CPU refills its own bucket at rate_limit_cpu_pps, so RX queues never
+// share a cache line or lose updates for a hot source. A source whose packets
+// land on k CPUs may pass up to k * rate_limit_cpu_pps.
 struct {
-    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-    __uint(max_entries, 8);
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, 100000);
     __type(key, __u32);
-    __type(value, __u64);
-} global_stats SEC(".maps");
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} rate_limits_percpu SEC(".maps");
 
-#define STAT_TOTAL_PACKETS 0
-#define STAT_TOTAL_BYTES   1
-#define STAT_BLOCKED       2
-#define STAT_ALLOWED       3
-#define STAT_RATE_LIMITED  4
-#define STAT_CONN_BYPASS   5
-#define STAT_GEOIP_BLOCKED 6
-#define STAT_PKT_INVALID   7  // v1.15.0: Invalid packets dropped
+#define RATE_LIMIT_GLOBAL 0  // One bucket per source in rate_limits
+#define RATE_LIMIT_PERCPU 1  // One bucket per source and CPU in rate_limits_percpu
+
+// Per-prefix rate limiting (v2.1)
+// Every source also spends a token from the bucket of its /24 (IPv6: /48),
+// at net_rate_pps. The prefix is checked first, so a flood rotating through
+// the addresses of a few prefixes drops on a handful of prefix buckets
+// without ever creating or evicting per-source ones. Prefix buckets follow
+// rate_limit_mode like the per-source ones.
+#define NET4_MASK 0x00FFFFFF          // /24 of a network-order IPv4 address
+#define NET6_MASK 0x0000FFFFFFFFFFFFULL // /48 of the first 8 IPv6 bytes, as loaded
 
-// Configuration
 struct {
-    __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, 8);  // Increased for new features
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
     __type(key, __u32);
-    __type(value, __u32);
-} config SEC(".maps");
-
-#define CONFIG_HARD_BLOCKING      0
-#define CONFIG_RATE_LIMIT_PPS     1
-#define CONFIG_ENABLE_BLOCK_TTL   2  // v1.15.0: Enable Block Map TTL
-#define CONFIG_BLOCK_TTL_SECONDS  3  // v1.15.0: TTL in seconds (default 300)
-#define CONFIG_ENABLE_PKT_VALIDATION 4  // v1.15.0: Enable Packet Validation
-
-// Port stats (optional, for monitoring)
-struct port_stats {
-    __u64 packets;
-    __u64 bytes;
-};
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} net_limits SEC(".maps");
 
 struct {
-    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
     __uint(max_entries, 65536);
-    __type(key, __u16);
-    __type(value, struct port_stats);
-} port_stats SEC(".maps");
+    __type(key, __u32);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} net_limits_percpu SEC(".maps");
 
-// ============================================================
-// PACKET PARSER
-// ============================================================
-static __always_inline int parse_ip_packet(struct xdp_md *ctx, __u32 *src_ip, __u16 *protocol, __u16 *dst_port, __u16 *src_port) {
-    void *data_end = (void *)(long)ctx->data_end;
-    void *data = (void *)(long)ctx->data;
-    struct ethhdr *eth = data;
+// Bandwidth and packet-size limits (v2.1)
+// Byte buckets hold up to one second of their rate and are charged
+// pkt_size per packet: byte_limits per source (IPv6: per /64) at
+// rate_limit_bps, and global_bytes, one bucket per CPU at global_cpu_bps,
+// charged in the accounting step for packets every filter has passed. Packets up to
+// SIZE_TINY_MAX and from SIZE_LARGE_MIN bytes also spend a token from the
+// source's bucket for their size class in size_limits (size_limits6 per /64).
+#define SIZE_TINY_MAX  128   // Frame bytes: bare headers, SYN/ACK and empty UDP floods
+#define SIZE_LARGE_MIN 1200  // Near-MTU frames: amplification and bandwidth floods
+#define SIZE_TINY      1
+#define SIZE_LARGE     2
 
-    if ((void *)(eth + 1) > data_end) return -1;
-    if (eth->h_proto != bpf_htons(ETH_P_IP)) return -1;
+struct size_limit_key {
+    __u32 src_ip;
+    __u32 class;   // SIZE_*
+};
 
-    struct iphdr *ip = (void *)(eth + 1);
-    if ((void *)(ip + 1) > data_end) return -1;
+struct size_limit_key6 {
+    __u64 net;     // Source /64
+    __u32 class;   // SIZE_*
+    __u32 pad;
+};
 
-    __u8 ihl = (*((__u8 *)ip)) & 0x0F;
-    if (ihl < 5) return -1;
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u32);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} byte_limits SEC(".maps");
 
-    *src_ip = ip->saddr;
-    *protocol = ip->protocol;
-    *dst_port = 0;
-    *src_port = 0;
-
-    int ip_len = ihl * 4;
-    void *l4_header = (void *)ip + ip_len;
-    if (l4_header > data_end) return 0;
-
-    // Handle Fragmentation: If offset > 0, we might not have L4 header
-    __u16 frag_off = bpf_ntohs(ip->frag_off);
-    if ((frag_off & 0x1FFF) > 0) {
-        // This is a fragment (not the first one).
-        // It likely doesn't have ports at the beginning of payload.
-        // We return 0 (success) but ports remain 0.
-        return 0;
-    }
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u64);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} byte_limits6 SEC(".maps");
 
-    if (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) {
-        if (l4_header + 4 > data_end) return 0;
-        __u8 *ports = (__u8 *)l4_header;
-        *src_port = ((__u16)ports[0] << 8) | ports[1];
-        *dst_port = ((__u16)ports[2] << 8) | ports[3];
-    }
-    return 0;
-}
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct rate_limit_entry);
+} global_bytes SEC(".maps");
 
-// ============================================================
-// PACKET VALIDATION (v1.15.0)
-// ============================================================
-// Returns 0 if valid, -1 if invalid
-static __always_inline int validate_packet(struct xdp_md *ctx) {
-    void *data_end = (void *)(long)ctx->data_end;
-    void *data = (void *)(long)ctx->data;
-    struct ethhdr *eth = data;
-    
-    if ((void *)(eth + 1) > data_end) return -1;
-    if (eth->h_proto != bpf_htons(ETH_P_IP)) return 0; // Skip non-IPv4
-    
-    struct iphdr *ip = (void *)(eth + 1);
-    if ((void *)(ip + 1) > data_end) return -1;
-    
-    // 1. IP Version must be 4
-    __u8 version = (*((__u8 *)ip)) >> 4;
-    if (version != 4) return -1;
-    
-    // 2. IP Header Length must be >= 5 (20 bytes)
-    __u8 ihl = (*((__u8 *)ip)) & 0x0F;
-    if (ihl < 5) return -1;
-    
-    // 3. Total Length must be >= 20
-    __u16 total_len = bpf_ntohs(ip->tot_len);
-    if (total_len < 20) return -1;
-    
-    // 4. TTL must be non-zero (TTL 0 is invalid)
-    if (ip->ttl == 0) return -1;
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct size_limit_key);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} size_limits SEC(".maps");
 
-    // Check for Fragmentation
-    __u16 frag_off = bpf_ntohs(ip->frag_off);
-    if ((frag_off & 0x1FFF) > 0) {
-        // Fragmented packet (offset > 0). 
-        // Cannot validate L4 headers as they might not be present.
-        return 0; 
-    }
-    
-    // 5. UDP specific: Length must be >= 8
-    if (ip->protocol == IPPROTO_UDP) {
-        int ip_len = ihl * 4;
-        void *udp_hdr = (void *)ip + ip_len;
-        if (udp_hdr + 8 > data_end) return -1;
-        
-        __u16 udp_len = ((__u16)((__u8 *)udp_hdr)[4] << 8) | ((__u8 *)udp_hdr)[5];
-        if (udp_len < 8) return -1;
-    }
-    
-    return 0;
-}
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct size_limit_key6);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} size_limits6 SEC(".maps");
 
-// ============================================================
-// MAIN XDP FILTER
-// ============================================================
-// ============================================================
-// EVENT RECORDING
-// ============================================================
-static __always_inline void record_event(__u32 src_ip, __u32 reason) {
-    struct event_data *e = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
-    if (e) {
-        e->src_ip = src_ip;
-        e->reason = reason;
-        e->timestamp = bpf_ktime_get_ns();
-        bpf_ringbuf_submit(e, 0);
-    }
-}
+// Attack signatures (v2.1)
+// models.AttackSignature rows compiled by the loader. sig_rules is keyed by
+// protocol and ports, with 0 as the wildcard; a packet is looked up under at
+// most four key shapes, most specific first, and only the shapes that have
+// entries (policy signature_shapes). Each key holds a few rules that may add
+// a payload-prefix match; the first rule that matches decides. Per-rule PPS
+// buckets and hit counters are per-CPU arrays indexed by the rule's slot.
+#define SIG_SLOTS       64
+#define SIG_SET_MAX     4
+#define SIG_PAYLOAD_MAX 16
 
-SEC("xdp")
-int xdp_traffic_filter(struct xdp_md *ctx) {
-    __u32 src_ip = 0;
-    __u16 protocol = 0;
-    __u16 dst_port = 0;
-    __u16 src_port = 0;
-    __u32 key;
+#define SIG_ACTION_LOG        0
+#define SIG_ACTION_RATE_LIMIT 1
+#define SIG_ACTION_BLOCK      2
 
-    if (parse_ip_packet(ctx, &src_ip, &protocol, &dst_port, &src_port) < 0)
-        return XDP_PASS;
+#define SIG_SHAPE_BOTH 1  // src_port and dst_port
+#define SIG_SHAPE_SRC  2  // src_port only
+#define SIG_SHAPE_DST  4  // dst_port only
+#define SIG_SHAPE_ANY  8  // protocol only
 
-    __u64 pkt_size = (void *)(long)ctx->data_end - (void *)(long)ctx->data;
+struct sig_key {
+    __u16 src_port;  // Host byte order, 0 = any
+    __u16 dst_port;
+    __u8 protocol;
+    __u8 pad[3];
+};
 
-    // ============================================================
-    // 0. WIREGUARD BYPASS (HIGHEST PRIORITY)
-    // ============================================================
-    // WireGuard MUST work regardless of any other filter
-    if (protocol == IPPROTO_UDP) {
-        if (dst_port == 51820 || src_port == 51820) {
-            return XDP_PASS;
-        }
-    }
+struct sig_rule {
+    __u16 slot;         // Index into sig_buckets/sig_hits
+    __u8 action;        // SIG_ACTION_*
+    __u8 payload_len;   // 0 = ports only
+    __u8 payload[SIG_PAYLOAD_MAX];
+};
 
-    // ============================================================
-    // 0.5 PACKET VALIDATION (v1.15.0) - Drop invalid packets early
-    // ============================================================
-    __u32 pv_key = CONFIG_ENABLE_PKT_VALIDATION;
-    __u32 *pkt_validation_enabled = bpf_map_lookup_elem(&config, &pv_key);
-    if (pkt_validation_enabled && *pkt_validation_enabled == 1) {
-        if (validate_packet(ctx) < 0) {
-            key = STAT_PKT_INVALID;
-            __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-            if (cnt) *cnt += 1;
-            // Record event for invalid packet? Maybe too noisy.
-            return XDP_DROP;
-        }
-    }
+struct sig_set {
+    __u32 count;
+    __u32 pad;
+    struct sig_rule rules[SIG_SET_MAX];
+};
 
-    // ============================================================
-    // 1. ESSENTIAL BYPASSES (Always Pass)
-    // ============================================================
-    // Private Networks
-    __u32 ip_h = bpf_ntohl(src_ip);
-    if ((ip_h & 0xFF000000) == 0x0A000000) return XDP_PASS; // 10.0.0.0/8
-    if ((ip_h & 0xFFF00000) == 0xAC100000) return XDP_PASS; // 172.16.0.0/12
-    if ((ip_h & 0xFFFF0000) == 0xC0A80000) return XDP_PASS; // 192.168.0.0/16
-    if ((ip_h & 0xFF000000) == 0x7F000000) return XDP_PASS; // 127.0.0.0/8
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 256);
+    __type(key, struct sig_key);
+    __type(value, struct sig_set);
+} sig_rules SEC(".maps");
 
-    // Management Ports (SSH, Admin Panel, Web UI)
-    if (dst_port == 22 || dst_port == 8080 || dst_port == 80 || dst_port == 443) return XDP_PASS;
+// tokens/last_update per signature and CPU; rate is the per-CPU share
+struct sig_bucket {
+    __u64 tokens;
+    __u64 last_update;
+    __u32 rate;
+    __u32 pad;
+};
 
-    // ============================================================
-    // 2. WHITELIST -> PASS
-    // ============================================================
-    struct lpm_key w_key;
-    set_key_ipv4(&w_key, src_ip);
-    if (bpf_map_lookup_elem(&white_list, &w_key)) {
-        key = STAT_ALLOWED;
-        __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-        if (cnt) *cnt += 1;
-        return XDP_PASS;
-    }
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, SIG_SLOTS);
+    __type(key, __u32);
+    __type(value, struct sig_bucket);
+} sig_buckets SEC(".maps");
 
-    // ============================================================
-    // 3. BLACKLIST -> DROP (with TTL support v1.15.0)
-    // ============================================================
-    struct lpm_key b_key;
-    set_key_ipv4(&b_key, src_ip);
-    struct block_entry *blocked = bpf_map_lookup_elem(&blocked_ips, &b_key);
-    if (blocked) {
-        __u64 now = bpf_ktime_get_ns();
-        // Check if entry has expired (expires_at > 0 means TTL-based)
-        if (blocked->expires_at > 0 && now >= blocked->expires_at) {
-            // Entry has expired - delete it
-            bpf_map_delete_elem(&blocked_ips, &b_key);
-        } else {
-            // Still blocked (permanent or not expired)
-            key = STAT_BLOCKED;
-            __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-            if (cnt) *cnt += 1;
-            // record_event(src_ip, blocked->reason); // Too noisy for already blocked
-            return XDP_DROP;
-        }
-    }
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, SIG_SLOTS);
+    __type(key, __u32);
+    __type(value, __u64);
+} sig_hits SEC(".maps");
 
-    // ============================================================
-    // 4. CONNECTION TRACKING (Response Bypass)
-    // ============================================================
-    // If source IP is a server we recently connected to, bypass
-    __u64 *conn_last_seen = bpf_map_lookup_elem(&active_connections, &src_ip);
-    if (conn_last_seen) {
-        __u64 now = bpf_ktime_get_ns();
-        if ((now - *conn_last_seen) < CONN_TRACK_TTL_NS) {
-            key = STAT_CONN_BYPASS;
-            __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-            if (cnt) *cnt += 1;
-            return XDP_PASS;
-        }
-    }
+// Verdict reasons (index into xdp_stats.verdicts)
+#define VERDICT_WIREGUARD    0
+#define VERDICT_MAINTENANCE  1
+#define VERDICT_INVALID      2
+#define VERDICT_PRIVATE      3
+#define VERDICT_MGMT_PORT    4
+#define VERDICT_WHITELIST    5
+#define VERDICT_BLACKLIST    6
+#define VERDICT_CONN_BYPASS  7
+#define VERDICT_A2S          8
+#define VERDICT_RATE_LIMIT   9
+#define VERDICT_GEOIP        10
+#define VERDICT_PASS         11
+#define VERDICT_SIGNATURE    12
+#define VERDICT_REFLECTION   13
+#define VERDICT_PORT_DROP    14
+#define VERDICT_A2S_CACHED   15
+#define VERDICT_SYN_COOKIE   16  // SYN-ACK cookie sent
+#define VERDICT_SYN_DROP     17  // Unverified non-SYN to a SYN-proxied port
+#define VERDICT_IPV6_ND      18  // ICMPv6 neighbor discovery, never filtered
+#define VERDICT_FRAG_PASS    19  // Later fragment of a passed first fragment
+#define VERDICT_FRAG_DROP    20  // Later fragment of a dropped first fragment
+#define VERDICT_FRAG_ORPHAN  21  // Later fragment with no first fragment seen
+#define VERDICT_FRAG_OVERLAP 22  // Fragment overlapping data already received
+#define VERDICT_FRAG_OVERSIZE 23 // Reassembled datagram would exceed 64 KB
+#define VERDICT_NET_LIMIT    24  // Source /24 (IPv6 /48) over net_rate_pps
+#define VERDICT_BYTE_LIMIT   25  // Source over rate_limit_bps
+#define VERDICT_GLOBAL_LIMIT 26  // This CPU's share of global_cpu_bps used up
+#define VERDICT_SIZE_LIMIT   27  // Source over its size class PPS
+#define VERDICT_NO_STAGE     28  // xdp_stages empty: dropped unfiltered
+#define VERDICT_MAX          32
 
-    // ============================================================
-    // 5. STEAM A2S QUERY BYPASS
-    // ============================================================
-    if (protocol == IPPROTO_UDP) {
-        struct iphdr *ip = (void *)(long)ctx->data + sizeof(struct ethhdr);
-        if ((void *)(ip + 1) <= (void *)(long)ctx->data_end) {
-            __u8 ihl = (*((__u8 *)ip)) & 0x0F;
-            void *udp_hdr = (void *)ip + (ihl * 4);
-            if (udp_hdr + 8 <= (void *)(long)ctx->data_end) {
-                unsigned char *payload = udp_hdr + 8;
-                // Check 4 bytes signature + 1 byte type
-                if ((void *)(payload + 5) <= (void *)(long)ctx->data_end) {
-                    // Use byte comparison to avoid alignment issues
-                    if (payload[0] == 0xFF && payload[1] == 0xFF && 
-                        payload[2] == 0xFF && payload[3] == 0xFF) { 
-                        // Steam A2S signature found (0xFFFFFFFF)
-                        // This covers A2S_INFO, A2S_PLAYER, A2S_RULES, and responses
-                        
-                        key = STAT_ALLOWED;
-                        __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-                        if (cnt) *cnt += 1;
-                        return XDP_PASS;
-                    }
-                }
-            }
-        }
-    }
+// Global statistics (v2.1)
+// One per-CPU struct, looked up once per packet. Every counter is a plain
+// increment because each CPU owns its copy.
+struct xdp_stats {
+    __u64 total_packets;
+    __u64 total_bytes;
+    __u64 blocked;
+    __u64 allowed;
+    __u64 rate_limited;
+    __u64 conn_bypass;
+    __u64 geoip_blocked;
+    __u64 pkt_invalid;       // v1.15.0: Invalid packets dropped
+    __u64 acct_skipped;      // New stats entries refused by the insert budget
+    __u64 acct_held;         // Sketch mode: packets from sources still below threshold
+    __u64 block_expired;     // Expired blocks deleted on hit (userspace counts its sweep)
+    __u64 verdicts[VERDICT_MAX];
+};
 
-    // ============================================================
-    // 6. PPS RATE LIMIT -> DROP if exceeded
-    // ============================================================
-    __u32 cfg_key = CONFIG_RATE_LIMIT_PPS;
-    __u32 *rate_limit_pps = bpf_map_lookup_elem(&config, &cfg_key);
-    if (rate_limit_pps && *rate_limit_pps > 0) {
-        __u64 now = bpf_ktime_get_ns();
-        struct rate_limit_entry *rl = bpf_map_lookup_elem(&rate_limits, &src_ip);
-        
-        if (rl) {
-            __u64 elapsed = now - rl->last_update;
-            if (elapsed > 1000000000ULL) elapsed = 1000000000ULL;
-            
-            __u64 tokens_to_add = (elapsed * (*rate_limit_pps)) / 1000000000ULL;
-            __u64 new_tokens = rl->tokens + tokens_to_add;
-            if (new_tokens > *rate_limit_pps) new_tokens = *rate_limit_pps;
-            
-            if (new_tokens < 1) {
-                // === Block Map TTL: Auto-add to blocklist (v1.15.0) ===
-                __u32 ttl_key = CONFIG_ENABLE_BLOCK_TTL;
-                __u32 *ttl_enabled = bpf_map_lookup_elem(&config, &ttl_key);
-                if (ttl_enabled && *ttl_enabled == 1) {
-                    __u32 ttl_sec_key = CONFIG_BLOCK_TTL_SECONDS;
-                    __u32 *ttl_seconds = bpf_map_lookup_elem(&config, &ttl_sec_key);
-                    __u64 ttl = (ttl_seconds && *ttl_seconds > 0) ? *ttl_seconds : 300; // Default 5 min
-                    struct block_entry entry = {
-                        .expires_at = now + (ttl * 1000000000ULL),
-                        .reason = BLOCK_REASON_RATE_LIMIT,
-                        .pad = 0
-                    };
-                    struct lpm_key rl_b_key;
-                    set_key_ipv4(&rl_b_key, src_ip);
-                    bpf_map_update_elem(&blocked_ips, &rl_b_key, &entry, BPF_ANY);
-                }
-                
-                key = STAT_RATE_LIMITED;
-                __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-                if (cnt) *cnt += 1;
-                record_event(src_ip, BLOCK_REASON_RATE_LIMIT);
-                return XDP_DROP;
-            }
-            rl->tokens = new_tokens - 1;
-            rl->last_update = now;
-        } else {
-            struct rate_limit_entry new_rl = { .tokens = *rate_limit_pps - 1, .last_update = now };
-            bpf_map_update_elem(&rate_limits, &src_ip, &new_rl, BPF_ANY);
-        }
-    }
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} global_stats SEC(".maps");
 
-    // ============================================================
-    // 7. GEOIP -> DROP if not in allowed countries
-    // ============================================================
-    cfg_key = CONFIG_HARD_BLOCKING;
-    __u32 *hard_blocking = bpf_map_lookup_elem(&config, &cfg_key);
-    
-    if (hard_blocking && *hard_blocking == 1) {
-        struct lpm_key geo_key;
-        set_key_ipv4(&geo_key, src_ip);
-        if (!bpf_map_lookup_elem(&geo_allowed, &geo_key)) {
-            key = STAT_GEOIP_BLOCKED;
-            __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-            if (cnt) *cnt += 1;
-            
-            key = STAT_BLOCKED;
-            cnt = bpf_map_lookup_elem(&global_stats, &key);
-            if (cnt) *cnt += 1;
-            
-            record_event(src_ip, BLOCK_REASON_GEOIP);
-            return XDP_DROP;
-        }
-    }
+// A2S query cache (v2.1)
+// Userspace queries each game server's A2S_INFO/A2S_RULES every few seconds
+// and stores the single-packet replies by public port. XDP answers queries
+// from the cache with XDP_TX: first with a stateless challenge derived from
+// the source and a rotating secret, then with the cached reply once the
+// client echoes it. Stale or missing entries fall through to the server.
+#define A2S_REPLY_MAX    1400
+#define A2S_CACHE_TTL_NS (15ULL * 1000000000ULL)
+#define A2S_KIND_INFO    0
+#define A2S_KIND_RULES   1
+#define A2S_INFO_REQ_LEN 25  // FFFFFFFF 'T' "Source Engine Query\0"
+#define A2S_CHALLENGE_LEN 9  // FFFFFFFF 'A' <challenge>
 
-    // ============================================================
-    // 8. UPDATE STATS & PASS
-    // ============================================================
-    key = STAT_TOTAL_PACKETS;
-    __u64 *cnt = bpf_map_lookup_elem(&global_stats, &key);
-    if (cnt) *cnt += 1;
+struct a2s_key {
+    __u16 port;  // Public (destination) port, host byte order
+    __u8 kind;   // A2S_KIND_*
+    __u8 pad;
+};
 
-    key = STAT_TOTAL_BYTES;
-    cnt = bpf_map_lookup_elem(&global_stats, &key);
-    if (cnt) *cnt += pkt_size;
+struct a2s_reply {
+    __u64 updated_at;
+    __u32 len;
+    __u32 pad;
+    __u8 data[A2S_REPLY_MAX];
+};
 
-    // Per-IP stats
-    struct packet_stats *stats = bpf_map_lookup_elem(&ip_stats, &src_ip);
-    if (stats) {
-        stats->packets += 1;
-        stats->bytes += pkt_size;
-        stats->last_seen = bpf_ktime_get_ns();
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 128);
+    __type(key, struct a2s_key);
+    __type(value, struct a2s_reply);
+} a2s_cache SEC(".maps");
+
+// Challenges made under the previous secret stay valid for one rotation
+struct a2s_secret {
+    __u32 current;
+    __u32 previous;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct a2s_secret);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_secret SEC(".maps");
+
+// XDP SYN proxy (v2.1)
+// SYNs to PORT_SYNPROXY ports are answered with a kernel SYN cookie
+// (XDP_TX) and never reach netfilter. An ACK carrying a valid cookie goes
+// on to the iptables SYNPROXY target, which checks the same cookie and
+// opens the connection to the origin, so the client keeps its handshake.
+// Once the origin answers, tc_egress_track records the flow and its
+// segments pass the conntrack stage before this one; anything else drops.
+#define SYN_PROXY_MSS 1360  // Matches the MSS clamp for the tunnel
+
+// Per-port policy (v2.1)
+// One byte per destination port, written by the loader from the DB: the low
+// nibble is the PORT_* action, the high nibble a rate-limit class whose
+// per-source PPS is policy.port_class_pps[class] (class 0 = no limit).
+#define PORT_FILTER  0  // Full filter pipeline (default)
+#define PORT_BYPASS  1  // Pass after validation (management ports)
+#define PORT_GAME    2  // Full pipeline; A2S bypass is limited to game ports
+#define PORT_DROP    3  // Drop outright
+#define PORT_TUNNEL  4  // UDP passes before anything else (WireGuard)
+#define PORT_ACTION_MASK 0x07
+#define PORT_SYNPROXY    0x08  // Flag: TCP handshakes are verified in XDP first
+#define PORT_CLASS_SHIFT 4
+#define PORT_CLASSES     8
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 65536);
+    __type(key, __u32);
+    __type(value, __u8);
+} port_policy SEC(".maps");
+
+struct port_limit_key {
+    __u32 src_ip;
+    __u32 class;
+};
+
+struct port_limit_key6 {
+    __u64 net;     // Source /64
+    __u32 class;
+    __u32 pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct port_limit_key);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} port_limits SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct port_limit_key6);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} port_limits6 SEC(".maps");
+
+// IPv6 (v2.1)
+// IPv6 sources are filtered by the same policy with their own maps. A host
+// usually owns a whole /64, so rate limits, auto-blocks and stats are keyed
+// by the /64 (the first 8 address bytes, raw): rotating addresses inside a
+// prefix neither escapes the limit nor multiplies map entries. Allow, block
+// and GeoIP lists are tries over the full 128-bit address.
+struct lpm_key6 {
+    __u32 prefixlen;
+    __u8  data[16];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 20000);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct lpm_key6);
+    __type(value, __u32);
+} white_list6 SEC(".maps");
+
+// Manual blocks of any prefix length
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 100000);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct lpm_key6);
+    __type(value, struct block_entry);
+} blocked_ips6 SEC(".maps");
+
+// Auto-blocks by /64, the counterpart of blocked_hosts
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u64);
+    __type(value, struct block_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} blocked_nets6 SEC(".maps");
+
+// Block expiry (v2.1)
+// An expired block is deleted when its source sends again. Sources that
+// never come back (spoofed floods) are swept from userspace, which walks
+// the block maps a bounded batch at a time with a resumable batch lookup;
+// bpf_for_each_map_elem cannot resume, so a sweep from BPF would have to
+// visit the whole map on every run.
+
+// Attack mode tick (v2.1)
+// A BPF timer, armed by the first packet, closes attack mode windows every
+// second so an idle link still relaxes.
+#define ATTACK_TICK_NS (1000000000ULL)
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+struct attack_timer_state {
+    struct bpf_timer timer;
+    __u32 armed;
+    __u32 pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct attack_timer_state);
+} attack_timer SEC(".maps");
+
+// Attack mode (v2.1)
+// Every CPU counts the packets and bytes it receives in windows aligned to
+// a shared ~134ms epoch. The first packet of a new epoch on any CPU wins a
+// cmpxchg on attack_state and sums the window just closed over all CPUs;
+// the attack_timer tick does the same, so an idle link still relaxes.
+// ATTACK_TRIP_WINDOWS windows over a trip rate switch to attack mode, where
+// the attack_* policy overrides apply to the very next packet. Relaxing
+// takes attack_hold_seconds of windows below attack_relax_pct of the trip
+// rates. Every transition is reported as an EVENT_ATTACK_MODE record.
+#define ATTACK_WINDOW_SHIFT 27  // 2^27 ns, ~134ms
+#define ATTACK_TRIP_WINDOWS 2
+#define ATTACK_MAX_CPUS     256
+#define ATTACK_MODE_NORMAL  0
+#define ATTACK_MODE_ACTIVE  1
+#define EVENT_ATTACK_MODE   0x100  // event_data.reason of a transition record
+
+struct attack_window {
+    __u64 epoch;
+    __u64 packets;
+    __u64 bytes;
+    __u64 prev_epoch;  // The window before, until it has been summed
+    __u64 prev_packets;
+    __u64 prev_bytes;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct attack_window);
+} attack_window SEC(".maps");
+
+struct attack_state {
+    __u64 epoch;        // Last evaluated window
+    __u64 since;        // Last transition (ns)
+    __u64 last_pps;     // Ingress rates of the last evaluated window
+    __u64 last_mbps;
+    __u64 transitions;
+    __u32 mode;         // ATTACK_MODE_*
+    __u32 streak;       // Consecutive windows pointing at the other mode
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct attack_state);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} attack_state SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 200000);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct lpm_key6);
+    __type(value, __u32);
+} geo_allowed6 SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u64);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} rate_limits6 SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u64);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} rate_limits6_percpu SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u64);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} net_limits6 SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u64);
+    __type(value, struct rate_limit_entry);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} net_limits6_percpu SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, __u64);
+    __type(value, struct packet_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} ip6_stats SEC(".maps");
+
+// Flows we opened over IPv6, written by tc_egress_track. Exact addresses:
+// return traffic must come from the host we talked to.
+struct flow_key6 {
+    __u8  remote_ip[16];
+    __u8  local_ip[16];
+    __u16 remote_port;  // host byte order
+    __u16 local_port;
+    __u8  proto;
+    __u8  pad[3];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 100000);
+    __type(key, struct flow_key6);
+    __type(value, struct flow_state);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} flows6 SEC(".maps");
+
+#define IPV6_NEXTHDR_HOP      0
+#define IPV6_NEXTHDR_ROUTING  43
+#define IPV6_NEXTHDR_FRAGMENT 44
+#define IPV6_NEXTHDR_DEST     60
+#define IPV6_EXT_MAX          4  // Extension headers walked before giving up on L4
+
+// IPv4 fragment tracking (v2.1)
+// Only the first fragment carries the ports, so it goes through the full
+// pipeline and its verdict is cached per datagram. Later fragments take
+// that verdict instead of being filtered on the source address alone; ones
+// with no cached first fragment are orphans and dropped. bytes/end catch
+// overlapping fragments: disjoint fragments never add up past the highest
+// offset seen. Shared LRU, since RSS may hash the first fragment (with
+// ports) and the rest (without) to different CPUs.
+#define FRAG_NONE   0
+#define FRAG_FIRST  1
+#define FRAG_LATER  2
+#define FRAG_TTL_NS (30ULL * 1000000000ULL) // Kernel ipfrag_time default
+#define FRAG_MAX_END (0xFFFF - sizeof(struct iphdr))
+
+struct frag_key {
+    __u32 src_ip;
+    __u32 dst_ip;
+    __u16 id;
+    __u8 proto;
+    __u8 pad;
+};
+
+struct frag_state {
+    __u64 first_seen;
+    __u32 bytes;      // Fragment payload received so far
+    __u32 end;        // Highest payload end seen
+    __u32 action;     // XDP_PASS or XDP_DROP for the rest of the datagram
+    __u32 pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, struct frag_key);
+    __type(value, struct frag_state);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} frag_states SEC(".maps");
+
+// Runtime policy (v2.1)
+// Every knob the fast path needs lives in one value that is read once per
+// packet. The Go loader publishes a complete policy with a single update.
+struct xdp_policy {
+    __u32 hard_blocking;          // 1 = drop sources outside geo_allowed
+    __u32 rate_limit_pps;         // Per-IP PPS limit, 0 = disabled
+    __u32 enable_block_ttl;       // 1 = auto-block rate limited IPs
+    __u32 block_ttl_seconds;      // TTL for auto-blocks (0 = default 300)
+    __u32 enable_pkt_validation;  // 1 = drop malformed packets
+    __u32 maintenance_mode;       // 1 = bypass all filtering
+    __u32 stats_mode;             // STATS_MODE_* for ip_stats/port_stats
+    __u32 stats_sample_rate;      // 1-in-N sampling (power of two)
+    __u32 stats_sketch_threshold; // Sketch mode: packets/window before insert
+    __u32 stats_insert_budget;    // New ip_stats/port_stats entries per CPU per second, 0 = unlimited
+    __u32 heavy_hitters;          // 1 = maintain the per-CPU top-K talker table
+    __u32 policy_trie;            // 1 = answer allow/block/GeoIP from policy_rules
+    __u32 block_prefixes;         // Entries in blocked_ips, 0 = skip the trie
+    __u32 rate_limit_mode;        // RATE_LIMIT_*
+    __u32 rate_limit_cpu_pps;     // Per-CPU bucket size in RATE_LIMIT_PERCPU mode
+    __u32 flow_rate_pps;          // Return traffic bypassed per flow per second, 0 = unlimited
+    __u32 signature_shapes;       // SIG_SHAPE_* present in sig_rules, 0 = no signatures
+    __u32 reflection_filter;      // 1 = drop unsolicited UDP from reflection_ports
+    __u32 game_ports;             // 1 = port_policy marks game ports (scopes the A2S bypass)
+    __u32 port_class_pps[PORT_CLASSES]; // Per-source PPS per port rate-limit class
+    __u32 a2s_cache;              // 1 = answer cached A2S queries with XDP_TX
+    __u32 syn_proxy;              // 1 = SYN cookies on PORT_SYNPROXY ports
+    __u32 block6_prefixes;        // Entries in blocked_ips6, 0 = skip the trie
+    __u32 geo6_loaded;            // 1 = geo_allowed6 holds the allowed countries
+    __u32 frag_filter;            // 1 = later fragments follow the first fragment's verdict
+    __u32 capture_rate;           // Redirect 1-in-N drops to capture_xsks (power of two), 0 = off
+    __u32 capture_proto;          // Capture filter: IP protocol, 0 = any
+    __u32 capture_port;           // Capture filter: source or destination port, 0 = any
+    __u32 capture_host;           // Capture filter: IPv4 source or destination, 0 = any
+    __u32 attack_trip_pps;        // Ingress PPS that trips attack mode, 0 = no PPS trigger
+    __u32 attack_trip_mbps;       // Ingress Mbit/s that trips attack mode, 0 = no bandwidth trigger
+    __u32 attack_relax_pct;       // Relax below this % of the trip rates (0 = 50)
+    __u32 attack_hold_seconds;    // Calm time before relaxing (0 = 30)
+    __u32 attack_rate_pps;        // Per-source PPS limit in attack mode, 0 = keep rate_limit_pps
+    __u32 attack_rate_cpu_pps;    // Per-CPU bucket size in attack mode with RATE_LIMIT_PERCPU
+    __u32 attack_hard_geo;        // 1 = hard GeoIP blocking in attack mode
+    __u32 attack_flow_ttl;        // Conntrack bypass TTL in attack mode (seconds), 0 = keep
+    __u32 net_rate_pps;           // Per-/24 (IPv6 /48) PPS limit, 0 = disabled
+    __u32 net_rate_cpu_pps;       // Per-CPU prefix bucket size in RATE_LIMIT_PERCPU mode
+    __u32 rate_limit_bps;         // Per-source bytes/s (IPv6: per /64), 0 = disabled
+    __u32 global_cpu_bps;         // Ingress bytes/s per CPU over all sources, 0 = disabled
+    __u32 size_tiny_pps;          // Per-source PPS of frames up to SIZE_TINY_MAX bytes, 0 = disabled
+    __u32 size_large_pps;         // Per-source PPS of frames from SIZE_LARGE_MIN bytes, 0 = disabled
+};
+
+// AF_XDP capture (v2.1)
+// While a capture runs, sampled drops matching the capture filter go to the
+// AF_XDP socket of their RX queue instead of being dropped, and userspace
+// writes them to a pcapng file. Passed packets are never redirected: XDP
+// cannot clone a packet, and a redirected one would not reach the stack.
+#define CAPTURE_XSKS_MAX 64
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, CAPTURE_XSKS_MAX);
+    __type(key, __u32);
+    __type(value, __u32);
+} capture_xsks SEC(".maps");
+
+// Reflection source ports (v2.1)
+// One bit per UDP source port (DNS, NTP, SSDP, ...), written by the loader
+// from the builtin reflection signatures before the program is loaded. It
+// lives in .rodata, so testing a port is a plain load with no map lookup.
+const volatile __u64 reflection_ports[65536 / 64] = {};
+
+#define STATS_MODE_FULL   0  // Account every passed packet
+#define STATS_MODE_SAMPLE 1  // Account 1-in-N packets, weighted by N
+#define STATS_MODE_SKETCH 2  // Insert sources only after they pass a sketch threshold
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_policy);
+} policy SEC(".maps");
+
+// Port stats (optional, for monitoring)
+struct port_stats {
+    __u64 packets;
+    __u64 bytes;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u16);
+    __type(value, struct port_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} port_stats SEC(".maps");
+
+// Accounting state (v2.1)
+// Per-CPU insert budget window, a small count-min sketch of packets per
+// source, and a top-K table of the heaviest sources seen by this CPU.
+// Sketch cells pack an 8-bit window epoch with a 24-bit count, so a new
+// window resets a cell lazily on its first touch. The sketch holds back
+// ip_stats inserts in sketch mode and ranks sources for the top-K table.
+#define SKETCH_DEPTH      4
+#define SKETCH_WIDTH_BITS 10
+#define SKETCH_WIDTH      (1 << SKETCH_WIDTH_BITS)
+#define SKETCH_COUNT_MASK 0x00FFFFFF
+#define SKETCH_EPOCH_SHIFT 30 // ~1.07s windows
+
+#define HH_TOPK          32
+#define HH_REFRESH_MASK  15 // Re-rank a source every 16 packets of its estimate
+
+struct hh_entry {
+    __u32 ip;
+    __u32 count;      // Sketch estimate for the window of last_seen
+    __u64 last_seen;
+};
+
+struct acct_state {
+    __u64 window_start;
+    __u32 inserts;
+    __u32 pad;
+    __u32 sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+    struct hh_entry topk[HH_TOPK];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct acct_state);
+} acct_state SEC(".maps");
+
+// ============================================================
+// PACKET PARSER
+// ============================================================
+// Per-packet context (v2.1)
+// parse_packet walks the Ethernet header, up to VLAN_MAX_DEPTH 802.1Q/802.1ad
+// tags and the IP header once, and records where each layer starts. Stages
+// rebuild their header pointers from these offsets (pkt_ptr) instead of
+// assuming an untagged frame and re-parsing from ctx->data.
+#define VLAN_MAX_DEPTH 2       // QinQ: outer 802.1ad + inner 802.1Q
+#define PKT_OFF_MASK   0x3FF   // Bounds the offsets for the verifier
+
+struct vlan_hdr {
+    __be16 h_vlan_TCI;
+    __be16 h_vlan_encapsulated_proto;
+};
+
+struct pipe_ctx {
+    __u64 pkt_size;
+    __u64 rule_expires;  // Policy trie block expiry
+    __u32 src_ip;        // IPv4 source, 0 for IPv6
+    __u32 dst_ip;        // IPv4 destination, 0 for IPv6
+    __u32 est;           // Heavy-hitter estimate, reused by accounting
+    __u32 rule_flags;    // RULE_* from the policy trie
+    __u32 has_rule;      // 1 = rule_flags/rule_expires are valid
+    __u32 attack;        // 1 = attack mode overrides apply to this packet
+    __u16 l3_proto;      // ETH_P_IP or ETH_P_IPV6
+    __u16 l3_off;        // IP header, past any VLAN tags
+    __u16 l4_off;        // L4 header, 0 = not in this packet
+    __u16 payload_off;   // L4 payload, 0 = L4 header runs past the packet
+    __u16 payload_len;   // Bytes from payload_off to the end of the packet
+    __u16 protocol;
+    __u16 dst_port;
+    __u16 src_port;
+    __u16 frag_id;       // IPv4 identification, when frag != FRAG_NONE
+    __u16 frag_start;    // Fragment offset in bytes
+    __u16 frag_len;      // Fragment payload bytes
+    __u8 tcp_flags;      // Valid when protocol is TCP and payload_off != 0
+    __u8 frag;           // FRAG_*; FRAG_LATER has no L4 header
+    __u8 port_action;    // PORT_* of dst_port
+    __u8 port_flags;     // PORT_SYNPROXY
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct pipe_ctx);
+} pipe_ctx SEC(".maps");
+
+// pkt_ptr returns the packet at off if len bytes fit there, or 0
+static __always_inline void *pkt_ptr(struct xdp_md *ctx, __u32 off, __u32 len) {
+    void *p = (void *)(long)ctx->data + (off & PKT_OFF_MASK);
+    if (p + len > (void *)(long)ctx->data_end)
+        return 0;
+    return p;
+}
+
+// parse_ipv6_l4 walks up to IPV6_EXT_MAX extension headers and returns the
+// L4 header, or 0 for a non-first fragment or an unparsable chain
+static __always_inline unsigned char *parse_ipv6_l4(struct ipv6hdr *ip6, void *data_end, __u8 *protocol, __u8 *frag) {
+    unsigned char *hdr = (void *)(ip6 + 1);
+    __u8 next = ip6->nexthdr;
+
+#pragma unroll
+    for (int i = 0; i < IPV6_EXT_MAX; i++) {
+        if (next != IPV6_NEXTHDR_HOP && next != IPV6_NEXTHDR_ROUTING &&
+            next != IPV6_NEXTHDR_FRAGMENT && next != IPV6_NEXTHDR_DEST)
+            break;
+        if ((void *)(hdr + 8) > data_end)
+            return 0;
+        if (next == IPV6_NEXTHDR_FRAGMENT) {
+            // Offset in the upper 13 bits of bytes 2-3
+            if ((((__u16)hdr[2] << 8) | hdr[3]) & 0xFFF8) {
+                *protocol = hdr[0];
+                *frag = FRAG_LATER;
+                return 0;
+            }
+            next = hdr[0];
+            hdr += 8;
+        } else {
+            next = hdr[0];
+            hdr += ((__u32)hdr[1] + 1) * 8;
+        }
+    }
+    *protocol = next;
+    if (next == IPV6_NEXTHDR_HOP || next == IPV6_NEXTHDR_ROUTING ||
+        next == IPV6_NEXTHDR_FRAGMENT || next == IPV6_NEXTHDR_DEST)
+        return 0;
+    return hdr;
+}
+
+// parse_packet fills pc for an IPv4 or IPv6 packet, optionally VLAN tagged.
+// Returns -1 for anything else.
+static __always_inline int parse_packet(struct xdp_md *ctx, struct pipe_ctx *pc) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct ethhdr *eth = data;
+
+    if ((void *)(eth + 1) > data_end) return -1;
+
+    __u16 h_proto = eth->h_proto;
+    void *l3 = (void *)(eth + 1);
+#pragma unroll
+    for (int i = 0; i < VLAN_MAX_DEPTH; i++) {
+        if (h_proto != bpf_htons(ETH_P_8021Q) && h_proto != bpf_htons(ETH_P_8021AD))
+            break;
+        struct vlan_hdr *vh = l3;
+        if ((void *)(vh + 1) > data_end) return -1;
+        h_proto = vh->h_vlan_encapsulated_proto;
+        l3 = (void *)(vh + 1);
+    }
+
+    pc->pkt_size = data_end - data;
+    pc->l3_off = l3 - data;
+    pc->l4_off = 0;
+    pc->payload_off = 0;
+    pc->payload_len = 0;
+    pc->src_ip = 0;
+    pc->dst_ip = 0;
+    pc->protocol = 0;
+    pc->dst_port = 0;
+    pc->src_port = 0;
+    pc->tcp_flags = 0;
+    pc->frag = FRAG_NONE;
+
+    unsigned char *l4;
+    if (h_proto == bpf_htons(ETH_P_IP)) {
+        struct iphdr *ip = l3;
+        if ((void *)(ip + 1) > data_end) return -1;
+
+        __u8 ihl = (*((__u8 *)ip)) & 0x0F;
+        if (ihl < 5) return -1;
+
+        pc->l3_proto = ETH_P_IP;
+        pc->src_ip = ip->saddr;
+        pc->dst_ip = ip->daddr;
+        pc->protocol = ip->protocol;
+
+        // Handle Fragmentation: a non-first fragment has no L4 header, so
+        // the ports remain 0
+        __u16 frag_off = bpf_ntohs(ip->frag_off);
+        if (frag_off & 0x3FFF) {
+            pc->frag = (frag_off & 0x1FFF) ? FRAG_LATER : FRAG_FIRST;
+            pc->frag_id = ip->id;
+            pc->frag_start = (frag_off & 0x1FFF) * 8;
+            __u16 tot_len = bpf_ntohs(ip->tot_len);
+            pc->frag_len = tot_len > ihl * 4 ? tot_len - ihl * 4 : 0;
+            if (pc->frag == FRAG_LATER)
+                return 0;
+        }
+        l4 = (void *)ip + ihl * 4;
+    } else if (h_proto == bpf_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6 = l3;
+        if ((void *)(ip6 + 1) > data_end) return -1;
+
+        __u8 protocol = 0;
+        pc->l3_proto = ETH_P_IPV6;
+        l4 = parse_ipv6_l4(ip6, data_end, &protocol, &pc->frag);
+        pc->protocol = protocol;
+        if (!l4)
+            return 0;
+    } else {
+        return -1;
+    }
+
+    if ((void *)l4 > data_end) return 0;
+    pc->l4_off = (void *)l4 - data;
+
+    if (pc->protocol == IPPROTO_TCP || pc->protocol == IPPROTO_UDP) {
+        if ((void *)(l4 + 4) > data_end) return 0;
+        pc->src_port = ((__u16)l4[0] << 8) | l4[1];
+        pc->dst_port = ((__u16)l4[2] << 8) | l4[3];
+    }
+
+    // UDP, ICMP and ICMPv6 headers are all 8 bytes
+    __u32 l4_len = 8;
+    if (pc->protocol == IPPROTO_TCP) {
+        struct tcphdr *tcp = (void *)l4;
+        if ((void *)(tcp + 1) > data_end) return 0;
+        pc->tcp_flags = l4[13];
+        l4_len = tcp->doff * 4;
+    }
+    unsigned char *payload = l4 + l4_len;
+    if ((void *)payload > data_end) return 0;
+    pc->payload_off = (void *)payload - data;
+    pc->payload_len = data_end - (void *)payload;
+    return 0;
+}
+
+// ============================================================
+// PACKET VALIDATION (v1.15.0)
+// ============================================================
+// Returns 0 if valid, -1 if invalid
+static __always_inline int validate_packet(struct xdp_md *ctx, struct pipe_ctx *pc) {
+    struct iphdr *ip = pkt_ptr(ctx, pc->l3_off, sizeof(struct iphdr));
+    if (!ip) return -1;
+    
+    // 1. IP Version must be 4
+    __u8 version = (*((__u8 *)ip)) >> 4;
+    if (version != 4) return -1;
+    
+    // 2. IP Header Length must be >= 5 (20 bytes)
+    __u8 ihl = (*((__u8 *)ip)) & 0x0F;
+    if (ihl < 5) return -1;
+    
+    // 3. Total Length must be >= 20
+    __u16 total_len = bpf_ntohs(ip->tot_len);
+    if (total_len < 20) return -1;
+    
+    // 4. TTL must be non-zero (TTL 0 is invalid)
+    if (ip->ttl == 0) return -1;
+
+    // Fragmented packet (offset > 0): L4 headers are not present
+    if (pc->frag == FRAG_LATER)
+        return 0;
+    
+    // 5. UDP specific: Length must be >= 8
+    if (pc->protocol == IPPROTO_UDP) {
+        unsigned char *udp_hdr = pc->l4_off ? pkt_ptr(ctx, pc->l4_off, 8) : 0;
+        if (!udp_hdr) return -1;
+        
+        __u16 udp_len = ((__u16)udp_hdr[4] << 8) | udp_hdr[5];
+        if (udp_len < 8) return -1;
+    }
+    
+    return 0;
+}
+
+// ============================================================
+// MAIN XDP FILTER
+// ============================================================
+// ============================================================
+// EVENT RECORDING
+// ============================================================
+// Drops are counted in event_counts; the ring buffer is only used once that
+// table is full, sampled more sparsely the further the reader falls behind.
+static __always_inline void record_event(__u32 src_ip, __u32 reason) {
+    struct event_key key = { .src_ip = src_ip, .reason = reason };
+    __u64 now = bpf_ktime_get_ns();
+
+    struct event_count *ec = bpf_map_lookup_elem(&event_counts, &key);
+    if (!ec) {
+        struct event_count init = { .count = 1, .first_seen = now, .last_seen = now };
+        if (bpf_map_update_elem(&event_counts, &key, &init, BPF_NOEXIST) == 0)
+            return;
+        ec = bpf_map_lookup_elem(&event_counts, &key);
+    }
+    if (ec) {
+        ec->count++;
+        ec->last_seen = now;
+        return;
+    }
+
+    // event_counts is full: adaptive 1-in-2^shift sampling on the ring buffer
+    __u64 backlog = bpf_ringbuf_query(&events, BPF_RB_AVAIL_DATA);
+    __u32 shift = backlog / EVENT_SAMPLE_STEP;
+    if (shift > EVENT_SAMPLE_MAX_SHIFT)
+        shift = EVENT_SAMPLE_MAX_SHIFT;
+    if (bpf_get_prandom_u32() & ((1U << shift) - 1))
+        return;
+
+    struct event_data *e = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
+    if (e) {
+        e->src_ip = src_ip;
+        e->reason = reason;
+        e->timestamp = now;
+        e->count = 1U << shift;
+        e->aux = 0;
+        // Batch wakeups: the reader also polls on a short deadline
+        bpf_ringbuf_submit(e, backlog + sizeof(*e) >= EVENT_WAKEUP_BYTES ? BPF_RB_FORCE_WAKEUP : BPF_RB_NO_WAKEUP);
+    }
+}
+
+// ============================================================
+// ACCOUNTING (v2.1)
+// ============================================================
+static __always_inline __u32 sketch_seed(int row) {
+    return row == 0 ? 0x9E3779B1 : row == 1 ? 0x85EBCA77 : row == 2 ? 0xC2B2AE3D : 0x27D4EB2F;
+}
+
+// Adds one packet for ip and returns the count-min estimate for this window
+static __always_inline __u32 sketch_update(struct acct_state *as, __u32 ip, __u64 now) {
+    __u32 epoch = (__u32)(now >> SKETCH_EPOCH_SHIFT) & 0xFF;
+    __u32 est = SKETCH_COUNT_MASK;
+
+#pragma unroll
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        __u32 idx = (ip * sketch_seed(row)) >> (32 - SKETCH_WIDTH_BITS);
+        __u32 cell = as->sketch[row][idx & (SKETCH_WIDTH - 1)];
+        __u32 cnt = (cell >> 24) == epoch ? (cell & SKETCH_COUNT_MASK) : 0;
+        if (cnt < SKETCH_COUNT_MASK)
+            cnt++;
+        as->sketch[row][idx & (SKETCH_WIDTH - 1)] = (epoch << 24) | cnt;
+        if (cnt < est)
+            est = cnt;
+    }
+    return est;
+}
+
+// Takes one insert from this CPU's per-second budget. Returns 0 if exhausted.
+static __always_inline int acct_take_insert(struct acct_state *as, __u32 budget, __u64 now) {
+    if (budget == 0)
+        return 1;
+    if (now - as->window_start >= 1000000000ULL) {
+        as->window_start = now;
+        as->inserts = 0;
+    }
+    if (as->inserts >= budget)
+        return 0;
+    as->inserts += 1;
+    return 1;
+}
+
+// Offers a source to the top-K table. Only every 16th packet of a source
+// pays for the scan, so one-packet spoofed sources never touch the table.
+static __always_inline void hh_update(struct acct_state *as, __u32 ip, __u32 est, __u64 now) {
+    if (est & HH_REFRESH_MASK)
+        return;
+
+    __u64 window = now >> SKETCH_EPOCH_SHIFT;
+    __u32 min_slot = 0;
+    __u32 min_count = 0xFFFFFFFF;
+
+#pragma unroll
+    for (int i = 0; i < HH_TOPK; i++) {
+        struct hh_entry *en = &as->topk[i];
+        if (en->ip == ip) {
+            en->count = est;
+            en->last_seen = now;
+            return;
+        }
+        __u32 c = (en->last_seen >> SKETCH_EPOCH_SHIFT) == window ? en->count : 0;
+        if (c < min_count) {
+            min_count = c;
+            min_slot = i;
+        }
+    }
+
+    if (est > min_count && min_slot < HH_TOPK) {
+        as->topk[min_slot].ip = ip;
+        as->topk[min_slot].count = est;
+        as->topk[min_slot].last_seen = now;
+    }
+}
+
+// Per-port accounting, shared by both address families
+static __always_inline void account_port(struct xdp_policy *pol, struct xdp_stats *st, struct acct_state *as,
+                                         __u16 dst_port, __u64 pkt_size, __u64 weight, __u64 now) {
+    if (dst_port == 0)
+        return;
+    __u32 zero = 0;
+    struct port_stats *pstats = bpf_map_lookup_elem(&port_stats, &dst_port);
+    if (pstats) {
+        pstats->packets += weight;
+        pstats->bytes += pkt_size * weight;
+        return;
+    }
+    if (!as)
+        as = bpf_map_lookup_elem(&acct_state, &zero);
+    if (as && acct_take_insert(as, pol->stats_insert_budget, now)) {
+        struct port_stats new_pstats = { .packets = weight, .bytes = pkt_size * weight };
+        bpf_map_update_elem(&port_stats, &dst_port, &new_pstats, BPF_NOEXIST);
+    } else {
+        st->acct_skipped += 1;
+    }
+}
+
+// Per-IP and per-port accounting for passed packets. Existing entries are
+// updated in place; new entries are gated by the sampling mode and the
+// per-CPU insert budget so a spoofed flood cannot churn the stats maps.
+// as/est carry the sketch state from the heavy-hitter pass (NULL/0 if off).
+static __always_inline void account_packet(struct xdp_policy *pol, struct xdp_stats *st,
+                                           struct acct_state *as, __u32 est,
+                                           __u32 src_ip, __u16 dst_port, __u64 pkt_size) {
+    __u64 weight = 1;
+    __u32 rate = pol->stats_sample_rate;
+
+    if (pol->stats_mode == STATS_MODE_SAMPLE && rate > 1) {
+        if (bpf_get_prandom_u32() & (rate - 1))
+            return;
+        weight = rate;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    __u32 zero = 0;
+
+    // Per-IP stats
+    struct packet_stats *stats = bpf_map_lookup_elem(&ip_stats, &src_ip);
+    if (stats) {
+        stats->packets += weight;
+        stats->bytes += pkt_size * weight;
+        stats->last_seen = now;
+    } else {
+        if (!as)
+            as = bpf_map_lookup_elem(&acct_state, &zero);
+        if (!as)
+            return;
+
+        __u64 initial = weight;
+        int admit = 1;
+        if (pol->stats_mode == STATS_MODE_SKETCH) {
+            if (est == 0)
+                est = sketch_update(as, src_ip, now);
+            if (est < pol->stats_sketch_threshold) {
+                st->acct_held += 1;
+                admit = 0;
+            } else {
+                initial = est; // Backfill the packets seen while below threshold
+            }
+        }
+
+        if (admit) {
+            if (acct_take_insert(as, pol->stats_insert_budget, now)) {
+                struct packet_stats new_stats = {
+                    .packets = initial, .bytes = pkt_size * initial, .last_seen = now, .blocked = 0, .pad = 0,
+                };
+                bpf_map_update_elem(&ip_stats, &src_ip, &new_stats, BPF_NOEXIST);
+            } else {
+                st->acct_skipped += 1;
+            }
+        }
+    }
+
+    account_port(pol, st, as, dst_port, pkt_size, weight, now);
+}
+
+static __always_inline int verdict(struct xdp_stats *st, __u32 reason, int action) {
+    if (reason < VERDICT_MAX)
+        st->verdicts[reason] += 1;
+    return action;
+}
+
+// conn_ttl returns the conntrack bypass TTL, cut short in attack mode
+static __always_inline __u64 conn_ttl(struct xdp_policy *pol, struct pipe_ctx *pc) {
+    __u64 ttl = pol->attack_flow_ttl * 1000000000ULL;
+    if (pc->attack && ttl > 0 && ttl < CONN_TRACK_TTL_NS)
+        return ttl;
+    return CONN_TRACK_TTL_NS;
+}
+
+// flow_admit decides whether an inbound packet of a tracked flow is bypassed,
+// advancing the TCP state as it goes. flags are the TCP flags (unused for
+// UDP). Packets over the flow's bucket are not bypassed but still filtered
+// normally. ttl is the idle time after which UDP and established TCP flows
+// are no longer bypassed.
+static __always_inline int flow_admit(struct flow_state *flow, __u16 protocol, __u8 flags, __u32 flow_pps,
+                                      __u64 ttl) {
+    __u64 now = bpf_ktime_get_ns();
+    __u64 age = now - flow->last_seen;
+
+    if (protocol == IPPROTO_TCP) {
+        switch (flow->state) {
+        case FLOW_SYN_SENT:
+            if (age >= FLOW_SYN_TTL_NS)
+                return 0;
+            // Only the handshake reply opens the flow
+            if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == (TCP_FLAG_SYN | TCP_FLAG_ACK))
+                flow->state = FLOW_ESTABLISHED;
+            else if (flags & TCP_FLAG_RST)
+                flow->state = FLOW_CLOSING;
+            else
+                return 0;
+            break;
+        case FLOW_ESTABLISHED:
+            if (age >= ttl)
+                return 0;
+            // A fresh SYN from the remote side is never part of our flow
+            if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN)
+                return 0;
+            if (flags & (TCP_FLAG_FIN | TCP_FLAG_RST))
+                flow->state = FLOW_CLOSING;
+            break;
+        case FLOW_CLOSING:
+            if (age >= FLOW_CLOSING_TTL_NS)
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+    } else if (age >= ttl) {
+        return 0;
+    }
+
+    if (flow_pps == 0)
+        return 1;
+
+    // Per-flow token bucket (same refill rule as rate_limit_take)
+    __u64 elapsed = now - flow->last_refill;
+    if (elapsed > 1000000000ULL) elapsed = 1000000000ULL;
+    __u64 tokens = flow->tokens + (elapsed * flow_pps) / 1000000000ULL;
+    if (tokens > flow_pps) tokens = flow_pps;
+    if (tokens < 1)
+        return 0;
+    flow->tokens = tokens - 1;
+    flow->last_refill = now;
+    return 1;
+}
+
+// flow_bypass reports whether an inbound TCP/UDP packet is return traffic
+// of a flow tc_egress_track saw us open
+static __always_inline int flow_bypass(struct pipe_ctx *pc, __u32 flow_pps, __u64 ttl) {
+    // A TCP segment needs its full header for the state machine
+    if (pc->protocol == IPPROTO_TCP && pc->payload_off == 0)
+        return 0;
+
+    struct flow_key key = {
+        .remote_ip = pc->src_ip,
+        .local_ip = pc->dst_ip,
+        .remote_port = pc->src_port,
+        .local_port = pc->dst_port,
+        .proto = pc->protocol,
+    };
+    struct flow_state *flow = bpf_map_lookup_elem(&flows, &key);
+    if (!flow)
+        return 0;
+    return flow_admit(flow, pc->protocol, pc->tcp_flags, flow_pps, ttl);
+}
+
+// reflection_port reports whether UDP from port is a known reflection vector
+static __always_inline int reflection_port(__u16 port) {
+    return (reflection_ports[port >> 6] >> (port & 63)) & 1;
+}
+
+// udp_flow_known reports whether a UDP packet answers a flow we opened,
+// without touching the flow's state or bucket
+static __always_inline int udp_flow_known(struct pipe_ctx *pc) {
+    struct flow_key key = {
+        .remote_ip = pc->src_ip,
+        .local_ip = pc->dst_ip,
+        .remote_port = pc->src_port,
+        .local_port = pc->dst_port,
+        .proto = IPPROTO_UDP,
+    };
+    struct flow_state *flow = bpf_map_lookup_elem(&flows, &key);
+    return flow && bpf_ktime_get_ns() - flow->last_seen < CONN_TRACK_TTL_NS;
+}
+
+// bucket_take spends cost tokens from key's bucket in map, refilled at rate
+// per second up to rate, and reports whether it had fewer than cost left
+static __always_inline int bucket_take(void *map, void *key, __u64 rate, __u64 cost, __u64 now) {
+    struct rate_limit_entry *rl = bpf_map_lookup_elem(map, key);
+    if (!rl) {
+        struct rate_limit_entry new_rl = { .tokens = rate > cost ? rate - cost : 0, .last_update = now };
+        bpf_map_update_elem(map, key, &new_rl, BPF_ANY);
+        return 0;
+    }
+
+    __u64 elapsed = now - rl->last_update;
+    if (elapsed > 1000000000ULL) elapsed = 1000000000ULL;
+
+    __u64 tokens_to_add = (elapsed * rate) / 1000000000ULL;
+    __u64 new_tokens = rl->tokens + tokens_to_add;
+    if (new_tokens > rate) new_tokens = rate;
+
+    if (new_tokens < cost)
+        return 1;
+    rl->tokens = new_tokens - cost;
+    rl->last_update = now;
+    return 0;
+}
+
+// rate_limit_take spends one token from key's bucket in map (rate_limits,
+// rate_limits_percpu or port_limits) and reports whether the bucket was
+// already empty
+static __always_inline int rate_limit_take(void *map, void *key, __u32 rate, __u64 now) {
+    return bucket_take(map, key, rate, 1, now);
+}
+
+// size_class returns the packet's size class and sets *rate to its
+// per-source limit, or returns 0 if the size is not limited
+static __always_inline __u32 size_class(struct xdp_policy *pol, __u64 pkt_size, __u32 *rate) {
+    if (pkt_size <= SIZE_TINY_MAX) {
+        *rate = pol->size_tiny_pps;
+        return *rate ? SIZE_TINY : 0;
+    }
+    if (pkt_size >= SIZE_LARGE_MIN) {
+        *rate = pol->size_large_pps;
+        return *rate ? SIZE_LARGE : 0;
+    }
+    return 0;
+}
+
+// size_limited applies the per-source limit of the packet's size class
+static __always_inline int size_limited(struct xdp_policy *pol, __u32 src_ip, __u64 pkt_size, __u64 now) {
+    __u32 rate = 0;
+    struct size_limit_key k = { .src_ip = src_ip, .class = size_class(pol, pkt_size, &rate) };
+    if (k.class == 0)
+        return 0;
+    return rate_limit_take(&size_limits, &k, rate, now);
+}
+
+// size_limited6 is size_limited for a source /64
+static __always_inline int size_limited6(struct xdp_policy *pol, __u64 net, __u64 pkt_size, __u64 now) {
+    __u32 rate = 0;
+    struct size_limit_key6 k = { .net = net, .class = size_class(pol, pkt_size, &rate) };
+    if (k.class == 0)
+        return 0;
+    return rate_limit_take(&size_limits6, &k, rate, now);
+}
+
+// global_limited charges the packet to this CPU's share of the global
+// bandwidth limit
+static __always_inline int global_limited(struct xdp_policy *pol, __u64 pkt_size, __u64 now) {
+    __u32 zero = 0;
+    if (pol->global_cpu_bps == 0)
+        return 0;
+    return bucket_take(&global_bytes, &zero, pol->global_cpu_bps, pkt_size, now);
+}
+
+// port_class_pps returns the per-source rate of a port rate-limit class,
+// 0 = unlimited
+static __always_inline __u32 port_class_pps(struct xdp_policy *pol, __u32 class) {
+    if (class == 0 || class >= PORT_CLASSES)
+        return 0;
+    return pol->port_class_pps[class];
+}
+
+// port_limited applies the per-source limit of a port rate-limit class
+static __always_inline int port_limited(struct xdp_policy *pol, __u32 src_ip, __u32 class) {
+    __u32 rate = port_class_pps(pol, class);
+    if (rate == 0)
+        return 0;
+    struct port_limit_key key = { .src_ip = src_ip, .class = class };
+    return rate_limit_take(&port_limits, &key, rate, bpf_ktime_get_ns());
+}
+
+// port_limited6 is port_limited for a source /64
+static __always_inline int port_limited6(struct xdp_policy *pol, __u64 net, __u32 class) {
+    __u32 rate = port_class_pps(pol, class);
+    if (rate == 0)
+        return 0;
+    struct port_limit_key6 key = { .net = net, .class = class };
+    return rate_limit_take(&port_limits6, &key, rate, bpf_ktime_get_ns());
+}
+
+// host_block_live reports whether src_ip has a live block in map, dropping
+// it once expired
+static __always_inline int host_block_live(struct xdp_stats *st, void *map, __u32 src_ip) {
+    struct block_entry *blocked = bpf_map_lookup_elem(map, &src_ip);
+    if (!blocked)
+        return 0;
+    // Check if entry has expired (expires_at > 0 means TTL-based)
+    if (blocked->expires_at > 0 && bpf_ktime_get_ns() >= blocked->expires_at) {
+        if (bpf_map_delete_elem(map, &src_ip) == 0)
+            st->block_expired += 1;
+        return 0;
+    }
+    return 1;
+}
+
+// host_blocked reports whether src_ip has a live manual or auto /32 block
+static __always_inline int host_blocked(struct xdp_stats *st, __u32 src_ip) {
+    return host_block_live(st, &manual_hosts, src_ip) || host_block_live(st, &blocked_hosts, src_ip);
+}
+
+struct attack_sum {
+    __u64 epoch;
+    __u64 packets;
+    __u64 bytes;
+};
+
+// attack_sum_cpu adds one CPU's count for the window being evaluated; a CPU
+// that has not seen a packet since still holds it as its current window
+static long attack_sum_cpu(__u32 cpu, void *data) {
+    struct attack_sum *sum = data;
+    __u32 zero = 0;
+    struct attack_window *w = bpf_map_lookup_percpu_elem(&attack_window, &zero, cpu);
+    if (!w)
+        return 1; // Past the last possible CPU
+    if (w->epoch == sum->epoch) {
+        sum->packets += w->packets;
+        sum->bytes += w->bytes;
+    } else if (w->prev_epoch == sum->epoch) {
+        sum->packets += w->prev_packets;
+        sum->bytes += w->prev_bytes;
+    }
+    return 0;
+}
+
+// attack_report queues a transition record, bypassing the drop sampling
+static __always_inline void attack_report(struct attack_state *as, __u64 now) {
+    struct event_data *e = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
+    if (!e)
+        return;
+    e->src_ip = as->mode;
+    e->reason = EVENT_ATTACK_MODE;
+    e->timestamp = now;
+    e->count = as->last_pps > 0xFFFFFFFF ? 0xFFFFFFFF : as->last_pps;
+    e->aux = as->last_mbps > 0xFFFFFFFF ? 0xFFFFFFFF : as->last_mbps;
+    bpf_ringbuf_submit(e, BPF_RB_FORCE_WAKEUP);
+}
+
+// attack_evaluate closes window epoch, the first after last, and steps the
+// state machine. Only the caller that advanced attack_state.epoch runs it.
+static __always_inline void attack_evaluate(struct xdp_policy *pol, struct attack_state *as,
+                                            __u64 epoch, __u64 last, __u64 now) {
+    struct attack_sum sum = { .epoch = epoch };
+    bpf_loop(ATTACK_MAX_CPUS, attack_sum_cpu, &sum, 0);
+
+    __u64 pps = (sum.packets * 1000000000ULL) >> ATTACK_WINDOW_SHIFT;
+    __u64 mbps = ((sum.bytes * 1000000000ULL) >> ATTACK_WINDOW_SHIFT) * 8 / 1000000;
+    as->last_pps = pps;
+    as->last_mbps = mbps;
+
+    __u64 trip_pps = pol->attack_trip_pps;
+    __u64 trip_mbps = pol->attack_trip_mbps;
+    if (as->mode == ATTACK_MODE_NORMAL) {
+        // Windows nobody evaluated had no packets, which breaks a streak
+        int over = (trip_pps > 0 && pps >= trip_pps) || (trip_mbps > 0 && mbps >= trip_mbps);
+        as->streak = over && epoch == last + 1 ? as->streak + 1 : over;
+        if (as->streak < ATTACK_TRIP_WINDOWS)
+            return;
+        as->mode = ATTACK_MODE_ACTIVE;
+    } else {
+        __u64 pct = pol->attack_relax_pct > 0 ? pol->attack_relax_pct : 50;
+        __u64 hold = pol->attack_hold_seconds > 0 ? pol->attack_hold_seconds : 30;
+        __u64 hold_windows = (hold * 1000000000ULL) >> ATTACK_WINDOW_SHIFT;
+        int calm = (trip_pps == 0 || pps * 100 < trip_pps * pct) &&
+                   (trip_mbps == 0 || mbps * 100 < trip_mbps * pct);
+        // ...and count as calm ones here
+        __u64 streak = calm ? as->streak + (epoch - last) : 0;
+        if (streak < hold_windows) {
+            as->streak = streak;
+            return;
+        }
+        as->mode = ATTACK_MODE_NORMAL;
+    }
+    as->streak = 0;
+    as->since = now;
+    as->transitions += 1;
+    attack_report(as, now);
+}
+
+// attack_tick evaluates every window that closed before now, once
+static __always_inline void attack_tick(struct xdp_policy *pol, struct attack_state *as, __u64 now) {
+    __u64 epoch = now >> ATTACK_WINDOW_SHIFT;
+    __u64 last = as->epoch;
+    if (last + 1 < epoch && __sync_val_compare_and_swap(&as->epoch, last, epoch - 1) == last)
+        attack_evaluate(pol, as, epoch - 1, last, now);
+}
+
+// attack_update counts a packet of pkt_size bytes into this CPU's window and
+// returns 1 while attack mode is on
+static __always_inline __u32 attack_update(struct xdp_policy *pol, __u64 pkt_size) {
+    if (pol->attack_trip_pps == 0 && pol->attack_trip_mbps == 0)
+        return 0;
+    __u32 zero = 0;
+    struct attack_window *w = bpf_map_lookup_elem(&attack_window, &zero);
+    struct attack_state *as = bpf_map_lookup_elem(&attack_state, &zero);
+    if (!w || !as)
+        return 0;
+
+    __u64 now = bpf_ktime_get_ns();
+    __u64 epoch = now >> ATTACK_WINDOW_SHIFT;
+    if (w->epoch != epoch) {
+        w->prev_epoch = w->epoch;
+        w->prev_packets = w->packets;
+        w->prev_bytes = w->bytes;
+        w->epoch = epoch;
+        w->packets = 0;
+        w->bytes = 0;
+        attack_tick(pol, as, now);
+    }
+    w->packets += 1;
+    w->bytes += pkt_size;
+    return as->mode == ATTACK_MODE_ACTIVE;
+}
+
+// attack_timer_run is the timer callback: close the attack mode window even
+// when no packet arrives, then re-arm
+static int attack_timer_run(void *map, __u32 *key, struct attack_timer_state *state) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct attack_state *as = bpf_map_lookup_elem(&attack_state, &zero);
+    if (pol && as && (pol->attack_trip_pps > 0 || pol->attack_trip_mbps > 0))
+        attack_tick(pol, as, bpf_ktime_get_ns());
+    bpf_timer_start(&state->timer, ATTACK_TICK_NS, 0);
+    return 0;
+}
+
+// arm_attack_timer starts the tick timer once per program load
+static __always_inline void arm_attack_timer(void) {
+    __u32 zero = 0;
+    struct attack_timer_state *state = bpf_map_lookup_elem(&attack_timer, &zero);
+    if (!state || state->armed)
+        return;
+    state->armed = 1;
+    // -EBUSY means another CPU got here first
+    if (bpf_timer_init(&state->timer, &attack_timer, CLOCK_MONOTONIC) != 0)
+        return;
+    bpf_timer_set_callback(&state->timer, attack_timer_run);
+    bpf_timer_start(&state->timer, ATTACK_TICK_NS, 0);
+}
+
+// geo_denied reports whether src_ip falls outside the allowed countries.
+// Nothing published yet means GeoIP is not loaded: fail open.
+static __always_inline int geo_denied(__u32 src_ip) {
+    __u32 zero = 0;
+    void *bitmap = bpf_map_lookup_elem(&geo_bitmap, &zero);
+    if (bitmap) {
+        __u32 block = bpf_ntohl(src_ip) >> 8;
+        __u32 idx = block >> 6;
+        struct geo_word *w = bpf_map_lookup_elem(bitmap, &idx);
+        if (!w)
+            return 0;
+        __u64 bit = 1ULL << (block & 63);
+        if (w->full & bit)
+            return 0;
+        if (!(w->mixed & bit))
+            return 1;
+        // Partially allowed /24: settle it with the sub-/24 prefixes in the trie
+    }
+
+    void *geo_trie = bpf_map_lookup_elem(&geo_allowed, &zero);
+    if (!geo_trie)
+        return 0;
+    struct lpm_key geo_key;
+    set_key_ipv4(&geo_key, src_ip);
+    return bpf_map_lookup_elem(geo_trie, &geo_key) ? 0 : 1;
+}
+
+// l4_payload returns the start of the TCP/UDP/ICMP payload, or 0 if the
+// headers run past the packet
+static __always_inline unsigned char *l4_payload(struct xdp_md *ctx, struct pipe_ctx *pc) {
+    if (pc->payload_off == 0)
+        return 0;
+    return pkt_ptr(ctx, pc->payload_off, 0);
+}
+
+// sig_payload_match compares the first payload_len bytes of the payload
+static __always_inline int sig_payload_match(struct sig_rule *rule, unsigned char *payload, void *data_end) {
+    if (rule->payload_len == 0)
+        return 1;
+    if (!payload)
+        return 0;
+#pragma unroll
+    for (int i = 0; i < SIG_PAYLOAD_MAX; i++) {
+        if (i >= rule->payload_len)
+            break;
+        if ((void *)(payload + i + 1) > data_end || payload[i] != rule->payload[i])
+            return 0;
+    }
+    return 1;
+}
+
+// sig_lookup returns the first rule of the set stored under key that matches
+static __always_inline struct sig_rule *sig_lookup(struct sig_key *key, unsigned char *payload, void *data_end) {
+    struct sig_set *set = bpf_map_lookup_elem(&sig_rules, key);
+    if (!set)
+        return 0;
+#pragma unroll
+    for (int i = 0; i < SIG_SET_MAX; i++) {
+        if (i >= set->count)
+            break;
+        if (sig_payload_match(&set->rules[i], payload, data_end))
+            return &set->rules[i];
+    }
+    return 0;
+}
+
+// sig_limited spends one token from the signature's per-CPU bucket
+static __always_inline int sig_limited(__u32 slot, __u64 now) {
+    struct sig_bucket *b = bpf_map_lookup_elem(&sig_buckets, &slot);
+    if (!b || b->rate == 0)
+        return 0;
+
+    __u64 elapsed = now - b->last_update;
+    if (elapsed > 1000000000ULL) elapsed = 1000000000ULL;
+
+    __u64 tokens = b->tokens + (elapsed * b->rate) / 1000000000ULL;
+    if (tokens > b->rate) tokens = b->rate;
+
+    if (tokens < 1)
+        return 1;
+    b->tokens = tokens - 1;
+    b->last_update = now;
+    return 0;
+}
+
+// tcp_checksum computes the checksum of an option-free or MSS-only TCP
+// header (no payload) over the IPv4 pseudo header
+static __always_inline __u16 tcp_checksum(struct iphdr *ip, struct tcphdr *tcp, void *data_end) {
+    __u32 len = tcp->doff * 4;
+    __u32 sum = (ip->saddr >> 16) + (ip->saddr & 0xFFFF) +
+                (ip->daddr >> 16) + (ip->daddr & 0xFFFF) +
+                bpf_htons(IPPROTO_TCP) + bpf_htons(len);
+    __u16 *p = (__u16 *)tcp;
+#pragma unroll
+    for (int i = 0; i < 12; i++) {
+        if (i * 2 >= len || (void *)(p + i + 1) > data_end)
+            break;
+        sum += p[i];
+    }
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+// a2s_challenge derives the challenge handed to a client
+static __always_inline __u32 a2s_challenge(__u32 secret, __u32 ip, __u16 port) {
+    __u32 h = secret ^ ip;
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h ^= port;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+    // 0 and -1 mean "no challenge" to clients
+    return (h == 0 || h == 0xFFFFFFFF) ? 1 : h;
+}
+
+// ip_checksum computes the checksum of a 20-byte IPv4 header
+static __always_inline __u16 ip_checksum(struct iphdr *ip) {
+    __u16 *p = (__u16 *)ip;
+    __u32 sum = 0;
+#pragma unroll
+    for (int i = 0; i < (int)(sizeof(*ip) / 2); i++)
+        sum += p[i];
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+// ============================================================
+// TAIL-CALL PIPELINE (v2.1)
+// ============================================================
+// xdp_traffic_filter runs the always-on bypasses, then tail-calls into the
+// stage programs below. Every stage owns a fixed slot in xdp_stages; the
+// loader links only the stages the policy needs, and an empty slot is
+// skipped with one failed tail call, so a disabled feature costs nothing.
+// Any stage can be swapped by replacing its slot while XDP stays attached.
+// Parsed packet state travels between stages in the per-CPU pipe_ctx.
+// The loader refuses to attach without its stages linked; should the array
+// still be empty, the entry program drops what it did not bypass itself.
+#define STAGE_ACL        0  // Heavy hitters, whitelist, blacklist
+#define STAGE_CONNTRACK  1
+#define STAGE_SIGNATURE  2  // Linked when signature_shapes != 0
+#define STAGE_A2S        3
+#define STAGE_SYN_PROXY  4  // Linked when syn_proxy == 1
+#define STAGE_RATE_LIMIT 5  // Linked when any per-source or per-prefix limit may apply
+#define STAGE_GEOIP      6  // Linked when hard_blocking == 1 or attack mode enables it
+#define STAGE_ACCOUNT    7  // Also charges the global bandwidth limit
+#define STAGE_MAX        8
+
+#define STEP_CONTINUE -1
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+    __uint(max_entries, STAGE_MAX);
+    __type(key, __u32);
+    __type(value, __u32);
+} xdp_stages SEC(".maps");
+
+// pipeline_next tail-calls the first linked stage in slots [from, STAGE_MAX).
+// It only returns if none is linked.
+static __always_inline void pipeline_next(struct xdp_md *ctx, __u32 from) {
+#pragma unroll
+    for (__u32 slot = from; slot < STAGE_MAX; slot++)
+        bpf_tail_call(ctx, &xdp_stages, slot);
+}
+
+// ============================================================
+// 1.5 HEAVY HITTERS + 2-3. WHITELIST -> PASS, BLACKLIST -> DROP
+// ============================================================
+static __always_inline int step_acl(struct xdp_policy *pol, struct xdp_stats *st, struct pipe_ctx *pc) {
+    __u32 zero = 0;
+    __u32 src_ip = pc->src_ip;
+
+    // Heavy hitters (v2.1) - rank every public source
+    pc->est = 0;
+    if (pol->heavy_hitters == 1) {
+        struct acct_state *as = bpf_map_lookup_elem(&acct_state, &zero);
+        if (as) {
+            __u64 hh_now = bpf_ktime_get_ns();
+            pc->est = sketch_update(as, src_ip, hh_now);
+            hh_update(as, src_ip, pc->est, hh_now);
+        }
+    }
+
+    // With the policy trie published, one walk answers both (and GeoIP later)
+    pc->has_rule = 0;
+    pc->rule_flags = 0;
+    if (pol->policy_trie == 1) {
+        void *rules = bpf_map_lookup_elem(&policy_rules, &zero);
+        if (rules) {
+            struct lpm_key r_key;
+            set_key_ipv4(&r_key, src_ip);
+            struct policy_rule *rule = bpf_map_lookup_elem(rules, &r_key);
+            if (rule) {
+                pc->has_rule = 1;
+                pc->rule_flags = rule->flags;
+                pc->rule_expires = rule->expires_at;
+            }
+        }
+    }
+
+    if (pc->has_rule) {
+        if (pc->rule_flags & RULE_ALLOW) {
+            st->allowed += 1;
+            return verdict(st, VERDICT_WHITELIST, XDP_PASS);
+        }
+    } else {
+        struct lpm_key w_key;
+        set_key_ipv4(&w_key, src_ip);
+        if (bpf_map_lookup_elem(&white_list, &w_key)) {
+            st->allowed += 1;
+            return verdict(st, VERDICT_WHITELIST, XDP_PASS);
+        }
+    }
+
+    // Blacklist with TTL support (v1.15.0): single hosts first
+    if (host_blocked(st, src_ip)) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_BLACKLIST, XDP_DROP);
+    }
+
+    if (pc->has_rule) {
+        // Expired blocks are ignored here; the loader drops them on the next compile
+        if ((pc->rule_flags & RULE_BLOCK) &&
+            (pc->rule_expires == 0 || bpf_ktime_get_ns() < pc->rule_expires)) {
+            st->blocked += 1;
+            return verdict(st, VERDICT_BLACKLIST, XDP_DROP);
+        }
+    } else if (pol->block_prefixes > 0) {
+        struct lpm_key b_key;
+        set_key_ipv4(&b_key, src_ip);
+        struct block_entry *blocked = bpf_map_lookup_elem(&blocked_ips, &b_key);
+        if (blocked) {
+            // Check if entry has expired (expires_at > 0 means TTL-based)
+            if (blocked->expires_at > 0 && bpf_ktime_get_ns() >= blocked->expires_at) {
+                // Entry has expired - delete it
+                if (bpf_map_delete_elem(&blocked_ips, &b_key) == 0)
+                    st->block_expired += 1;
+            } else {
+                // Still blocked (permanent or not expired)
+                st->blocked += 1;
+                // record_event(src_ip, blocked->reason); // Too noisy for already blocked
+                return verdict(st, VERDICT_BLACKLIST, XDP_DROP);
+            }
+        }
+    }
+    return STEP_CONTINUE;
+}
+
+// ============================================================
+// 4. CONNECTION TRACKING (Response Bypass)
+// ============================================================
+static __always_inline int step_conntrack(struct xdp_policy *pol, struct xdp_stats *st, struct pipe_ctx *pc) {
+    // Return traffic of a flow we opened, within its TCP state and bucket
+    if ((pc->protocol == IPPROTO_TCP || pc->protocol == IPPROTO_UDP) &&
+        flow_bypass(pc, pol->flow_rate_pps, conn_ttl(pol, pc))) {
+        st->conn_bypass += 1;
+        return verdict(st, VERDICT_CONN_BYPASS, XDP_PASS);
+    }
+    return STEP_CONTINUE;
+}
+
+// ============================================================
+// 4.5 ATTACK SIGNATURES -> LOG / RATE LIMIT / DROP
+// ============================================================
+static __always_inline int step_signature(struct xdp_md *ctx, struct xdp_policy *pol,
+                                          struct xdp_stats *st, struct pipe_ctx *pc) {
+    __u32 shapes = pol->signature_shapes;
+    if (shapes == 0)
+        return STEP_CONTINUE;
+
+    void *data_end = (void *)(long)ctx->data_end;
+    unsigned char *payload = l4_payload(ctx, pc);
+    struct sig_key key = { .protocol = (__u8)pc->protocol };
+    struct sig_rule *rule = 0;
+
+    if (shapes & SIG_SHAPE_BOTH) {
+        key.src_port = pc->src_port;
+        key.dst_port = pc->dst_port;
+        rule = sig_lookup(&key, payload, data_end);
+    }
+    if (!rule && (shapes & SIG_SHAPE_SRC)) {
+        key.src_port = pc->src_port;
+        key.dst_port = 0;
+        rule = sig_lookup(&key, payload, data_end);
+    }
+    if (!rule && (shapes & SIG_SHAPE_DST)) {
+        key.src_port = 0;
+        key.dst_port = pc->dst_port;
+        rule = sig_lookup(&key, payload, data_end);
+    }
+    if (!rule && (shapes & SIG_SHAPE_ANY)) {
+        key.src_port = 0;
+        key.dst_port = 0;
+        rule = sig_lookup(&key, payload, data_end);
+    }
+    if (!rule)
+        return STEP_CONTINUE;
+
+    __u32 slot = rule->slot;
+    __u64 *hits = bpf_map_lookup_elem(&sig_hits, &slot);
+    if (hits)
+        *hits += 1;
+
+    int drop = rule->action == SIG_ACTION_BLOCK ||
+               (rule->action == SIG_ACTION_RATE_LIMIT && sig_limited(slot, bpf_ktime_get_ns()));
+    if (drop) {
+        st->blocked += 1;
+        record_event(pc->src_ip, BLOCK_REASON_SIGNATURE);
+        return verdict(st, VERDICT_SIGNATURE, XDP_DROP);
+    }
+    return STEP_CONTINUE;
+}
+
+// a2s_respond answers an A2S_INFO/A2S_RULES query from a2s_cache by
+// rewriting the packet into the reply. Returns STEP_CONTINUE on a cache miss.
+static __always_inline int a2s_respond(struct xdp_md *ctx, struct xdp_stats *st, struct pipe_ctx *pc) {
+    // The reply is rebuilt with a bare IP header behind the same L2 header
+    __u32 l3_off = pc->l3_off & PKT_OFF_MASK;
+    if (pc->l4_off != l3_off + sizeof(struct iphdr))
+        return STEP_CONTINUE;
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    unsigned char *payload = pkt_ptr(ctx, pc->payload_off, 5);
+    if (!payload)
+        return STEP_CONTINUE;
+
+    struct a2s_key key = { .port = pc->dst_port };
+    __u32 challenge_off;
+    if (payload[4] == 0x54) {
+        key.kind = A2S_KIND_INFO;
+        challenge_off = A2S_INFO_REQ_LEN;
+    } else if (payload[4] == 0x56) {
+        key.kind = A2S_KIND_RULES;
+        challenge_off = 5;
+    } else {
+        return STEP_CONTINUE;
+    }
+
+    struct a2s_reply *reply = bpf_map_lookup_elem(&a2s_cache, &key);
+    if (!reply || reply->len == 0 || reply->len > A2S_REPLY_MAX ||
+        bpf_ktime_get_ns() - reply->updated_at >= A2S_CACHE_TTL_NS)
+        return STEP_CONTINUE;
+    __u32 zero = 0;
+    struct a2s_secret *secret = bpf_map_lookup_elem(&a2s_secret, &zero);
+    if (!secret || secret->current == 0)
+        return STEP_CONTINUE;
+
+    __u32 challenge = a2s_challenge(secret->current, pc->src_ip, pc->src_port);
+    int answered = 0;
+    if ((void *)(payload + challenge_off + 4) <= data_end) {
+        __u32 got;
+        __builtin_memcpy(&got, payload + challenge_off, 4);
+        answered = got == challenge ||
+                   (secret->previous && got == a2s_challenge(secret->previous, pc->src_ip, pc->src_port));
+    }
+
+    // Resize the packet to the reply, then turn it around in place
+    __u32 reply_len = answered ? reply->len : A2S_CHALLENGE_LEN;
+    int new_len = l3_off + sizeof(struct iphdr) + sizeof(struct udphdr) + reply_len;
+    if (bpf_xdp_adjust_tail(ctx, new_len - (int)(data_end - data)))
+        return STEP_CONTINUE;
+
+    data = (void *)(long)ctx->data;
+    data_end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = data;
+    struct iphdr *ip = data + l3_off;
+    if ((void *)(eth + 1) > data_end)
+        return XDP_DROP;
+    struct udphdr *udp = (void *)(ip + 1);
+    payload = (void *)(udp + 1);
+    if ((void *)(payload + A2S_CHALLENGE_LEN) > data_end)
+        return XDP_DROP;
+
+    __u8 mac[ETH_ALEN];
+    __builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+
+    __u32 addr = ip->saddr;
+    ip->saddr = ip->daddr;
+    ip->daddr = addr;
+    ip->tot_len = bpf_htons(sizeof(struct iphdr) + sizeof(struct udphdr) + reply_len);
+    ip->frag_off = 0;
+    ip->ttl = 64;
+    ip->check = 0;
+    ip->check = ip_checksum(ip);
+
+    __u16 port = udp->source;
+    udp->source = udp->dest;
+    udp->dest = port;
+    udp->len = bpf_htons(sizeof(struct udphdr) + reply_len);
+    udp->check = 0;  // Optional over IPv4
+
+    if (answered) {
+        if (bpf_xdp_store_bytes(ctx, l3_off + sizeof(struct iphdr) + sizeof(struct udphdr),
+                                reply->data, reply_len))
+            return XDP_DROP;
+    } else {
+        payload[0] = 0xFF;
+        payload[1] = 0xFF;
+        payload[2] = 0xFF;
+        payload[3] = 0xFF;
+        payload[4] = 0x41;
+        __builtin_memcpy(payload + 5, &challenge, 4);
+    }
+
+    st->allowed += 1;
+    return verdict(st, VERDICT_A2S_CACHED, XDP_TX);
+}
+
+// ============================================================
+// 5. STEAM A2S QUERY BYPASS
+// ============================================================
+static __always_inline int step_a2s(struct xdp_md *ctx, struct xdp_policy *pol,
+                                    struct xdp_stats *st, struct pipe_ctx *pc) {
+    // Once game ports are configured, queries to other ports get no bypass
+    if (pol->game_ports == 1 && pc->port_action != PORT_GAME)
+        return STEP_CONTINUE;
+
+    if (pc->protocol == IPPROTO_UDP) {
+        unsigned char *payload = l4_payload(ctx, pc);
+        // Check 4 bytes signature + 1 byte type
+        if (payload && (void *)(payload + 5) <= (void *)(long)ctx->data_end) {
+            // Use byte comparison to avoid alignment issues
+            if (payload[0] == 0xFF && payload[1] == 0xFF &&
+                payload[2] == 0xFF && payload[3] == 0xFF) {
+                // Steam A2S signature found (0xFFFFFFFF)
+                // This covers A2S_INFO, A2S_PLAYER, A2S_RULES, and responses
+                if (pol->a2s_cache == 1) {
+                    int action = a2s_respond(ctx, st, pc);
+                    if (action != STEP_CONTINUE)
+                        return action;
+                }
+
+                // Cache miss: the game server answers
+                st->allowed += 1;
+                return verdict(st, VERDICT_A2S, XDP_PASS);
+            }
+        }
+    }
+    return STEP_CONTINUE;
+}
+
+// ============================================================
+// 5.5 SYN PROXY -> SYN cookie / SYNPROXY / DROP
+// ============================================================
+// syn_proxy_reply turns the segment into a reply carrying flags, seq and
+// ack_seq (network order). A SYN-ACK also carries an MSS option.
+static __always_inline int syn_proxy_reply(struct xdp_md *ctx, struct pipe_ctx *pc,
+                                           __u8 flags, __u32 seq, __u32 ack_seq) {
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    __u32 l3_off = pc->l3_off & PKT_OFF_MASK;
+    __u32 tcp_len = (flags & TCP_FLAG_SYN) ? sizeof(struct tcphdr) + 4 : sizeof(struct tcphdr);
+    int new_len = l3_off + sizeof(struct iphdr) + tcp_len;
+    if (bpf_xdp_adjust_tail(ctx, new_len - (int)(data_end - data)))
+        return XDP_DROP;
+
+    data = (void *)(long)ctx->data;
+    data_end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = data;
+    struct iphdr *ip = data + l3_off;
+    struct tcphdr *tcp = (void *)(ip + 1);
+    if ((void *)(eth + 1) > data_end || (void *)tcp + tcp_len > data_end)
+        return XDP_DROP;
+
+    __u8 mac[ETH_ALEN];
+    __builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+
+    __u32 addr = ip->saddr;
+    ip->saddr = ip->daddr;
+    ip->daddr = addr;
+    ip->ihl = 5;
+    ip->tot_len = bpf_htons(sizeof(struct iphdr) + tcp_len);
+    ip->frag_off = 0;
+    ip->ttl = 64;
+    ip->check = 0;
+    ip->check = ip_checksum(ip);
+
+    // The TCP header now starts right after the IP header, wherever the
+    // segment had it, so the ports come from pc
+    tcp->source = bpf_htons(pc->dst_port);
+    tcp->dest = bpf_htons(pc->src_port);
+    tcp->seq = seq;
+    tcp->ack_seq = ack_seq;
+    ((__u8 *)tcp)[12] = (tcp_len / 4) << 4;
+    ((__u8 *)tcp)[13] = flags;
+    tcp->window = (flags & TCP_FLAG_SYN) ? bpf_htons(65535) : 0;
+    tcp->urg_ptr = 0;
+    if (flags & TCP_FLAG_SYN) {
+        __u8 *opt = (void *)(tcp + 1);
+        opt[0] = 2;  // MSS
+        opt[1] = 4;
+        opt[2] = SYN_PROXY_MSS >> 8;
+        opt[3] = SYN_PROXY_MSS & 0xFF;
+    }
+    tcp->check = 0;
+    tcp->check = tcp_checksum(ip, tcp, data_end);
+    return XDP_TX;
+}
+
+static __always_inline int step_syn_proxy(struct xdp_md *ctx, struct xdp_policy *pol,
+                                          struct xdp_stats *st, struct pipe_ctx *pc) {
+    if (pol->syn_proxy != 1 || pc->protocol != IPPROTO_TCP || !(pc->port_flags & PORT_SYNPROXY))
+        return STEP_CONTINUE;
+
+    // Segments this step cannot check are dropped, never passed on. The
+    // cookie helpers only read the addresses from the IP header, so IP
+    // options are fine; a truncated TCP header is not.
+    void *data_end = (void *)(long)ctx->data_end;
+    struct iphdr *ip = pkt_ptr(ctx, pc->l3_off, sizeof(struct iphdr));
+    struct tcphdr *tcp = pkt_ptr(ctx, pc->l4_off, sizeof(struct tcphdr));
+    if (pc->payload_off == 0 || pc->l4_off == 0 || !ip || !tcp) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_SYN_DROP, XDP_DROP);
+    }
+    __u32 tcp_len = tcp->doff * 4;
+    if (tcp_len < sizeof(struct tcphdr) || tcp_len > 60 || (void *)tcp + tcp_len > data_end) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_SYN_DROP, XDP_DROP);
+    }
+    __u8 flags = pc->tcp_flags;
+
+    // Handshake completed against our cookie: SYNPROXY takes it from here.
+    // Segments the client sends before the origin answers carry the same
+    // acknowledgment number, so they pass this check too.
+    if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST)) == TCP_FLAG_ACK &&
+        bpf_tcp_raw_check_syncookie_ipv4(ip, tcp) == 0)
+        return STEP_CONTINUE;
+
+    if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) != TCP_FLAG_SYN) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_SYN_DROP, XDP_DROP);
+    }
+    __s64 cookie = bpf_tcp_raw_gen_syncookie_ipv4(ip, tcp, tcp_len);
+    if (cookie < 0) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_SYN_DROP, XDP_DROP);
+    }
+    int action = syn_proxy_reply(ctx, pc, TCP_FLAG_SYN | TCP_FLAG_ACK, bpf_htonl((__u32)cookie),
+                                 bpf_htonl(bpf_ntohl(tcp->seq) + 1));
+    if (action == XDP_TX)
+        return verdict(st, VERDICT_SYN_COOKIE, XDP_TX);
+    st->blocked += 1;
+    return verdict(st, VERDICT_SYN_DROP, action);
+}
+
+// ============================================================
+// 6. PPS / BANDWIDTH RATE LIMIT -> DROP if exceeded
+// ============================================================
+// source_rate returns the per-source PPS limit and sets *cpu_pps to its
+// per-CPU bucket size. Attack mode can only tighten the limit.
+static __always_inline __u32 source_rate(struct xdp_policy *pol, struct pipe_ctx *pc, __u32 *cpu_pps) {
+    __u32 rate = pol->rate_limit_pps;
+    __u32 attack_rate = pol->attack_rate_pps;
+    if (pc->attack && attack_rate > 0 && (rate == 0 || attack_rate < rate)) {
+        *cpu_pps = pol->attack_rate_cpu_pps > 0 ? pol->attack_rate_cpu_pps : attack_rate;
+        return attack_rate;
+    }
+    *cpu_pps = pol->rate_limit_cpu_pps > 0 ? pol->rate_limit_cpu_pps : rate;
+    return rate;
+}
+
+// net_limited spends a token from the bucket of key, a source prefix, in
+// map (net_limits*) or percpu_map (net_limits*_percpu) per rate_limit_mode
+static __always_inline int net_limited(struct xdp_policy *pol, void *map, void *percpu_map, void *key, __u64 now) {
+    if (pol->rate_limit_mode == RATE_LIMIT_PERCPU)
+        return rate_limit_take(percpu_map, key,
+                               pol->net_rate_cpu_pps > 0 ? pol->net_rate_cpu_pps : pol->net_rate_pps, now);
+    return rate_limit_take(map, key, pol->net_rate_pps, now);
+}
+
+static __always_inline int step_rate_limit(struct xdp_policy *pol, struct xdp_stats *st, struct pipe_ctx *pc) {
+    __u32 src_ip = pc->src_ip;
+
+    // The source's /24 first: no per-source bucket for a prefix over its limit
+    if (pol->net_rate_pps > 0) {
+        __u32 net = src_ip & NET4_MASK;
+        if (net_limited(pol, &net_limits, &net_limits_percpu, &net, bpf_ktime_get_ns())) {
+            st->rate_limited += 1;
+            record_event(net, BLOCK_REASON_RATE_LIMIT);
+            return verdict(st, VERDICT_NET_LIMIT, XDP_DROP);
+        }
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    if (size_limited(pol, src_ip, pc->pkt_size, now)) {
+        st->rate_limited += 1;
+        record_event(src_ip, BLOCK_REASON_RATE_LIMIT);
+        return verdict(st, VERDICT_SIZE_LIMIT, XDP_DROP);
+    }
+
+    // Per-source PPS, then bytes/s; either one auto-blocks
+    __u32 cpu_pps;
+    __u32 rate_limit_pps = source_rate(pol, pc, &cpu_pps);
+    __u32 reason = 0;
+    if (rate_limit_pps > 0) {
+        int limited;
+        if (pol->rate_limit_mode == RATE_LIMIT_PERCPU)
+            limited = rate_limit_take(&rate_limits_percpu, &src_ip, cpu_pps, now);
+        else
+            limited = rate_limit_take(&rate_limits, &src_ip, rate_limit_pps, now);
+        if (limited)
+            reason = VERDICT_RATE_LIMIT;
+    }
+    if (!reason && pol->rate_limit_bps > 0 &&
+        bucket_take(&byte_limits, &src_ip, pol->rate_limit_bps, pc->pkt_size, now))
+        reason = VERDICT_BYTE_LIMIT;
+
+    if (reason) {
+        // === Block Map TTL: Auto-add to blocklist (v1.15.0) ===
+        if (pol->enable_block_ttl == 1) {
+            __u64 ttl = pol->block_ttl_seconds > 0 ? pol->block_ttl_seconds : 300; // Default 5 min
+            struct block_entry entry = {
+                .expires_at = now + (ttl * 1000000000ULL),
+                .reason = BLOCK_REASON_RATE_LIMIT,
+                .pad = 0
+            };
+            bpf_map_update_elem(&blocked_hosts, &src_ip, &entry, BPF_ANY);
+        }
+
+        st->rate_limited += 1;
+        record_event(src_ip, BLOCK_REASON_RATE_LIMIT);
+        return verdict(st, reason, XDP_DROP);
+    }
+    return STEP_CONTINUE;
+}
+
+// ============================================================
+// 7. GEOIP -> DROP if not in allowed countries
+// ============================================================
+// geo_hard reports whether sources outside the allowed countries drop
+static __always_inline int geo_hard(struct xdp_policy *pol, struct pipe_ctx *pc) {
+    return pol->hard_blocking == 1 || (pc->attack && pol->attack_hard_geo == 1);
+}
+
+static __always_inline int step_geoip(struct xdp_policy *pol, struct xdp_stats *st, struct pipe_ctx *pc) {
+    int geo_drop = 0;
+    if (geo_hard(pol, pc)) {
+        if (pc->has_rule && (pc->rule_flags & RULE_GEO_LOADED))
+            geo_drop = !(pc->rule_flags & RULE_GEO);
+        else
+            geo_drop = geo_denied(pc->src_ip);
+    }
+    if (geo_drop) {
+        st->geoip_blocked += 1;
+        st->blocked += 1;
+        record_event(pc->src_ip, BLOCK_REASON_GEOIP);
+        return verdict(st, VERDICT_GEOIP, XDP_DROP);
+    }
+    return STEP_CONTINUE;
+}
+
+// ============================================================
+// 8. GLOBAL BANDWIDTH LIMIT, UPDATE STATS & PASS
+// ============================================================
+static __always_inline int step_account(struct xdp_policy *pol, struct xdp_stats *st, struct pipe_ctx *pc) {
+    __u32 zero = 0;
+    // Uplink budget: only packets every filtering step has passed spend it
+    if (global_limited(pol, pc->pkt_size, bpf_ktime_get_ns())) {
+        st->rate_limited += 1;
+        return verdict(st, VERDICT_GLOBAL_LIMIT, XDP_DROP);
+    }
+
+    struct acct_state *as = pol->heavy_hitters == 1 ? bpf_map_lookup_elem(&acct_state, &zero) : 0;
+    account_packet(pol, st, as, pc->est, pc->src_ip, pc->dst_port, pc->pkt_size);
+    return STEP_CONTINUE;
+}
+
+// pipeline_pass ends the pipeline for a packet every stage let through
+static __always_inline int pipeline_pass(struct xdp_stats *st, struct pipe_ctx *pc) {
+    st->total_packets += 1;
+    st->total_bytes += pc->pkt_size;
+    st->allowed += 1;
+    return verdict(st, VERDICT_PASS, XDP_PASS);
+}
+
+// ============================================================
+// 0.7 IPV4 FRAGMENTS
+// ============================================================
+// frag_record caches the verdict on a first fragment for the rest of its
+// datagram and returns action. A rewritten reply (XDP_TX) ends the datagram.
+static __always_inline int frag_record(struct xdp_policy *pol, struct pipe_ctx *pc, int action) {
+    if (pc->frag != FRAG_FIRST || pol->frag_filter != 1)
+        return action;
+
+    struct frag_key key = {
+        .src_ip = pc->src_ip,
+        .dst_ip = pc->dst_ip,
+        .id = pc->frag_id,
+        .proto = (__u8)pc->protocol,
+    };
+    struct frag_state state = {
+        .first_seen = bpf_ktime_get_ns(),
+        .bytes = pc->frag_len,
+        .end = pc->frag_len,
+        .action = action == XDP_PASS ? XDP_PASS : XDP_DROP,
+    };
+    bpf_map_update_elem(&frag_states, &key, &state, BPF_ANY);
+    return action;
+}
+
+// step_fragment decides a non-first fragment from its first fragment's verdict
+static __always_inline int step_fragment(struct xdp_stats *st, struct pipe_ctx *pc) {
+    struct frag_key key = {
+        .src_ip = pc->src_ip,
+        .dst_ip = pc->dst_ip,
+        .id = pc->frag_id,
+        .proto = (__u8)pc->protocol,
+    };
+    struct frag_state *state = bpf_map_lookup_elem(&frag_states, &key);
+    __u32 end = (__u32)pc->frag_start + pc->frag_len;
+
+    // Ping of death: the datagram would not fit in an IP packet
+    if (end > FRAG_MAX_END) {
+        if (state)
+            state->action = XDP_DROP;
+        st->blocked += 1;
+        return verdict(st, VERDICT_FRAG_OVERSIZE, XDP_DROP);
+    }
+    if (!state || bpf_ktime_get_ns() - state->first_seen >= FRAG_TTL_NS) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_FRAG_ORPHAN, XDP_DROP);
+    }
+
+    __u32 bytes = __sync_fetch_and_add(&state->bytes, pc->frag_len) + pc->frag_len;
+    if (end > state->end)
+        state->end = end;
+    if (bytes > state->end) {
+        // Teardrop and friends: poison the whole datagram
+        state->action = XDP_DROP;
+        st->blocked += 1;
+        return verdict(st, VERDICT_FRAG_OVERLAP, XDP_DROP);
+    }
+
+    if (state->action != XDP_PASS) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_FRAG_DROP, XDP_DROP);
+    }
+    st->allowed += 1;
+    return verdict(st, VERDICT_FRAG_PASS, XDP_PASS);
+}
+
+// capture_drop redirects a sampled drop to the AF_XDP socket of its RX
+// queue. A queue without a socket falls back to XDP_DROP.
+static __always_inline int capture_drop(struct xdp_md *ctx, struct xdp_policy *pol, struct pipe_ctx *pc) {
+    if ((pol->capture_proto && pol->capture_proto != pc->protocol) ||
+        (pol->capture_port && pol->capture_port != pc->dst_port && pol->capture_port != pc->src_port) ||
+        (pol->capture_host && pol->capture_host != pc->src_ip && pol->capture_host != pc->dst_ip))
+        return XDP_DROP;
+    if (bpf_get_prandom_u32() & (pol->capture_rate - 1))
+        return XDP_DROP;
+    return bpf_redirect_map(&capture_xsks, ctx->rx_queue_index, XDP_DROP);
+}
+
+// pipeline_done is the last step of every program with the packet's final
+// verdict: first fragments record it, captured drops leave through AF_XDP
+static __always_inline int pipeline_done(struct xdp_md *ctx, struct xdp_policy *pol,
+                                         struct pipe_ctx *pc, int action) {
+    action = frag_record(pol, pc, action);
+    if (action == XDP_DROP && pol->capture_rate > 0)
+        return capture_drop(ctx, pol, pc);
+    return action;
+}
+
+// ============================================================
+// IPV6 FILTER (v2.1)
+// ============================================================
+// Same order as the IPv4 path. Signatures, the A2S cache and the SYN proxy
+// are IPv4 only, and drops are not reported as attack events (event_key is
+// an IPv4 address); they still show up in the verdict counters.
+
+// flow6_state returns the flows6 entry a packet to or from remote would use
+static __always_inline struct flow_state *flow6_state(struct ipv6hdr *ip6, __u16 protocol,
+                                                      __u16 src_port, __u16 dst_port) {
+    struct flow_key6 key = {
+        .remote_port = src_port,
+        .local_port = dst_port,
+        .proto = protocol,
+    };
+    __builtin_memcpy(key.remote_ip, &ip6->saddr, 16);
+    __builtin_memcpy(key.local_ip, &ip6->daddr, 16);
+    return bpf_map_lookup_elem(&flows6, &key);
+}
+
+// net6_blocked reports whether the source /64 has a live auto-block
+static __always_inline int net6_blocked(struct xdp_stats *st, __u64 net) {
+    struct block_entry *blocked = bpf_map_lookup_elem(&blocked_nets6, &net);
+    if (!blocked)
+        return 0;
+    if (blocked->expires_at > 0 && bpf_ktime_get_ns() >= blocked->expires_at) {
+        if (bpf_map_delete_elem(&blocked_nets6, &net) == 0)
+            st->block_expired += 1;
+        return 0;
+    }
+    return 1;
+}
+
+static __always_inline void account_packet6(struct xdp_policy *pol, struct xdp_stats *st,
+                                            __u64 net, __u16 dst_port, __u64 pkt_size) {
+    __u64 weight = 1;
+    __u32 rate = pol->stats_sample_rate;
+
+    // Sketch mode has no IPv6 sketch; the insert budget still applies
+    if (pol->stats_mode == STATS_MODE_SAMPLE && rate > 1) {
+        if (bpf_get_prandom_u32() & (rate - 1))
+            return;
+        weight = rate;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    __u32 zero = 0;
+    struct acct_state *as = 0;
+
+    struct packet_stats *stats = bpf_map_lookup_elem(&ip6_stats, &net);
+    if (stats) {
+        stats->packets += weight;
+        stats->bytes += pkt_size * weight;
+        stats->last_seen = now;
     } else {
-        struct packet_stats new_stats = {
-            .packets = 1, .bytes = pkt_size, .last_seen = bpf_ktime_get_ns(), .blocked = 0, .pad = 0,
-        };
-        bpf_map_update_elem(&ip_stats, &src_ip, &new_stats, BPF_ANY);
-    }
-
-    // Per-port stats
-    if (dst_port > 0) {
-        struct port_stats *pstats = bpf_map_lookup_elem(&port_stats, &dst_port);
-        if (pstats) {
-            pstats->packets += 1;
-            pstats->bytes += pkt_size;
+        as = bpf_map_lookup_elem(&acct_state, &zero);
+        if (as && acct_take_insert(as, pol->stats_insert_budget, now)) {
+            struct packet_stats new_stats = {
+                .packets = weight, .bytes = pkt_size * weight, .last_seen = now, .blocked = 0, .pad = 0,
+            };
+            bpf_map_update_elem(&ip6_stats, &net, &new_stats, BPF_NOEXIST);
         } else {
-            struct port_stats new_pstats = { .packets = 1, .bytes = pkt_size };
-            bpf_map_update_elem(&port_stats, &dst_port, &new_pstats, BPF_ANY);
+            st->acct_skipped += 1;
         }
     }
+    account_port(pol, st, as, dst_port, pkt_size, weight, now);
+}
+
+static __always_inline int xdp_filter_ipv6(struct xdp_md *ctx, struct xdp_policy *pol,
+                                           struct xdp_stats *st, struct pipe_ctx *pc) {
+    void *data_end = (void *)(long)ctx->data_end;
+    struct ipv6hdr *ip6 = pkt_ptr(ctx, pc->l3_off, sizeof(struct ipv6hdr));
+    if (!ip6)
+        return XDP_PASS;
+
+    __u64 pkt_size = pc->pkt_size;
+    __u16 protocol = pc->protocol;
+    __u16 src_port = pc->src_port;
+    __u16 dst_port = pc->dst_port;
+    unsigned char *l4 = pc->l4_off ? pkt_ptr(ctx, pc->l4_off, 0) : 0;
+
+    __u32 port_key = dst_port;
+    __u8 *port_entry = bpf_map_lookup_elem(&port_policy, &port_key);
+    __u8 port = port_entry ? *port_entry : PORT_FILTER;
+    __u16 port_action = port & PORT_ACTION_MASK;
+    __u32 port_class = port >> PORT_CLASS_SHIFT;
+
+    // The /64 keys limits and stats
+    __u64 net;
+    __builtin_memcpy(&net, &ip6->saddr, 8);
+
+    if (port_action == PORT_TUNNEL && protocol == IPPROTO_UDP) {
+        if (port_limited6(pol, net, port_class)) {
+            st->rate_limited += 1;
+            return verdict(st, VERDICT_RATE_LIMIT, XDP_DROP);
+        }
+        return verdict(st, VERDICT_WIREGUARD, XDP_PASS);
+    }
+
+    if (pol->maintenance_mode == 1)
+        return verdict(st, VERDICT_MAINTENANCE, XDP_PASS);
+
+    if (port_action == PORT_DROP) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_PORT_DROP, XDP_DROP);
+    }
+
+    if (pol->enable_pkt_validation == 1) {
+        __u32 ip6_len = (void *)data_end - (void *)ip6;
+        if ((ip6->version != 6) || ip6->hop_limit == 0 ||
+            bpf_ntohs(ip6->payload_len) + sizeof(*ip6) > ip6_len ||
+            (l4 && protocol == IPPROTO_UDP &&
+             ((void *)(l4 + 8) > data_end || (((__u16)l4[4] << 8) | l4[5]) < 8))) {
+            st->pkt_invalid += 1;
+            return verdict(st, VERDICT_INVALID, XDP_DROP);
+        }
+    }
+
+    // Neighbor discovery (RS/RA/NS/NA/redirect): IPv6 stops working without it
+    if (l4 && protocol == IPPROTO_ICMPV6 && (void *)(l4 + 1) <= data_end && l4[0] >= 133 && l4[0] <= 137)
+        return verdict(st, VERDICT_IPV6_ND, XDP_PASS);
+
+    // Link-local fe80::/10, unique local fc00::/7, loopback ::1
+    __u8 *saddr = (__u8 *)&ip6->saddr;
+    if ((saddr[0] == 0xFE && (saddr[1] & 0xC0) == 0x80) || (saddr[0] & 0xFE) == 0xFC ||
+        (net == 0 && ip6->saddr.in6_u.u6_addr32[2] == 0 && ip6->saddr.in6_u.u6_addr32[3] == bpf_htonl(1)))
+        return verdict(st, VERDICT_PRIVATE, XDP_PASS);
+
+    if (pol->reflection_filter == 1 && protocol == IPPROTO_UDP && reflection_port(src_port)) {
+        struct flow_state *flow = flow6_state(ip6, IPPROTO_UDP, src_port, dst_port);
+        if (!flow || bpf_ktime_get_ns() - flow->last_seen >= CONN_TRACK_TTL_NS) {
+            st->blocked += 1;
+            return verdict(st, VERDICT_REFLECTION, XDP_DROP);
+        }
+    }
+
+    if (port_limited6(pol, net, port_class)) {
+        st->rate_limited += 1;
+        return verdict(st, VERDICT_RATE_LIMIT, XDP_DROP);
+    }
+
+    if (port_action == PORT_BYPASS)
+        return verdict(st, VERDICT_MGMT_PORT, XDP_PASS);
+
+    // Whitelist -> PASS, blacklist -> DROP
+    struct lpm_key6 key = { .prefixlen = 128 };
+    __builtin_memcpy(key.data, &ip6->saddr, 16);
+    if (bpf_map_lookup_elem(&white_list6, &key)) {
+        st->allowed += 1;
+        return verdict(st, VERDICT_WHITELIST, XDP_PASS);
+    }
+    if (net6_blocked(st, net)) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_BLACKLIST, XDP_DROP);
+    }
+    if (pol->block6_prefixes > 0) {
+        struct block_entry *blocked = bpf_map_lookup_elem(&blocked_ips6, &key);
+        if (blocked) {
+            if (blocked->expires_at > 0 && bpf_ktime_get_ns() >= blocked->expires_at) {
+                if (bpf_map_delete_elem(&blocked_ips6, &key) == 0)
+                    st->block_expired += 1;
+            } else {
+                st->blocked += 1;
+                return verdict(st, VERDICT_BLACKLIST, XDP_DROP);
+            }
+        }
+    }
+
+    // Connection tracking
+    if (l4 && (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP)) {
+        struct flow_state *flow = 0;
+        if (protocol != IPPROTO_TCP || pc->payload_off)
+            flow = flow6_state(ip6, protocol, src_port, dst_port);
+        if (flow && flow_admit(flow, protocol, pc->tcp_flags, pol->flow_rate_pps, conn_ttl(pol, pc))) {
+            st->conn_bypass += 1;
+            return verdict(st, VERDICT_CONN_BYPASS, XDP_PASS);
+        }
+    }
+
+    // Steam A2S query
+    unsigned char *payload = l4_payload(ctx, pc);
+    if (protocol == IPPROTO_UDP && (pol->game_ports != 1 || port_action == PORT_GAME) && payload &&
+        (void *)(payload + 5) <= data_end &&
+        payload[0] == 0xFF && payload[1] == 0xFF && payload[2] == 0xFF && payload[3] == 0xFF) {
+        st->allowed += 1;
+        return verdict(st, VERDICT_A2S, XDP_PASS);
+    }
+
+    // Rate limits: /48 PPS, size class, /64 PPS and bytes/s, global bytes/s
+    if (pol->net_rate_pps > 0) {
+        __u64 net48 = net & NET6_MASK;
+        if (net_limited(pol, &net_limits6, &net_limits6_percpu, &net48, bpf_ktime_get_ns())) {
+            st->rate_limited += 1;
+            return verdict(st, VERDICT_NET_LIMIT, XDP_DROP);
+        }
+    }
+    __u64 now = bpf_ktime_get_ns();
+    if (size_limited6(pol, net, pkt_size, now)) {
+        st->rate_limited += 1;
+        return verdict(st, VERDICT_SIZE_LIMIT, XDP_DROP);
+    }
+    __u32 cpu_pps;
+    __u32 rate_limit_pps = source_rate(pol, pc, &cpu_pps);
+    __u32 reason = 0;
+    if (rate_limit_pps > 0) {
+        int limited;
+        if (pol->rate_limit_mode == RATE_LIMIT_PERCPU)
+            limited = rate_limit_take(&rate_limits6_percpu, &net, cpu_pps, now);
+        else
+            limited = rate_limit_take(&rate_limits6, &net, rate_limit_pps, now);
+        if (limited)
+            reason = VERDICT_RATE_LIMIT;
+    }
+    if (!reason && pol->rate_limit_bps > 0 &&
+        bucket_take(&byte_limits6, &net, pol->rate_limit_bps, pkt_size, now))
+        reason = VERDICT_BYTE_LIMIT;
+    if (reason) {
+        if (pol->enable_block_ttl == 1) {
+            __u64 ttl = pol->block_ttl_seconds > 0 ? pol->block_ttl_seconds : 300;
+            struct block_entry entry = {
+                .expires_at = now + (ttl * 1000000000ULL),
+                .reason = BLOCK_REASON_RATE_LIMIT,
+                .pad = 0
+            };
+            bpf_map_update_elem(&blocked_nets6, &net, &entry, BPF_ANY);
+        }
+        st->rate_limited += 1;
+        return verdict(st, reason, XDP_DROP);
+    }
+    // GeoIP: fail open until the loader has published the IPv6 prefixes
+    if (geo_hard(pol, pc) && pol->geo6_loaded == 1 && !bpf_map_lookup_elem(&geo_allowed6, &key)) {
+        st->geoip_blocked += 1;
+        st->blocked += 1;
+        return verdict(st, VERDICT_GEOIP, XDP_DROP);
+    }
+
+    if (global_limited(pol, pkt_size, now)) {
+        st->rate_limited += 1;
+        return verdict(st, VERDICT_GLOBAL_LIMIT, XDP_DROP);
+    }
+    account_packet6(pol, st, net, dst_port, pkt_size);
+    st->total_packets += 1;
+    st->total_bytes += pkt_size;
+    st->allowed += 1;
+    return verdict(st, VERDICT_PASS, XDP_PASS);
+}
+
+static __always_inline int xdp_filter_ipv4(struct xdp_md *ctx, struct xdp_policy *pol,
+                                           struct xdp_stats *st, struct pipe_ctx *pc) {
+    __u32 src_ip = pc->src_ip;
+    __u16 protocol = pc->protocol;
+    __u16 dst_port = pc->dst_port;
+
+    // One array load decides what the destination port needs
+    __u32 port_key = dst_port;
+    __u8 *port_entry = bpf_map_lookup_elem(&port_policy, &port_key);
+    __u8 port = port_entry ? *port_entry : PORT_FILTER;
+    __u16 port_action = port & PORT_ACTION_MASK;
+    __u32 port_class = port >> PORT_CLASS_SHIFT;
+
+    // ============================================================
+    // 0. TUNNEL BYPASS (HIGHEST PRIORITY)
+    // ============================================================
+    // WireGuard MUST work regardless of any other filter
+    if (port_action == PORT_TUNNEL && protocol == IPPROTO_UDP) {
+        if (port_limited(pol, src_ip, port_class)) {
+            st->rate_limited += 1;
+            return verdict(st, VERDICT_RATE_LIMIT, XDP_DROP);
+        }
+        return verdict(st, VERDICT_WIREGUARD, XDP_PASS);
+    }
+
+    // Maintenance mode: all blocking is temporarily disabled
+    if (pol->maintenance_mode == 1)
+        return verdict(st, VERDICT_MAINTENANCE, XDP_PASS);
+
+    if (port_action == PORT_DROP) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_PORT_DROP, XDP_DROP);
+    }
+
+    // Later fragments carry no ports: follow the first fragment
+    if (pc->frag == FRAG_LATER && pol->frag_filter == 1)
+        return step_fragment(st, pc);
+
+    // ============================================================
+    // 0.5 PACKET VALIDATION (v1.15.0) - Drop invalid packets early
+    // ============================================================
+    if (pol->enable_pkt_validation == 1) {
+        if (validate_packet(ctx, pc) < 0) {
+            st->pkt_invalid += 1;
+            // Record event for invalid packet? Maybe too noisy.
+            return verdict(st, VERDICT_INVALID, XDP_DROP);
+        }
+    }
+
+    // ============================================================
+    // 1. ESSENTIAL BYPASSES (Always Pass)
+    // ============================================================
+    // Private Networks
+    __u32 ip_h = bpf_ntohl(src_ip);
+    if ((ip_h & 0xFF000000) == 0x0A000000 ||  // 10.0.0.0/8
+        (ip_h & 0xFFF00000) == 0xAC100000 ||  // 172.16.0.0/12
+        (ip_h & 0xFFFF0000) == 0xC0A80000 ||  // 192.168.0.0/16
+        (ip_h & 0xFF000000) == 0x7F000000)    // 127.0.0.0/8
+        return verdict(st, VERDICT_PRIVATE, XDP_PASS);
+
+    // ============================================================
+    // 1.2 REFLECTION FAST DROP
+    // ============================================================
+    // Replies from DNS/NTP/SSDP/... ports are only legitimate if we asked.
+    // Other traffic pays one .rodata load; reflection traffic one flow lookup.
+    // No event is recorded: these floods run at millions of packets per second.
+    if (pol->reflection_filter == 1 && protocol == IPPROTO_UDP && reflection_port(pc->src_port) &&
+        !udp_flow_known(pc)) {
+        st->blocked += 1;
+        return verdict(st, VERDICT_REFLECTION, XDP_DROP);
+    }
+
+    // Port rate-limit class, so bypassed ports cannot be flooded either
+    if (port_limited(pol, src_ip, port_class)) {
+        st->rate_limited += 1;
+        return verdict(st, VERDICT_RATE_LIMIT, XDP_DROP);
+    }
+
+    // Management Ports (SSH, Admin Panel, Web UI)
+    if (port_action == PORT_BYPASS)
+        return verdict(st, VERDICT_MGMT_PORT, XDP_PASS);
+
+    // Hand the verdict state to the stages
+    pc->port_action = port_action;
+    pc->port_flags = port & PORT_SYNPROXY;
+    pc->est = 0;
+    pc->has_rule = 0;
+    pc->rule_flags = 0;
+
+    pipeline_next(ctx, STAGE_ACL);
+
+    // No stage linked: fail closed. WireGuard and the management ports
+    // were passed above, so the server stays reachable.
+    st->blocked += 1;
+    return verdict(st, VERDICT_NO_STAGE, XDP_DROP);
+}
+
+SEC("xdp")
+int xdp_traffic_filter(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+    arm_attack_timer();
+
+    // Parse once; every stage below works from pc
+    if (parse_packet(ctx, pc) < 0)
+        return XDP_PASS;
+    pc->attack = attack_update(pol, pc->pkt_size);
+    if (pc->l3_proto == ETH_P_IPV6)
+        return pipeline_done(ctx, pol, pc, xdp_filter_ipv6(ctx, pol, st, pc));
+    return pipeline_done(ctx, pol, pc, xdp_filter_ipv4(ctx, pol, st, pc));
+}
+
+// Stage programs: run one step, then hand over to the next linked stage.
+// Their verdict is the packet's final one, so it goes through pipeline_done.
+
+SEC("xdp")
+int xdp_stage_acl(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_acl(pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_ACL + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
 
-    key = STAT_ALLOWED;
-    cnt = bpf_map_lookup_elem(&global_stats, &key);
-    if (cnt) *cnt += 1;
+SEC("xdp")
+int xdp_stage_conntrack(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_conntrack(pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_CONNTRACK + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_signature(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_signature(ctx, pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_SIGNATURE + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_a2s(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_a2s(ctx, pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_A2S + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_syn_proxy(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_syn_proxy(ctx, pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_SYN_PROXY + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_rate_limit(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_rate_limit(pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_RATE_LIMIT + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_geoip(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
+
+    int action = step_geoip(pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_GEOIP + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
+}
+
+SEC("xdp")
+int xdp_stage_account(struct xdp_md *ctx) {
+    __u32 zero = 0;
+    struct xdp_policy *pol = bpf_map_lookup_elem(&policy, &zero);
+    struct xdp_stats *st = bpf_map_lookup_elem(&global_stats, &zero);
+    struct pipe_ctx *pc = bpf_map_lookup_elem(&pipe_ctx, &zero);
+    if (!pol || !st || !pc)
+        return XDP_PASS;
 
-    return XDP_PASS;
+    int action = step_account(pol, st, pc);
+    if (action != STEP_CONTINUE)
+        return pipeline_done(ctx, pol, pc, action);
+    pipeline_next(ctx, STAGE_ACCOUNT + 1);
+    return pipeline_done(ctx, pol, pc, pipeline_pass(st, pc));
 }
 
 char _license[] SEC("license") = "GPL";
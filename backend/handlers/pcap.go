@@ -26,6 +26,9 @@ type StartCaptureRequest struct {
 	Interface string `json:"interface"`
 	Duration  int    `json:"duration"` // Seconds
 	Filter    string `json:"filter"`
+	// Mode "xdp" samples XDP drops over AF_XDP instead of running tcpdump
+	Mode       string `json:"mode"`
+	SampleRate int    `json:"sample_rate"` // xdp mode: keep 1 in N drops
 }
 
 // StartCapture starts a new packet capture
@@ -41,6 +44,20 @@ func StartCapture(c *fiber.Ctx) error {
 		duration = 60 * time.Second // Default 1 min
 	}
 
+	if req.Mode == "xdp" {
+		filename, err := svc.StartXDPCapture(duration, req.Filter, req.SampleRate)
+		if err != nil {
+			return c.Status(fiber.StatusInternalServerError).JSON(fiber.Map{"error": err.Error()})
+		}
+		status := svc.GetStatus()
+		system.Info("Started XDP capture on %s for %v", status.InterfaceName, duration)
+		return c.JSON(fiber.Map{
+			"message":   "Capture started",
+			"filename":  filename,
+			"interface": status.InterfaceName,
+		})
+	}
+
 	filename, err := svc.StartCapture(req.Interface, duration, req.Filter)
 	if err != nil {
 		return c.Status(fiber.StatusInternalServerError).JSON(fiber.Map{"error": err.Error()})
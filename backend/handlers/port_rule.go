@@ -0,0 +1,113 @@
+package handlers
+
+import (
+	"kg-proxy-web-gui/backend/models"
+
+	"github.com/gofiber/fiber/v2"
+)
+
+// validPortRule checks the fields XDP needs to encode a port rule
+func validPortRule(rule *models.PortRule) bool {
+	switch rule.Action {
+	case "tunnel", "bypass", "filter", "drop":
+	default:
+		return false
+	}
+	if rule.Port < 1 || rule.Port > 65535 || rule.PPSLimit < 0 {
+		return false
+	}
+	return rule.PortEnd == 0 || (rule.PortEnd >= rule.Port && rule.PortEnd <= 65535)
+}
+
+// GetPortRules - Get all XDP port rules
+func (h *Handler) GetPortRules(c *fiber.Ctx) error {
+	var rules []models.PortRule
+	if err := h.DB.Order("port").Find(&rules).Error; err != nil {
+		return c.Status(500).JSON(fiber.Map{"error": "포트 규칙 조회 실패"})
+	}
+	return c.JSON(rules)
+}
+
+// CreatePortRule - Create an XDP port rule
+func (h *Handler) CreatePortRule(c *fiber.Ctx) error {
+	var rule models.PortRule
+	if err := c.BodyParser(&rule); err != nil {
+		return c.Status(400).JSON(fiber.Map{"error": "잘못된 요청 형식"})
+	}
+	if !validPortRule(&rule) {
+		return c.Status(400).JSON(fiber.Map{"error": "포트(1-65535)와 동작(tunnel, bypass, filter, drop)을 확인하세요"})
+	}
+
+	rule.IsBuiltin = false
+	if err := h.DB.Create(&rule).Error; err != nil {
+		return c.Status(500).JSON(fiber.Map{"error": "포트 규칙 생성 실패"})
+	}
+
+	if h.EBPF != nil {
+		go h.EBPF.SyncAllowedPorts()
+	}
+
+	return c.Status(201).JSON(rule)
+}
+
+// UpdatePortRule - Update an XDP port rule
+func (h *Handler) UpdatePortRule(c *fiber.Ctx) error {
+	id := c.Params("id")
+
+	var existing models.PortRule
+	if err := h.DB.First(&existing, id).Error; err != nil {
+		return c.Status(404).JSON(fiber.Map{"error": "포트 규칙을 찾을 수 없습니다"})
+	}
+
+	var update models.PortRule
+	if err := c.BodyParser(&update); err != nil {
+		return c.Status(400).JSON(fiber.Map{"error": "잘못된 요청 형식"})
+	}
+
+	// Builtin rules keep their port and action; only the limit can change
+	existing.PPSLimit = update.PPSLimit
+	if !existing.IsBuiltin {
+		existing.Port = update.Port
+		existing.PortEnd = update.PortEnd
+		existing.Action = update.Action
+		existing.Label = update.Label
+	}
+	if !validPortRule(&existing) {
+		return c.Status(400).JSON(fiber.Map{"error": "포트(1-65535)와 동작(tunnel, bypass, filter, drop)을 확인하세요"})
+	}
+
+	if err := h.DB.Save(&existing).Error; err != nil {
+		return c.Status(500).JSON(fiber.Map{"error": "포트 규칙 업데이트 실패"})
+	}
+
+	if h.EBPF != nil {
+		go h.EBPF.SyncAllowedPorts()
+	}
+
+	return c.JSON(existing)
+}
+
+// DeletePortRule - Delete an XDP port rule
+func (h *Handler) DeletePortRule(c *fiber.Ctx) error {
+	id := c.Params("id")
+
+	var rule models.PortRule
+	if err := h.DB.First(&rule, id).Error; err != nil {
+		return c.Status(404).JSON(fiber.Map{"error": "포트 규칙을 찾을 수 없습니다"})
+	}
+
+	// The WireGuard tunnel rule keeps the proxy reachable
+	if rule.IsBuiltin && rule.Action == "tunnel" {
+		return c.Status(403).JSON(fiber.Map{"error": "WireGuard 터널 규칙은 삭제할 수 없습니다"})
+	}
+
+	if err := h.DB.Delete(&rule).Error; err != nil {
+		return c.Status(500).JSON(fiber.Map{"error": "포트 규칙 삭제 실패"})
+	}
+
+	if h.EBPF != nil {
+		go h.EBPF.SyncAllowedPorts()
+	}
+
+	return c.JSON(fiber.Map{"message": "포트 규칙이 삭제되었습니다"})
+}
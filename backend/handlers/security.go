@@ -163,7 +163,7 @@ func (h *Handler) UpdateSecuritySettings(c *fiber.Ctx) error {
 
 	// Update eBPF Config (XDP settings)
 	if h.EBPF != nil {
-		h.EBPF.UpdateConfig(settings.XDPHardBlocking, settings.XDPRateLimitPPS)
+		h.EBPF.UpdateConfig(&settings)
 	}
 
 	return c.JSON(fiber.Map{"message": "Settings applied successfully", "settings": settings})
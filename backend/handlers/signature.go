@@ -38,6 +38,10 @@ func (h *Handler) CreateSignature(c *fiber.Ctx) error {
 		return c.Status(500).JSON(fiber.Map{"error": "시그니처 생성 실패"})
 	}
 
+	if h.EBPF != nil {
+		go h.EBPF.SyncSignatures()
+	}
+
 	return c.Status(201).JSON(sig)
 }
 
@@ -56,7 +60,10 @@ func (h *Handler) UpdateSignature(c *fiber.Ctx) error {
 	}
 
 	// Builtin signatures can only toggle enabled status
+	reload := false
 	if existing.IsBuiltin {
+		// Builtin reflection ports are compiled into the XDP program
+		reload = existing.Category == "reflection" && existing.Enabled != update.Enabled
 		existing.Enabled = update.Enabled
 	} else {
 		existing.Name = update.Name
@@ -74,6 +81,15 @@ func (h *Handler) UpdateSignature(c *fiber.Ctx) error {
 		return c.Status(500).JSON(fiber.Map{"error": "시그니처 업데이트 실패"})
 	}
 
+	if h.EBPF != nil {
+		if reload {
+			// The reload resyncs the signature table itself
+			go h.EBPF.ReloadProgram()
+		} else {
+			go h.EBPF.SyncSignatures()
+		}
+	}
+
 	return c.JSON(existing)
 }
 
@@ -95,6 +111,10 @@ func (h *Handler) DeleteSignature(c *fiber.Ctx) error {
 		return c.Status(500).JSON(fiber.Map{"error": "시그니처 삭제 실패"})
 	}
 
+	if h.EBPF != nil {
+		go h.EBPF.SyncSignatures()
+	}
+
 	return c.JSON(fiber.Map{"message": "시그니처가 삭제되었습니다"})
 }
 
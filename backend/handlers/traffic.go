@@ -55,6 +55,11 @@ func (h *Handler) GetTrafficData(c *fiber.Ctx) error {
 		"timestamp":        stats.Timestamp,
 		"total_packets":    stats.TotalPackets,   // For graph (cumulative)
 		"blocked_packets":  stats.BlockedPackets, // For graph (cumulative)
+		"verdict_counts":   stats.VerdictCounts,  // Per-reason breakdown (cumulative)
+		"block_expired":    stats.BlockExpired,   // Expired blocks deleted by XDP (cumulative)
+		"attack_mode":      stats.AttackMode,     // XDP attack mode (tightened limits) in force
+		"egress_stats":     stats.EgressStats,    // TC egress tracking overhead (cumulative)
+		"xdp_attachments":  stats.XDPAttachments, // Interface and XDP mode (native/generic)
 	}
 
 	return c.JSON(fiber.Map{
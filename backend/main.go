@@ -79,22 +79,49 @@ func main() {
 		&models.AttackEvent{},
 		&models.AttackSignature{},
 		&models.CountryGroup{},
+		&models.PortRule{},
 	); err != nil {
 		system.Error("Database migration failed: %v", err)
 		log.Fatalf("CRITICAL: Database migration failed. Application cannot start: %v", err)
 	}
 	system.Info("Database migration completed successfully")
 
-	// Seed default attack signatures if empty
-	var sigCount int64
-	db.Model(&models.AttackSignature{}).Count(&sigCount)
-	if sigCount == 0 {
-		for _, sig := range models.SeedDefaultSignatures() {
-			if err := db.Create(&sig).Error; err != nil {
-				system.Warn("Failed to seed signature %s: %v", sig.Name, err)
+	// Older versions accepted xdp_attach_mode "offload", which never worked;
+	// reset it so saving the settings is not refused from now on
+	var attachSettings models.SecuritySettings
+	if db.First(&attachSettings, 1).Error == nil {
+		if err := models.ValidateXDPAttachMode(attachSettings.XDPAttachMode); err != nil {
+			system.Error("%v; resetting it to native", err)
+			db.Model(&attachSettings).UpdateColumn("xdp_attach_mode", "native")
+		}
+	}
+
+	// Seed default attack signatures (builtins added in later versions are seeded too)
+	seeded := 0
+	for _, sig := range models.SeedDefaultSignatures() {
+		var existing models.AttackSignature
+		if db.Where("name = ?", sig.Name).First(&existing).Error == nil {
+			continue
+		}
+		if err := db.Create(&sig).Error; err != nil {
+			system.Warn("Failed to seed signature %s: %v", sig.Name, err)
+			continue
+		}
+		seeded++
+	}
+	if seeded > 0 {
+		system.Info("Seeded %d default attack signatures", seeded)
+	}
+
+	// Seed the XDP port rules on first start (they replace the old hard-coded bypasses)
+	var portRuleCount int64
+	db.Model(&models.PortRule{}).Count(&portRuleCount)
+	if portRuleCount == 0 {
+		for _, rule := range models.SeedDefaultPortRules() {
+			if err := db.Create(&rule).Error; err != nil {
+				system.Warn("Failed to seed port rule %d: %v", rule.Port, err)
 			}
 		}
-		system.Info("Seeded %d default attack signatures", len(models.SeedDefaultSignatures()))
 	}
 
 	// 2. Setup Services
@@ -170,6 +197,9 @@ func main() {
 	// Connect Firewall to eBPF for coordinated maintenance mode
 	fwService.SetEBPF(ebpfService)
 
+	// Connect PCAP to eBPF for XDP drop captures
+	services.NewPCAPService().SetEBPF(ebpfService)
+
 	// 4. Initial Firewall Application
 	// This ensures management ports are open even if the DB was empty
 	// CRITICAL: This must run BEFORE eBPF Enable to ensure GeoIP CIDRs are downloaded and ready
@@ -193,7 +223,7 @@ func main() {
 
 	// Apply saved eBPF configuration
 	if ebpfService.IsEnabled() {
-		ebpfService.UpdateConfig(settings.XDPHardBlocking, settings.XDPRateLimitPPS)
+		ebpfService.UpdateConfig(&settings)
 	}
 
 	// Initialize Webhook Service
@@ -321,6 +351,12 @@ func main() {
 	protected.Delete("/signatures/:id", h.DeleteSignature)
 	protected.Post("/signatures/reset-stats", h.ResetSignatureStats)
 
+	// XDP Port Rules
+	protected.Get("/security/ports", h.GetPortRules)
+	protected.Post("/security/ports", h.CreatePortRule)
+	protected.Put("/security/ports/:id", h.UpdatePortRule)
+	protected.Delete("/security/ports/:id", h.DeletePortRule)
+
 	// Webhook
 	protected.Post("/webhook/test", h.TestWebhook)
 
@@ -380,9 +416,9 @@ func main() {
 
 		sysMonitor.Stop()
 
-		// Disable XDP (detach filter) to ensure fail-open
+		// Detach XDP to fail open, unless xdp_keep_on_exit hands it to the next start
 		if ebpfService.IsEnabled() {
-			ebpfService.Disable()
+			ebpfService.Shutdown()
 		}
 
 		// Send Shutdown Alert
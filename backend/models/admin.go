@@ -1,7 +1,12 @@
 package models
 
 import (
+	"errors"
+	"fmt"
+	"strings"
 	"time"
+
+	"gorm.io/gorm"
 )
 
 type Admin struct {
@@ -33,6 +38,15 @@ type SecuritySettings struct {
 	// XDP Advanced Settings
 	XDPHardBlocking bool `gorm:"default:false" json:"xdp_hard_blocking"` // Drop packets at XDP level instead of passing to iptables
 	XDPRateLimitPPS int  `gorm:"default:0" json:"xdp_rate_limit_pps"`    // Per-IP PPS limit, 0=disabled
+	// Rate limiter: "global" (one shared bucket per IP) or "percpu" (one bucket per IP per CPU)
+	XDPRateLimitMode     string `gorm:"default:'global'" json:"xdp_rate_limit_mode"`
+	XDPRateLimitCPUShare int    `gorm:"default:100" json:"xdp_rate_limit_cpu_share"` // percpu: each CPU bucket gets this % of the PPS limit
+	XDPFlowRateLimitPPS  int    `gorm:"default:0" json:"xdp_flow_rate_limit_pps"`    // Return traffic bypassed per tracked flow per second, 0=unlimited
+	XDPNetRateLimitPPS   int    `gorm:"default:0" json:"xdp_net_rate_limit_pps"`     // Aggregate PPS limit per source /24 (IPv6 /48), 0=disabled
+	XDPRateLimitMbps     int    `gorm:"default:0" json:"xdp_rate_limit_mbps"`        // Per-IP (IPv6 /64) bandwidth limit in Mbit/s, 0=disabled
+	XDPGlobalLimitMbps   int    `gorm:"default:0" json:"xdp_global_limit_mbps"`      // Total ingress bandwidth limit in Mbit/s (split across CPUs), 0=disabled
+	XDPTinyPacketPPS     int    `gorm:"default:0" json:"xdp_tiny_packet_pps"`        // Per-IP PPS of frames up to 128 bytes, 0=disabled
+	XDPLargePacketPPS    int    `gorm:"default:0" json:"xdp_large_packet_pps"`       // Per-IP PPS of frames from 1200 bytes, 0=disabled
 
 	// Discord Webhook Notifications
 	DiscordWebhookURL string `json:"discord_webhook_url,omitempty"`
@@ -62,5 +76,63 @@ type SecuritySettings struct {
 	// Packet Validation: Drop invalid packets at XDP level
 	EnablePacketValidation bool `gorm:"default:false" json:"enable_packet_validation"`
 
+	// === XDP ACCOUNTING (v2.1) ===
+	// Per-IP/per-port stats under spoofed floods: "full", "sample" (1-in-N) or "sketch" (threshold)
+	XDPStatsMode            string `gorm:"default:'full'" json:"xdp_stats_mode"`
+	XDPStatsSampleRate      int    `gorm:"default:16" json:"xdp_stats_sample_rate"`      // Sample mode: account 1-in-N packets (rounded to power of two)
+	XDPStatsSketchThreshold int    `gorm:"default:8" json:"xdp_stats_sketch_threshold"`  // Sketch mode: packets per ~1s window before a source gets an entry
+	XDPStatsInsertBudget    int    `gorm:"default:50000" json:"xdp_stats_insert_budget"` // New stats entries per CPU per second, 0=unlimited
+	XDPHeavyHitters         bool   `gorm:"default:true" json:"xdp_heavy_hitters"`        // Rank top talkers in-kernel (count-min sketch + top-K)
+
+	// === XDP GEOIP ENGINE (v2.1) ===
+	// "trie" (LPM trie of merged CIDRs) or "bitmap" (/24 bitmap, trie only for partial /24s)
+	XDPGeoEngine string `gorm:"default:'trie'" json:"xdp_geo_engine"`
+	// Answer whitelist, blacklist and GeoIP from one compiled LPM trie
+	XDPPolicyTrie bool `gorm:"default:false" json:"xdp_policy_trie"`
+	// Drop unsolicited UDP from reflection source ports (DNS, NTP, SSDP, ...) first thing in XDP
+	XDPReflectionFilter bool `gorm:"default:true" json:"xdp_reflection_filter"`
+	// Answer A2S_INFO/A2S_RULES from a cache in XDP (XDP_TX) instead of the game server
+	XDPA2SCache bool `gorm:"default:false" json:"xdp_a2s_cache"`
+	// Answer SYNs to TCP service ports with SYN cookies in XDP; clients are admitted after one handshake
+	XDPSynProxy bool `gorm:"default:false" json:"xdp_syn_proxy"`
+	// Give later IPv4 fragments their first fragment's verdict and drop orphan/overlapping fragments
+	XDPFragFilter bool `gorm:"default:true" json:"xdp_frag_filter"`
+	// Interfaces to attach XDP to, comma-separated (empty = auto-detect the primary interface)
+	XDPInterfaces string `gorm:"default:''" json:"xdp_interfaces"`
+	// XDP attach mode: "native" (driver, falls back to generic) or "generic". See ValidateXDPAttachMode.
+	XDPAttachMode string `gorm:"default:'native'" json:"xdp_attach_mode"`
+	// Leave XDP attached on shutdown so the next start replaces the program in place (no unprotected gap)
+	XDPKeepOnExit bool `gorm:"default:false" json:"xdp_keep_on_exit"`
+
+	// === XDP ATTACK MODE (v2.1) ===
+	// XDP switches to attack mode by itself when total ingress reaches either trip rate (0 = trigger off)
+	XDPAttackTripPPS     int  `gorm:"default:0" json:"xdp_attack_trip_pps"`
+	XDPAttackTripMbps    int  `gorm:"default:0" json:"xdp_attack_trip_mbps"`
+	XDPAttackRelaxPct    int  `gorm:"default:50" json:"xdp_attack_relax_pct"`    // Relax once ingress stays below this % of the trip rates...
+	XDPAttackHoldSeconds int  `gorm:"default:30" json:"xdp_attack_hold_seconds"` // ...for this long
+	XDPAttackRatePPS     int  `gorm:"default:0" json:"xdp_attack_rate_pps"`      // Per-IP PPS limit in attack mode, 0=keep xdp_rate_limit_pps
+	XDPAttackHardGeo     bool `gorm:"default:true" json:"xdp_attack_hard_geo"`   // Hard GeoIP blocking in attack mode
+	XDPAttackFlowTTL     int  `gorm:"default:30" json:"xdp_attack_flow_ttl"`     // Conntrack bypass TTL in attack mode (seconds), 0=keep 180s
+
 	UpdatedAt time.Time `json:"updated_at"`
 }
+
+// ValidateXDPAttachMode rejects xdp_attach_mode values the XDP filter cannot
+// run in. NIC offload is one of them: offloaded programs are limited to
+// array and hash maps and a handful of helpers, and the filter needs LRU
+// and LPM maps, tail calls, timers and the ring buffer.
+func ValidateXDPAttachMode(mode string) error {
+	switch strings.ToLower(strings.TrimSpace(mode)) {
+	case "", "native", "generic":
+		return nil
+	case "offload":
+		return errors.New(`xdp_attach_mode "offload" is not supported: the XDP filter uses maps and helpers NIC offload cannot run, use "native" or "generic"`)
+	default:
+		return fmt.Errorf(`xdp_attach_mode %q is invalid, use "native" or "generic"`, mode)
+	}
+}
+
+// BeforeSave refuses to store settings that cannot work
+func (s *SecuritySettings) BeforeSave(tx *gorm.DB) error {
+	return ValidateXDPAttachMode(s.XDPAttachMode)
+}
@@ -74,6 +74,36 @@ func SeedDefaultSignatures() []AttackSignature {
 			IsBuiltin: true,
 			Enabled:   true,
 		},
+		{
+			Name:      "CLDAP Amplification",
+			Category:  "reflection",
+			Protocol:  "UDP",
+			SrcPort:   389,
+			Action:    "block",
+			PPSLimit:  10,
+			IsBuiltin: true,
+			Enabled:   true,
+		},
+		{
+			Name:      "SNMP Amplification",
+			Category:  "reflection",
+			Protocol:  "UDP",
+			SrcPort:   161,
+			Action:    "rate_limit",
+			PPSLimit:  50,
+			IsBuiltin: true,
+			Enabled:   true,
+		},
+		{
+			Name:      "WS-Discovery Amplification",
+			Category:  "reflection",
+			Protocol:  "UDP",
+			SrcPort:   3702,
+			Action:    "block",
+			PPSLimit:  10,
+			IsBuiltin: true,
+			Enabled:   true,
+		},
 		{
 			Name:      "Steam A2S Query",
 			Category:  "game_query",
@@ -0,0 +1,27 @@
+package models
+
+import "time"
+
+// PortRule sets the XDP policy for a destination port or port range
+type PortRule struct {
+	ID        uint      `gorm:"primaryKey" json:"id"`
+	Port      int       `gorm:"not null" json:"port"`
+	PortEnd   int       `gorm:"default:0" json:"port_end"`  // Range end (0 = single port)
+	Action    string    `gorm:"not null" json:"action"`     // tunnel, bypass, filter, drop
+	PPSLimit  int       `gorm:"default:0" json:"pps_limit"` // Per-source PPS limit (0 = unlimited)
+	Label     string    `json:"label"`                      // e.g., "WireGuard", "SSH"
+	IsBuiltin bool      `gorm:"default:false" json:"is_builtin"`
+	CreatedAt time.Time `json:"created_at"`
+}
+
+// SeedDefaultPortRules returns the rules replacing the old hard-coded XDP
+// bypasses. Game ports come from ServicePort and need no rule.
+func SeedDefaultPortRules() []PortRule {
+	return []PortRule{
+		{Port: 51820, Action: "tunnel", Label: "WireGuard", IsBuiltin: true},
+		{Port: 22, Action: "bypass", PPSLimit: 200, Label: "SSH", IsBuiltin: true},
+		{Port: 80, Action: "bypass", PPSLimit: 1000, Label: "HTTP", IsBuiltin: true},
+		{Port: 443, Action: "bypass", PPSLimit: 1000, Label: "HTTPS", IsBuiltin: true},
+		{Port: 8080, Action: "bypass", PPSLimit: 1000, Label: "Web GUI", IsBuiltin: true},
+	}
+}
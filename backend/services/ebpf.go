@@ -3,17 +3,20 @@
 package services
 
 import (
-	"bytes"
 	"encoding/binary"
 	"errors"
 	"fmt"
+	"hash/fnv"
 	"net"
 	"os"
 	"os/exec"
 	"path/filepath"
 	"runtime"
+	"slices"
+	"sort"
 	"strings"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"kg-proxy-web-gui/backend/models"
@@ -50,13 +53,273 @@ type BlockEntry struct {
 	Pad       uint32
 }
 
-// AggregatedEvent for smart batching
-type AggregatedEvent struct {
-	SourceIP  uint32
-	Reason    uint32
-	Count     int64
-	FirstSeen time.Time
-	LastSeen  time.Time
+// XDPPolicy matches the C struct xdp_policy
+type XDPPolicy struct {
+	HardBlocking        uint32
+	RateLimitPPS        uint32
+	EnableBlockTTL      uint32
+	BlockTTLSeconds     uint32
+	EnablePktValidation uint32
+	MaintenanceMode     uint32
+	StatsMode           uint32
+	StatsSampleRate     uint32
+	StatsSketchThresh   uint32
+	StatsInsertBudget   uint32
+	HeavyHitters        uint32
+	PolicyTrie          uint32
+	BlockPrefixes       uint32
+	RateLimitMode       uint32
+	RateLimitCPUPPS     uint32
+	FlowRatePPS         uint32
+	SignatureShapes     uint32
+	ReflectionFilter    uint32
+	GamePorts           uint32
+	PortClassPPS        [portClasses]uint32
+	A2SCache            uint32
+	SynProxy            uint32
+	Block6Prefixes      uint32
+	Geo6Loaded          uint32
+	FragFilter          uint32
+	CaptureRate         uint32
+	CaptureProto        uint32
+	CapturePort         uint32
+	CaptureHost         uint32
+	AttackTripPPS       uint32
+	AttackTripMbps      uint32
+	AttackRelaxPct      uint32
+	AttackHoldSeconds   uint32
+	AttackRatePPS       uint32
+	AttackRateCPUPPS    uint32
+	AttackHardGeo       uint32
+	AttackFlowTTL       uint32
+	NetRatePPS          uint32
+	NetRateCPUPPS       uint32
+	RateLimitBPS        uint32
+	GlobalCPUBPS        uint32
+	SizeTinyPPS         uint32
+	SizeLargePPS        uint32
+}
+
+// attackModeEnabled reports whether XDP runs its attack mode state machine
+func (p *XDPPolicy) attackModeEnabled() bool {
+	return p.AttackTripPPS > 0 || p.AttackTripMbps > 0
+}
+
+// rateLimited reports whether any limit of the rate-limit stage may apply
+func (p *XDPPolicy) rateLimited() bool {
+	return p.RateLimitPPS > 0 || p.NetRatePPS > 0 || p.RateLimitBPS > 0 ||
+		p.SizeTinyPPS > 0 || p.SizeLargePPS > 0 || (p.attackModeEnabled() && p.AttackRatePPS > 0)
+}
+
+// Accounting modes, match STATS_MODE_* in xdp_filter.c
+const (
+	statsModeFull   = 0
+	statsModeSample = 1
+	statsModeSketch = 2
+)
+
+// statsModeFromString maps the XDPStatsMode setting to a STATS_MODE_* value
+func statsModeFromString(mode string) uint32 {
+	switch strings.ToLower(mode) {
+	case "sample":
+		return statsModeSample
+	case "sketch":
+		return statsModeSketch
+	default:
+		return statsModeFull
+	}
+}
+
+// Rate limiter modes, match RATE_LIMIT_* in xdp_filter.c
+const (
+	rateLimitGlobal = 0
+	rateLimitPerCPU = 1
+)
+
+// rateLimitModeFromString maps the XDPRateLimitMode setting to a RATE_LIMIT_* value
+func rateLimitModeFromString(mode string) uint32 {
+	if strings.ToLower(mode) == "percpu" {
+		return rateLimitPerCPU
+	}
+	return rateLimitGlobal
+}
+
+// perCPURateLimit sizes each CPU's bucket as sharePercent of the per-source limit
+func perCPURateLimit(pps, sharePercent int) uint32 {
+	if sharePercent <= 0 || sharePercent > 100 {
+		sharePercent = 100
+	}
+	perCPU := (pps*sharePercent + 99) / 100
+	if perCPU < 1 {
+		perCPU = 1
+	}
+	return uint32(perCPU)
+}
+
+// minByteRate keeps a byte bucket, which holds one second of its rate, large
+// enough for a jumbo frame
+const minByteRate = 9216
+
+// byteRate converts a Mbit/s limit into the byte rate of one of buckets
+// sharing it, 0 if the limit is off
+func byteRate(mbps, buckets int) uint32 {
+	if mbps <= 0 {
+		return 0
+	}
+	rate := uint64(mbps) * 125000 / uint64(max(buckets, 1))
+	return uint32(min(max(rate, minByteRate), uint64(^uint32(0))))
+}
+
+// GeoIP engines, selected by the XDPGeoEngine setting
+const (
+	geoEngineTrie   = "trie"
+	geoEngineBitmap = "bitmap"
+)
+
+// geoEngineFromString normalizes the XDPGeoEngine setting
+func geoEngineFromString(engine string) string {
+	if strings.ToLower(engine) == geoEngineBitmap {
+		return geoEngineBitmap
+	}
+	return geoEngineTrie
+}
+
+// geoBitmapWords matches GEO_BITMAP_WORDS: one bit per /24, 64 per word
+const geoBitmapWords = (1 << 24) / 64
+
+// GeoWord matches the C struct geo_word
+type GeoWord struct {
+	Full  uint64
+	Mixed uint64
+}
+
+// roundUpPow2 rounds n up to a power of two (the XDP sampler uses a bit mask)
+func roundUpPow2(n uint32) uint32 {
+	p := uint32(1)
+	for p < n && p < 1<<16 {
+		p <<= 1
+	}
+	return p
+}
+
+// verdictMax matches VERDICT_MAX in xdp_filter.c
+const verdictMax = 32
+
+// verdictNames maps VERDICT_* indices to API names
+var verdictNames = [...]string{
+	"wireguard", "maintenance", "invalid", "private", "mgmt_port", "whitelist",
+	"blacklist", "conn_bypass", "a2s", "rate_limit", "geoip", "pass", "signature",
+	"reflection", "port_drop", "a2s_cached", "syn_cookie", "syn_drop", "ipv6_nd",
+	"frag_pass", "frag_drop", "frag_orphan", "frag_overlap", "frag_oversize",
+	"net_limit", "byte_limit", "global_limit", "size_limit", "no_stage",
+}
+
+// XDPStats matches the C struct xdp_stats
+type XDPStats struct {
+	TotalPackets uint64
+	TotalBytes   uint64
+	Blocked      uint64
+	Allowed      uint64
+	RateLimited  uint64
+	ConnBypass   uint64
+	GeoIPBlocked uint64
+	PktInvalid   uint64
+	AcctSkipped  uint64
+	AcctHeld     uint64
+	BlockExpired uint64
+	Verdicts     [verdictMax]uint64
+}
+
+// add accumulates another CPU's counters into s
+func (s *XDPStats) add(o *XDPStats) {
+	s.TotalPackets += o.TotalPackets
+	s.TotalBytes += o.TotalBytes
+	s.Blocked += o.Blocked
+	s.Allowed += o.Allowed
+	s.RateLimited += o.RateLimited
+	s.ConnBypass += o.ConnBypass
+	s.GeoIPBlocked += o.GeoIPBlocked
+	s.PktInvalid += o.PktInvalid
+	s.AcctSkipped += o.AcctSkipped
+	s.AcctHeld += o.AcctHeld
+	s.BlockExpired += o.BlockExpired
+	for i := range s.Verdicts {
+		s.Verdicts[i] += o.Verdicts[i]
+	}
+}
+
+// verdictCounts returns the per-reason packet counters keyed by name
+func (s *XDPStats) verdictCounts() map[string]int64 {
+	counts := make(map[string]int64, len(verdictNames))
+	for i, name := range verdictNames {
+		counts[name] = int64(s.Verdicts[i])
+	}
+	return counts
+}
+
+// readGlobalStats sums the per-CPU global_stats value with a single lookup
+func readGlobalStats(objs *xdpObjects) (XDPStats, error) {
+	var total XDPStats
+	var values []XDPStats
+	if err := objs.GlobalStats.Lookup(uint32(0), &values); err != nil {
+		return total, err
+	}
+	for i := range values {
+		total.add(&values[i])
+	}
+	return total, nil
+}
+
+// readTCStats sums the per-CPU tc_stats value with a single lookup
+func readTCStats(objs *tcObjects) (TCEgressStats, error) {
+	var total TCEgressStats
+	var values []TCEgressStats
+	if err := objs.TcStats.Lookup(uint32(0), &values); err != nil {
+		return total, err
+	}
+	for _, v := range values {
+		total.TotalPackets += v.TotalPackets
+		total.Tracked += v.Tracked
+		total.TCPTracked += v.TCPTracked
+		total.UDPTracked += v.UDPTracked
+		total.FlowInserts += v.FlowInserts
+		total.FlowWrites += v.FlowWrites
+		total.FlowSkipped += v.FlowSkipped
+	}
+	return total, nil
+}
+
+// Sketch and top-K geometry, match SKETCH_* and HH_TOPK in xdp_filter.c
+const (
+	sketchDepth = 4
+	sketchWidth = 1024
+	hhTopK      = 32
+)
+
+// heavyHitterMaxAge drops top-K candidates not refreshed within this window
+const heavyHitterMaxAge = 10 * time.Second
+
+// HHEntry matches the C struct hh_entry
+type HHEntry struct {
+	IP       uint32
+	Count    uint32
+	LastSeen uint64
+}
+
+// AcctState matches the C struct acct_state
+type AcctState struct {
+	WindowStart uint64
+	Inserts     uint32
+	_           uint32 // padding
+	Sketch      [sketchDepth][sketchWidth]uint32
+	TopK        [hhTopK]HHEntry
+}
+
+// heavyHitter is a top-K candidate merged across CPUs
+type heavyHitter struct {
+	ip       uint32
+	count    uint64
+	lastSeen uint64
 }
 
 // EBPFService manages eBPF/XDP traffic monitoring
@@ -67,15 +330,21 @@ type EBPFService struct {
 	stopChan    chan struct{}
 	isRunning   bool
 
-	// Event Aggregation
-	eventChan chan AggregatedEvent
+	// Event Aggregation: full batches go over eventChan, empty ones return via eventFree
+	eventChan chan *eventBatch
+	eventFree chan *eventBatch
 	// Real eBPF objects - using interface{} to avoid build errors when generated files are missing
 	// In production (Linux build), this will hold *xdpObjects
 	objs         interface{}
-	link         link.Link
 	geoIPService *GeoIPService
 
-	// Interface name
+	// XDP attachments, one per interface, and the requested interfaces
+	// (empty = auto-detect) and mode they were attached with
+	xdpLinks     []xdpLink
+	attachIfaces []string
+	attachMode   string
+
+	// Primary interface name (the first XDP interface)
 	ifaceName string
 
 	// Boot time for timestamp conversion
@@ -97,12 +366,55 @@ type EBPFService struct {
 	// State for log suppression
 	lastGeoIPCount int
 
+	// GeoIP double buffering: geo_allowed points at geoInner (and geo_bitmap
+	// at geoBitmap in bitmap mode); a refresh builds new inner maps from the
+	// specs and swaps them in
+	geoMu          sync.Mutex
+	geoEngine      string
+	geoInnerSpec   *ebpf.MapSpec
+	geoInner       *ebpf.Map
+	geoBitmapSpec  *ebpf.MapSpec
+	geoBitmap      *ebpf.Map
+	geoFingerprint uint64
+	geo6Keys       map[LpmKey6]struct{} // geo_allowed6 contents
+
+	// Unified policy trie: whitelist/blacklist rule sets as last written to
+	// white_list/blocked_ips, compiled into policy_rules when enabled
+	ruleMu        sync.Mutex
+	allowRules    map[LpmKey]struct{}
+	blockRules    map[LpmKey]BlockEntry
+	block6Keys    map[LpmKey6]struct{} // blocked_ips6 contents
+	ruleInnerSpec *ebpf.MapSpec
+	ruleInner     *ebpf.Map
+
+	// Attack signatures: signature ID per sig_hits slot and the hit totals
+	// already added to the DB
+	sigMu       sync.Mutex
+	sigSlotIDs  []uint
+	sigLastHits []uint64
+
+	// Per-port policy: last table written to port_policy and the objects it
+	// was written to
+	portMu    sync.Mutex
+	portTable []uint8
+	portObjs  *xdpObjects
+
+	// Last published XDP policy (re-published on every program load)
+	policy   XDPPolicy
+	policyMu sync.Mutex
+
+	// AF_XDP capture sockets by RX queue, republished on every program load
+	captureMu  sync.Mutex
+	captureFDs map[uint32]int
+
 	// TC egress connection tracking
-	tcObjs           interface{}
-	tcLink           link.Link
-	tcLegacyAttached bool   // True if legacy tc command was used
-	tcLegacyIface    string // Interface name for legacy cleanup
-	bpfPinPath       string // Path to pinned BPF maps
+	tcObjs         interface{}
+	tcLinks        map[string]link.Link // TCX attachments by XDP interface
+	tcLegacyIfaces []string             // Interfaces attached with the legacy tc command
+	bpfPinPath     string               // Path to pinned BPF maps
+	keepOnExit     atomic.Bool          // Leave XDP attached on shutdown (xdp_keep_on_exit)
+	attackSince    atomic.Int64         // Unix ns of the last attack mode entry, 0 = not in attack mode
+	blocksSwept    atomic.Uint64        // Expired blocks deleted by the userspace sweep
 
 	// RingBuffer
 	ringBuf *ringbuf.Reader
@@ -137,10 +449,16 @@ func NewEBPFService() *EBPFService {
 		trafficData:  make([]TrafficEntry, 0),
 		stopChan:     make(chan struct{}),
 		ifaceName:    ifaceName,
+		attachMode:   xdpModeNative,
 		bootTime:     boot,
 		lastSnapshot: time.Now(),
 		bpfPinPath:   "/sys/fs/bpf/kg_proxy",
-		eventChan:    make(chan AggregatedEvent, 10000), // Buffer size for high PPS
+		eventChan:    make(chan *eventBatch, eventBatchPool),
+		eventFree:    newEventFreeList(),
+		allowRules:   make(map[LpmKey]struct{}),
+		blockRules:   make(map[LpmKey]BlockEntry),
+		block6Keys:   make(map[LpmKey6]struct{}),
+		geo6Keys:     make(map[LpmKey6]struct{}),
 	}
 }
 
@@ -168,24 +486,40 @@ func (e *EBPFService) Enable() error {
 		return fmt.Errorf("eBPF is only supported on Linux")
 	}
 
-	// Try to load real eBPF program
-	if err := e.loadEBPFProgram(); err != nil {
+	if err := e.start(); err != nil {
+		return err
+	}
+	system.Info("eBPF XDP filter loaded and attached to %s", strings.Join(e.xdpInterfaceNames(), ", "))
+	return nil
+}
+
+// start loads and attaches the program and starts the background loops.
+// Every goroutine of this run, including the ring buffer reader and the
+// event aggregator started while loading, gets the run's own stop channel,
+// so one left over from a previous run never sees a later one. Caller holds
+// e.mu.
+func (e *EBPFService) start() error {
+	stop := make(chan struct{})
+	if err := e.loadEBPFProgram(stop); err != nil {
+		close(stop)
 		return fmt.Errorf("failed to load eBPF program: %w", err)
 	}
 
 	e.enabled = true
 	e.isRunning = true
-	e.stopChan = make(chan struct{})
+	e.stopChan = stop
 
 	// Start real traffic collection from eBPF maps
-	go e.collectTrafficFromEBPF()
+	go e.collectTrafficFromEBPF(stop)
 
 	// Start GeoIP map sync loop (retry initially to catch up with GeoIP DB load)
-	go e.startGeoIPSyncLoop()
+	go e.startGeoIPSyncLoop(stop)
 
-	// Event Aggregator will be started if RingBuffer is available
+	// Keep the XDP A2S reply cache fresh (idle unless the cache is enabled)
+	go e.startA2SCacheLoop(stop)
 
-	system.Info("eBPF XDP filter loaded and attached to %s", e.ifaceName)
+	// Delete expired blocks whose sources never come back
+	go e.startBlockSweepLoop(stop)
 	return nil
 }
 
@@ -197,49 +531,39 @@ func intToIP(nn uint32) string {
 }
 
 // startEventAggregator processes events from RingBuffer with smart batching
-func (e *EBPFService) startEventAggregator() {
-	// Aggregation Map: Key "IP-Reason" -> *AggregatedEvent
-	// We use string key because we can't use struct as map key if it contains slices usually, but here struct is simple.
-	// Using struct key directly is faster.
-	type AggKey struct {
-		SrcIP  uint32
-		Reason uint32
-	}
-
-	aggMap := make(map[AggKey]*AggregatedEvent)
+func (e *EBPFService) startEventAggregator(stop <-chan struct{}) {
+	// Table, GeoIP cache and DB batch are reused across flushes
+	table := newAggTable()
+	geo := newEventGeoCache()
+	batch := make([]models.AttackEvent, 0, 1024)
+	dropped := 0
 
 	// Batch Interval: 3 Seconds (per user request)
 	ticker := time.NewTicker(3 * time.Second)
 	defer ticker.Stop()
 
 	flush := func() {
-		if len(aggMap) == 0 {
+		if dropped > 0 {
+			system.Warn("Attack event table full, %d events dropped in the last batch", dropped)
+			dropped = 0
+		}
+		if table.len() == 0 {
 			return
 		}
 
-		batch := make([]models.AttackEvent, 0, len(aggMap))
-
-		// Hard limit batch size to prevent DB choke (e.g., 2000 events per flush)
-		// If more than 2000 unique IP+Reason pairs, we might need multiple flushes or drop some.
-		// For now, we process all but use CreateInBatches.
-
-		for _, agg := range aggMap {
-			ipStr := intToIP(agg.SourceIP)
-
-			// Get Country
-			countryName := "Unknown"
-			countryCode := "XX"
-			if e.geoIPService != nil {
-				countryName, countryCode = e.geoIPService.GetCountry(ipStr)
-			}
+		batch = batch[:0]
+		table.each(func(s *aggSlot) {
+			srcIP, reason := uint32(s.key>>32), uint32(s.key)
+			loc := geo.get(srcIP, e.geoIPService)
 
 			// Map Reason Code to String
 			// #define BLOCK_REASON_MANUAL     1
 			// #define BLOCK_REASON_RATE_LIMIT 2
 			// #define BLOCK_REASON_GEOIP      3
 			// #define BLOCK_REASON_FLOOD      4
+			// #define BLOCK_REASON_SIGNATURE  5
 			reasonStr := "unknown"
-			switch agg.Reason {
+			switch reason {
 			case 1:
 				reasonStr = "blacklist"
 			case 2:
@@ -248,28 +572,30 @@ func (e *EBPFService) startEventAggregator() {
 				reasonStr = "geoip_violation"
 			case 4:
 				reasonStr = "flood"
+			case 5:
+				reasonStr = "signature"
 			}
 
 			// Calculate PPS (Average over the batch interval, or just store count)
 			// Storing total count in 'Count' field.
 			// PPS = Count / 3 (since batch is 3s)
-			pps := agg.Count / 3
-			if pps == 0 && agg.Count > 0 {
+			pps := s.count / 3
+			if pps == 0 && s.count > 0 {
 				pps = 1
 			}
 
 			batch = append(batch, models.AttackEvent{
-				Timestamp:   agg.FirstSeen, // Use first seen time for the record
-				SourceIP:    ipStr,
-				CountryCode: countryCode,
-				CountryName: countryName,
+				Timestamp:   e.bootTime.Add(time.Duration(s.first)), // Use first seen time for the record
+				SourceIP:    loc.ip,
+				CountryCode: loc.code,
+				CountryName: loc.name,
 				AttackType:  reasonStr,
 				PPS:         pps,
-				Count:       agg.Count,
+				Count:       s.count,
 				Action:      "blocked",
-				Details:     fmt.Sprintf("Blocked %d packets in 3s batch", agg.Count),
+				Details:     fmt.Sprintf("Blocked %d packets in 3s batch", s.count),
 			})
-		}
+		})
 
 		// Save to DB
 		if e.db != nil && len(batch) > 0 {
@@ -278,41 +604,51 @@ func (e *EBPFService) startEventAggregator() {
 			}
 		}
 
-		// Reset map
-		aggMap = make(map[AggKey]*AggregatedEvent)
+		table.reset()
+	}
+
+	// Merge the in-kernel counters; their key count is bounded by event_counts
+	mergeKernelCounts := func() {
+		e.drainEventCounts(func(k EventKey, total EventCount) {
+			if !table.add(k.SrcIP, k.Reason, int64(total.Count), total.FirstSeen, total.LastSeen) {
+				dropped++
+			}
+		})
 	}
 
 	for {
 		select {
-		case <-e.stopChan:
+		case <-stop:
 			flush() // Flush remaining before exit
 			return
-		case event := <-e.eventChan:
-			key := AggKey{SrcIP: event.SourceIP, Reason: event.Reason}
-			if agg, exists := aggMap[key]; exists {
-				agg.Count++
-				agg.LastSeen = event.LastSeen
-			} else {
-				// Safety: Prevent OOM if too many unique IPs
-				if len(aggMap) > 50000 {
-					continue // Drop event if map is too full (Under attack by >50k unique IPs)
+		case b := <-e.eventChan:
+			// Ring buffer overflow samples, already weighted by their sampling period
+			for i := 0; i < b.n; i++ {
+				r := &b.records[i]
+				if !table.add(r.SrcIP, r.Reason, int64(r.Count), r.Seen, r.Seen) {
+					dropped++ // Under attack by more unique IPs than the table holds
 				}
-				aggMap[key] = &event
 			}
+			b.n = 0
+			e.eventFree <- b
 		case <-ticker.C:
+			mergeKernelCounts()
 			flush()
 		}
 	}
 }
 
-// loadEBPFProgram loads the compiled eBPF program
-func (e *EBPFService) loadEBPFProgram() error {
-	// Detect network interface
-	iface, err := e.detectInterface()
+// loadEBPFProgram loads the compiled eBPF program. The event goroutines it
+// starts run until stop is closed.
+func (e *EBPFService) loadEBPFProgram(stop <-chan struct{}) error {
+	// Configured XDP interfaces, or the detected primary interface
+	settings := e.loadSavedSettings()
+	e.loadAttachConfig(settings)
+	ifaces, err := e.resolveInterfaces()
 	if err != nil {
 		return fmt.Errorf("failed to detect network interface: %w", err)
 	}
-	e.ifaceName = iface.Name
+	e.ifaceName = ifaces[0].Name
 
 	// Create BPF pin directory for map sharing
 	if err := os.MkdirAll(e.bpfPinPath, 0755); err != nil {
@@ -327,11 +663,72 @@ func (e *EBPFService) loadEBPFProgram() error {
 			PinPath: e.bpfPinPath,
 		},
 	}
-	if err := loadXdpObjects(objs, opts); err != nil {
+	spec, err := loadXdp()
+	if err != nil {
+		return fmt.Errorf("loading eBPF spec: %w", err)
+	}
+	geoSpec, ok := spec.Maps["geo_allowed"]
+	if !ok || geoSpec.InnerMap == nil {
+		return fmt.Errorf("geo_allowed map-in-map definition missing from eBPF spec")
+	}
+	bitmapSpec, ok := spec.Maps["geo_bitmap"]
+	if !ok || bitmapSpec.InnerMap == nil {
+		return fmt.Errorf("geo_bitmap map-in-map definition missing from eBPF spec")
+	}
+	rulesSpec, ok := spec.Maps["policy_rules"]
+	if !ok || rulesSpec.InnerMap == nil {
+		return fmt.Errorf("policy_rules map-in-map definition missing from eBPF spec")
+	}
+	if v, ok := spec.Variables["reflection_ports"]; ok {
+		if err := v.Set(e.reflectionPorts()); err != nil {
+			return fmt.Errorf("setting reflection ports: %w", err)
+		}
+	}
+	// Pinned state carries over from the previous program unless its layout changed
+	e.dropIncompatiblePins(spec)
+	err = spec.LoadAndAssign(objs, opts)
+	if errors.Is(err, ebpf.ErrMapIncompatible) {
+		system.Warn("Pinned eBPF maps do not match the new program, starting from empty maps: %v", err)
+		e.removeMapPins(spec)
+		err = spec.LoadAndAssign(objs, opts)
+	}
+	if err != nil {
 		return fmt.Errorf("loading eBPF objects: %w", err)
 	}
 	e.objs = objs
 
+	// Fresh outer maps: forget the previous inner maps so GeoIP is rebuilt
+	e.geoMu.Lock()
+	e.geoInnerSpec = geoSpec.InnerMap.Copy()
+	e.geoBitmapSpec = bitmapSpec.InnerMap.Copy()
+	e.closeGeoMaps()
+	if settings != nil {
+		e.geoEngine = geoEngineFromString(settings.XDPGeoEngine)
+	}
+	e.geoMu.Unlock()
+	e.closePolicyTrie()
+	e.ruleMu.Lock()
+	e.ruleInnerSpec = rulesSpec.InnerMap.Copy()
+	clear(e.block6Keys) // blocked_ips6 starts out empty
+	e.ruleMu.Unlock()
+
+	// Restore the last known policy so a reload keeps the active settings,
+	// and apply the saved ones so a first load never runs on defaults
+	capturing := e.restoreCaptureSockets(objs)
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) {
+		if settings != nil {
+			applySettingsPolicy(p, settings)
+		}
+		if !capturing {
+			p.CaptureRate = 0
+		}
+	}); err != nil {
+		// Without its stages the entry program drops everything it does not bypass
+		e.closeObjects()
+		return fmt.Errorf("publishing XDP policy: %w", err)
+	}
+	e.refreshPolicyTrie(objs)
+
 	// Initialize Ring Buffer
 	if eventsMap := objs.xdpMaps.Events; eventsMap != nil {
 		rb, err := ringbuf.NewReader(eventsMap)
@@ -339,14 +736,10 @@ func (e *EBPFService) loadEBPFProgram() error {
 			system.Warn("Failed to create ringbuf reader: %v", err)
 		} else {
 			e.ringBuf = rb
-			go e.consumeRingBuffer()
-			// Start Smart Batching Aggregator (only if RingBuffer AND stopChan are available)
-			if e.stopChan != nil {
-				go e.startEventAggregator()
-				system.Info("eBPF event aggregator started (3s batching)")
-			} else {
-				system.Warn("stopChan not initialized, skipping aggregator")
-			}
+			go e.consumeRingBuffer(rb, stop)
+			// Start Smart Batching Aggregator
+			go e.startEventAggregator(stop)
+			system.Info("eBPF event aggregator started (3s batching)")
 		}
 	} else {
 		system.Warn("Events map not found in eBPF objects, attack logging disabled")
@@ -357,16 +750,28 @@ func (e *EBPFService) loadEBPFProgram() error {
 		system.Warn("Failed to populate GeoIP map initially: %v", err)
 	}
 
-	// Attach XDP program to interface
-	l, err := link.AttachXDP(link.XDPOptions{
-		Program:   objs.XdpTrafficFilter,
-		Interface: iface.Index,
-	})
-	if err != nil {
-		objs.Close()
+	// Port policy before attaching too: until it is written, WireGuard and
+	// the management ports are filtered like any other port
+	if err := e.SyncAllowedPorts(); err != nil {
+		system.Warn("Failed to sync allowed ports on startup: %v", err)
+	}
+
+	// Manual blocks left in blocked_hosts by an older version move out of
+	// the LRU before XDP runs
+	e.migrateManualHosts(objs)
+
+	// Whitelist before attaching as well, so a program replaced in place
+	// never runs without it
+	if err := e.SyncWhitelist(); err != nil {
+		system.Warn("Failed to sync whitelist on startup: %v", err)
+	}
+
+	// Attach XDP program to every interface, replacing a program left
+	// attached by the previous process in place
+	if err := e.attachXDP(objs.XdpTrafficFilter, ifaces); err != nil {
+		e.closeObjects()
 		return fmt.Errorf("attaching XDP program: %w", err)
 	}
-	e.link = l
 
 	// Load and attach TC egress program for connection tracking
 	if err := e.loadTCProgram(); err != nil {
@@ -374,21 +779,19 @@ func (e *EBPFService) loadEBPFProgram() error {
 	} else {
 		system.Info("TC egress connection tracking enabled")
 	}
+	e.releaseStaleLinks()
 
 	// Initialize BPF maps with GeoIP data
 	if e.geoIPService != nil {
 		e.UpdateGeoIPData()
 	}
 
-	// Sync Allowed Ports (Dynamic Game Ports)
-	if err := e.SyncAllowedPorts(); err != nil {
-		system.Warn("Failed to sync allowed ports on startup: %v", err)
-	}
-
-	// Sync Whitelist (DB + Critical DNS)
-	if err := e.SyncWhitelist(); err != nil {
-		system.Warn("Failed to sync whitelist on startup: %v", err)
-	}
+	// Compile attack signatures (runs once the caller releases e.mu)
+	go func() {
+		if err := e.SyncSignatures(); err != nil {
+			system.Warn("Failed to sync attack signatures: %v", err)
+		}
+	}()
 
 	return nil
 }
@@ -400,13 +803,7 @@ func (e *EBPFService) loadTCProgram() error {
 	// Internet inbound: WAN ingress (XDP) -> de-NAT -> wg0 -> Origin
 	// So we track on WAN egress to catch Origin's outbound traffic
 
-	// Use the same interface that XDP is attached to
-	wanIface, err := net.InterfaceByName(e.ifaceName)
-	if err != nil {
-		return fmt.Errorf("WAN interface %s not found: %w", e.ifaceName, err)
-	}
-
-	// Load TC objects with same pin path to share active_connections map
+	// Load TC objects with same pin path to share the flows map
 	tcObjs := &tcObjects{}
 	opts := &ebpf.CollectionOptions{
 		Maps: ebpf.MapOptions{
@@ -418,30 +815,82 @@ func (e *EBPFService) loadTCProgram() error {
 	}
 	e.tcObjs = tcObjs
 
-	// Try modern TCX first (kernel >= 6.6), then fallback to legacy netlink
-	tcLink, err := link.AttachTCX(link.TCXOptions{
-		Interface: wanIface.Index,
-		Program:   tcObjs.TcEgressTrack,
-		Attach:    ebpf.AttachTCXEgress,
-	})
-	if err == nil {
-		e.tcLink = tcLink
-		system.Info("TC egress attached to %s via TCX (kernel >= 6.6)", e.ifaceName)
-		return nil
+	if err := e.attachTC(tcObjs); err != nil {
+		e.detachTC()
+		tcObjs.Close()
+		e.tcObjs = nil
+		return err
 	}
+	return nil
+}
 
-	// Fallback: Use legacy netlink-based TC attachment for older kernels
-	system.Warn("TCX not supported, trying legacy TC attachment: %v", err)
-
-	if err := e.attachTCLegacy(wanIface.Index, tcObjs.TcEgressTrack); err != nil {
-		tcObjs.Close()
-		return fmt.Errorf("legacy TC attachment failed: %w", err)
+// attachTC attaches the TC egress program to every XDP interface, so flows
+// are tracked whichever interface their return traffic comes in on
+func (e *EBPFService) attachTC(tcObjs *tcObjects) error {
+	if e.tcLinks == nil {
+		e.tcLinks = make(map[string]link.Link)
 	}
+	for _, x := range e.xdpLinks {
+		// A link held from the running program (ReloadProgram)
+		if l, ok := e.tcLinks[x.name]; ok {
+			err := l.Update(tcObjs.TcEgressTrack)
+			if err == nil {
+				system.Info("TC egress program on %s replaced in place", x.name)
+				continue
+			}
+			system.Warn("Failed to replace TC egress program on %s in place: %v", x.name, err)
+			l.Close()
+			delete(e.tcLinks, x.name)
+		}
+		if l, ok := e.adoptTCXLink(tcObjs.TcEgressTrack, x.name); ok {
+			e.tcLinks[x.name] = l
+			system.Info("TC egress program on %s replaced in place", x.name)
+			continue
+		}
+
+		// Try modern TCX first (kernel >= 6.6), then fallback to legacy netlink
+		tcLink, err := link.AttachTCX(link.TCXOptions{
+			Interface: x.ifindex,
+			Program:   tcObjs.TcEgressTrack,
+			Attach:    ebpf.AttachTCXEgress,
+		})
+		if err == nil {
+			e.tcLinks[x.name] = tcLink
+			system.Info("TC egress attached to %s via TCX (kernel >= 6.6)", x.name)
+			continue
+		}
 
-	system.Info("TC egress attached to %s via legacy netlink", e.ifaceName)
+		// Fallback: Use legacy netlink-based TC attachment for older kernels
+		system.Warn("TCX not supported, trying legacy TC attachment: %v", err)
+
+		if err := e.attachTCLegacy(x.ifindex, tcObjs.TcEgressTrack); err != nil {
+			return fmt.Errorf("legacy TC attachment on %s failed: %w", x.name, err)
+		}
+		system.Info("TC egress attached to %s via legacy netlink", x.name)
+	}
 	return nil
 }
 
+// detachTC removes the TC egress program from every interface
+func (e *EBPFService) detachTC() {
+	// Detach legacy TC first (if using tc command)
+	for _, iface := range e.tcLegacyIfaces {
+		exec.Command("tc", "filter", "del", "dev", iface, "egress").Run()
+		exec.Command("tc", "qdisc", "del", "dev", iface, "clsact").Run()
+		system.Info("Legacy TC egress program detached from %s", iface)
+	}
+	e.tcLegacyIfaces = nil
+
+	// Detach TC egress program (TCX method)
+	for _, l := range e.tcLinks {
+		l.Close()
+	}
+	if len(e.tcLinks) > 0 {
+		system.Info("TC egress program detached")
+	}
+	e.tcLinks = nil
+}
+
 // attachTCLegacy uses the tc command to attach the BPF program for older kernels
 func (e *EBPFService) attachTCLegacy(ifIndex int, prog *ebpf.Program) error {
 	// Get interface name from index
@@ -471,8 +920,9 @@ func (e *EBPFService) attachTCLegacy(ifIndex int, prog *ebpf.Program) error {
 		return fmt.Errorf("attaching TC filter: %s: %w", string(out), err)
 	}
 
-	e.tcLegacyAttached = true
-	e.tcLegacyIface = iface.Name
+	if !slices.Contains(e.tcLegacyIfaces, iface.Name) {
+		e.tcLegacyIfaces = append(e.tcLegacyIfaces, iface.Name)
+	}
 	return nil
 }
 
@@ -504,7 +954,7 @@ func (e *EBPFService) detectInterface() (*net.Interface, error) {
 	return nil, fmt.Errorf("no suitable network interface found")
 }
 
-// UpdateGeoIPData populates the geo_allowed BPF map
+// UpdateGeoIPData populates the GeoIP BPF maps
 func (e *EBPFService) UpdateGeoIPData() error {
 	if e.objs == nil || e.geoIPService == nil {
 		return nil
@@ -515,73 +965,268 @@ func (e *EBPFService) UpdateGeoIPData() error {
 		return nil
 	}
 
-	// system.Info("Populating GeoIP BPF map...")
-	count := 0
+	e.geoMu.Lock()
+	defer e.geoMu.Unlock()
 
-	allCIDRs := e.geoIPService.GetAllCountryCIDRs()
+	// IPv6 has a single trie, updated in place by diff
+	e.publishGeo6(objs)
 
-	for country, cidrs := range allCIDRs {
-		if len(country) < 2 {
-			continue
+	// Skip the rebuild if the GeoIP data and engine have not changed since the last swap
+	engine := geoEngineFromString(e.geoEngine)
+	start := time.Now()
+	ranges := e.geoIPService.GetMergedCIDRRanges()
+	fingerprint := geoFingerprint(ranges, engine)
+	if e.geoFingerprint != 0 && fingerprint == e.geoFingerprint {
+		return nil
+	}
+
+	var count int
+	var err error
+	if engine == geoEngineBitmap {
+		count, err = e.publishGeoBitmap(objs, ranges)
+	} else {
+		count, err = e.publishGeoTrie(objs, ranges)
+	}
+	if err != nil {
+		return err
+	}
+
+	if count > 0 {
+		e.geoFingerprint = fingerprint
+		// Keep the GeoIP copy in the policy trie in step with the GeoIP maps
+		if err := e.rebuildPolicyTrie(objs, e.policyGeoRangesLocked()); err != nil {
+			system.Warn("Failed to rebuild policy trie: %v", err)
+		}
+		if count != e.lastGeoIPCount {
+			system.Info("GeoIP BPF map update (%s): %d entries from %d merged ranges loaded in %s",
+				engine, count, len(ranges), time.Since(start).Round(time.Millisecond))
+			e.lastGeoIPCount = count
+		}
+	} else {
+		system.Warn("⚠️ CRITICAL: No GeoIP data loaded! Disabling Hard Blocking to prevent lockout.")
+		// Fail-Safe: Disable Hard Blocking if no countries are loaded
+		if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.HardBlocking = 0 }); err != nil {
+			system.Warn("Failed to apply fail-safe (disable hard blocking): %v", err)
 		}
-		// Convert country code (e.g., "KR") to 16-bit int
-		c0 := strings.ToUpper(country)[0]
-		c1 := strings.ToUpper(country)[1]
-		countryCode := uint32(c0)<<8 | uint32(c1)
+	}
+	return nil
+}
 
-		for _, cidr := range cidrs {
-			_, ipNet, err := net.ParseCIDR(cidr)
-			if err != nil {
-				continue
-			}
-			ip := ipNet.IP.To4()
-			if ip == nil {
-				continue
-			}
+// publishGeoTrie swaps in a trie holding every merged range and retires the
+// bitmap, returning the number of prefixes loaded. Caller holds geoMu.
+func (e *EBPFService) publishGeoTrie(objs *xdpObjects, ranges []IPv4Range) (int, error) {
+	count, err := e.swapGeoTrie(objs, buildGeoTrieKeys(ranges, int(e.geoInnerSpec.MaxEntries)))
+	if err != nil || count == 0 {
+		return count, err
+	}
+
+	// The full trie is live, so the bitmap can go
+	if e.geoBitmap != nil {
+		if err := objs.GeoBitmap.Delete(uint32(0)); err != nil {
+			system.Warn("Failed to retire geo_bitmap: %v", err)
+		}
+		e.geoBitmap.Close()
+		e.geoBitmap = nil
+	}
+	return count, nil
+}
 
-			// Use byte array for raw order to match network byte order in BPF
-			ones, _ := ipNet.Mask.Size()
+// publishGeoBitmap swaps in a /24 bitmap of the merged ranges, then a trie
+// holding only the pieces of partially allowed /24s. The bitmap goes first so
+// that, while switching over from trie mode, mixed blocks are still answered
+// by the old full trie. Returns the number of words plus prefixes loaded.
+// Caller holds geoMu.
+func (e *EBPFService) publishGeoBitmap(objs *xdpObjects, ranges []IPv4Range) (int, error) {
+	words, partial := buildGeoBitmap(ranges)
+
+	// The inner array starts zeroed, so only non-empty words are written
+	var indexes []uint32
+	var values []GeoWord
+	for i, w := range words {
+		if w != (GeoWord{}) {
+			indexes = append(indexes, uint32(i))
+			values = append(values, w)
+		}
+	}
+	if len(indexes) == 0 {
+		return 0, nil
+	}
+
+	bitmap, err := ebpf.NewMap(e.geoBitmapSpec)
+	if err != nil {
+		return 0, fmt.Errorf("creating geo_bitmap inner array: %w", err)
+	}
+	// A partially written bitmap would drop allowed blocks, so it is all or nothing
+	if n, err := batchPut(bitmap, indexes, values); err != nil || n != len(indexes) {
+		bitmap.Close()
+		return 0, fmt.Errorf("filling geo_bitmap (%d of %d words): %w", n, len(indexes), err)
+	}
+	if err := objs.GeoBitmap.Put(uint32(0), bitmap); err != nil {
+		bitmap.Close()
+		return 0, fmt.Errorf("swapping geo_bitmap inner array: %w", err)
+	}
+	if e.geoBitmap != nil {
+		e.geoBitmap.Close()
+	}
+	e.geoBitmap = bitmap
 
-			// LPM Trie Key
-			key := struct {
-				PrefixLen uint32
-				Data      [4]byte // Use [4]byte to ensure byte-perfect order
-			}{
-				PrefixLen: uint32(ones),
+	keys := buildGeoTrieKeys(partial, int(e.geoInnerSpec.MaxEntries))
+	if len(keys) == 0 {
+		// No partial /24s: the trie is never consulted, so drop it
+		if e.geoInner != nil {
+			if err := objs.GeoAllowed.Delete(uint32(0)); err != nil {
+				system.Warn("Failed to retire geo_allowed trie: %v", err)
 			}
-			copy(key.Data[:], ip.To4())
+			e.geoInner.Close()
+			e.geoInner = nil
+		}
+		return len(indexes), nil
+	}
+	count, err := e.swapGeoTrie(objs, keys)
+	if err != nil {
+		return 0, err
+	}
+	return len(indexes) + count, nil
+}
 
-			if err := objs.GeoAllowed.Put(key, countryCode); err != nil {
-				system.Warn("Failed to add IP to geo_allowed map: %v", err)
-				continue
+// swapGeoTrie builds a new geo_allowed inner trie off to the side and
+// publishes it with one update. Caller holds geoMu.
+func (e *EBPFService) swapGeoTrie(objs *xdpObjects, keys []LpmKey) (int, error) {
+	if len(keys) == 0 {
+		return 0, nil
+	}
+	inner, err := ebpf.NewMap(e.geoInnerSpec)
+	if err != nil {
+		return 0, fmt.Errorf("creating geo_allowed inner trie: %w", err)
+	}
+	values := make([]uint32, len(keys))
+	for i := range values {
+		values[i] = 1
+	}
+	count, err := batchPut(inner, keys, values)
+	if err != nil {
+		system.Warn("Failed to add %d CIDRs to geo_allowed map: %v", len(keys)-count, err)
+	}
+	if count == 0 {
+		// Never publish an empty trie: hard blocking would drop everything
+		inner.Close()
+		return 0, nil
+	}
+	if err := objs.GeoAllowed.Put(uint32(0), inner); err != nil {
+		inner.Close()
+		return 0, fmt.Errorf("swapping geo_allowed inner trie: %w", err)
+	}
+	if e.geoInner != nil {
+		e.geoInner.Close()
+	}
+	e.geoInner = inner
+	return count, nil
+}
+
+// closeGeoMaps releases our handles on the current inner maps. The kernel
+// frees them once the outer maps and in-flight programs drop their references.
+// Caller holds geoMu.
+func (e *EBPFService) closeGeoMaps() {
+	if e.geoInner != nil {
+		e.geoInner.Close()
+		e.geoInner = nil
+	}
+	if e.geoBitmap != nil {
+		e.geoBitmap.Close()
+		e.geoBitmap = nil
+	}
+	e.geoFingerprint = 0
+	clear(e.geo6Keys)
+}
+
+// geoFingerprint identifies the merged GeoIP ranges and engine, so unchanged
+// refreshes can skip rebuilding the maps. Every range is hashed: the maps
+// hold exactly these ranges, so any change to them changes the fingerprint.
+func geoFingerprint(ranges []IPv4Range, engine string) uint64 {
+	h := fnv.New64a()
+	fmt.Fprintf(h, "%s;%d;", engine, len(ranges))
+	var buf [8]byte
+	for _, r := range ranges {
+		binary.LittleEndian.PutUint32(buf[0:4], r.Start)
+		binary.LittleEndian.PutUint32(buf[4:8], r.End)
+		h.Write(buf[:])
+	}
+	return h.Sum64()
+}
+
+// buildGeoTrieKeys expands merged ranges into the minimal set of
+// geo_allowed prefixes, capped at limit entries
+func buildGeoTrieKeys(ranges []IPv4Range, limit int) []LpmKey {
+	keys := make([]LpmKey, 0, len(ranges))
+	dropped := 0
+	for _, r := range ranges {
+		r.ForEachCIDR(func(base uint32, prefixLen int) {
+			if len(keys) >= limit {
+				dropped++
+				return
 			}
-			count++
+			key := LpmKey{PrefixLen: uint32(prefixLen)}
+			binary.BigEndian.PutUint32(key.Data[:], base)
+			keys = append(keys, key)
+		})
+	}
+	if dropped > 0 {
+		system.Warn("GeoIP map limit reached, %d of %d CIDRs not added", dropped, len(keys)+dropped)
+	}
+	return keys
+}
 
-			// Limit to prevent map overflow
-			if count >= 1000000 {
-				system.Warn("GeoIP map limit reached, some IPs not added")
-				return nil
+// buildGeoBitmap compiles merged ranges into geo_bitmap words. /24 blocks a
+// range only partly covers are marked mixed, and the covered pieces are
+// returned so they can go into the trie.
+func buildGeoBitmap(ranges []IPv4Range) ([]GeoWord, []IPv4Range) {
+	words := make([]GeoWord, geoBitmapWords)
+	var partial []IPv4Range
+	for _, r := range ranges {
+		for block := r.Start >> 8; block <= r.End>>8; block++ {
+			lo, hi := block<<8, block<<8|0xFF
+			bit := uint64(1) << (block & 63)
+			if r.Start <= lo && r.End >= hi {
+				words[block>>6].Full |= bit
+				continue
 			}
+			words[block>>6].Mixed |= bit
+			partial = append(partial, IPv4Range{Start: max(r.Start, lo), End: min(r.End, hi)})
 		}
 	}
+	return words, partial
+}
 
-	if count > 0 && count != e.lastGeoIPCount {
-		system.Info("GeoIP BPF map update: %d CIDRs loaded", count)
-		e.lastGeoIPCount = count
-	} else if count == 0 {
-		system.Warn("⚠️ CRITICAL: No GeoIP data loaded! Disabling Hard Blocking to prevent lockout.")
-		// Fail-Safe: Disable Hard Blocking if no countries are loaded
-		// Index 0 is configuration for Hard Blocking
-		configHardBlocking := uint32(0)
-		if err := objs.Config.Put(configHardBlocking, uint32(0)); err != nil {
-			system.Warn("Failed to apply fail-safe (disable hard blocking): %v", err)
+// parseLpmKey parses an IPv4 address or CIDR into an LPM trie key
+func parseLpmKey(s string) (LpmKey, bool) {
+	key := LpmKey{PrefixLen: 32}
+
+	// Try single IP first
+	ip := net.ParseIP(s)
+	if ip == nil {
+		// Try CIDR
+		var ipNet *net.IPNet
+		var err error
+		ip, ipNet, err = net.ParseCIDR(s)
+		if err != nil {
+			return key, false
 		}
+		ones, _ := ipNet.Mask.Size()
+		key.PrefixLen = uint32(ones)
+		ip = ipNet.IP
 	}
-	return nil
+
+	// Use byte array for raw order to match network byte order in BPF
+	ip4 := ip.To4()
+	if ip4 == nil {
+		return key, false
+	}
+	copy(key.Data[:], ip4)
+	return key, true
 }
 
 // collectTrafficFromEBPF reads real data from eBPF maps
-func (e *EBPFService) collectTrafficFromEBPF() {
+func (e *EBPFService) collectTrafficFromEBPF(stop <-chan struct{}) {
 	// Optimization: Reduce polling to 5s to prevent syscall flooding during attacks
 	ticker := time.NewTicker(5 * time.Second)
 	defer ticker.Stop()
@@ -590,26 +1235,33 @@ func (e *EBPFService) collectTrafficFromEBPF() {
 	snapshotTicker := time.NewTicker(1 * time.Minute)
 	defer snapshotTicker.Stop()
 
+	// Signature hit counters are folded into the DB every 10s
+	sigTicker := time.NewTicker(10 * time.Second)
+	defer sigTicker.Stop()
+
 	for {
 		select {
-		case <-e.stopChan:
+		case <-stop:
 			return
 		case <-ticker.C:
 			e.readEBPFMaps()
 		case <-snapshotTicker.C:
 			e.saveTrafficSnapshot()
+		case <-sigTicker.C:
+			e.syncSignatureHits()
 		}
 	}
 }
 
 // startGeoIPSyncLoop keeps the eBPF GeoIP map in sync with the GeoIP service
-func (e *EBPFService) startGeoIPSyncLoop() {
+func (e *EBPFService) startGeoIPSyncLoop(stop <-chan struct{}) {
 	// Initial retry phase: try frequently for the first 30 seconds
 	// directly after startup, GeoIP DB might still be downloading/loading.
 	for i := 0; i < 30; i++ {
-		time.Sleep(1 * time.Second)
-		if !e.isRunning {
+		select {
+		case <-stop:
 			return
+		case <-time.After(1 * time.Second):
 		}
 		// We blindly attempt update. If GeoIP service has data, it populates map.
 		// If not, it does nothing or partial update. It's safe.
@@ -622,7 +1274,7 @@ func (e *EBPFService) startGeoIPSyncLoop() {
 
 	for {
 		select {
-		case <-e.stopChan:
+		case <-stop:
 			return
 		case <-ticker.C:
 			e.UpdateGeoIPData()
@@ -630,52 +1282,76 @@ func (e *EBPFService) startGeoIPSyncLoop() {
 	}
 }
 
-// consumeRingBuffer reads events from the Ring Buffer
-func (e *EBPFService) consumeRingBuffer() {
-	if e.ringBuf == nil {
-		return
-	}
+// consumeRingBuffer reads events from rb until stop is closed, then closes it
+func (e *EBPFService) consumeRingBuffer(rb *ringbuf.Reader, stop <-chan struct{}) {
+	// ReadInto reuses the sample buffer; records are decoded into batches
+	// from the free list and handed over a batch at a time
+	var record ringbuf.Record
+	var batch *eventBatch
 
-	// Match C struct event_data
-	var event struct {
-		SrcIP     uint32
-		Reason    uint32
-		Timestamp uint64
+	send := func() {
+		if batch == nil || batch.n == 0 {
+			return
+		}
+		select {
+		case e.eventChan <- batch:
+			batch = nil
+		default:
+			// Channel full, drop the batch and reuse it (safe degradation)
+			batch.n = 0
+		}
 	}
+	// Hand a half-filled batch back so a reload starts with the full pool
+	defer func() {
+		if batch != nil {
+			batch.n = 0
+			e.eventFree <- batch
+		}
+	}()
 
+	// XDP submits most records without a wakeup, so a partial batch is sent
+	// whenever the deadline passes without it filling up
+	rb.SetDeadline(time.Now().Add(eventPollInterval))
 	for {
 		select {
-		case <-e.stopChan:
-			if e.ringBuf != nil {
-				e.ringBuf.Close()
-			}
+		case <-stop:
+			rb.Close()
 			return
 		default:
 		}
 
-		record, err := e.ringBuf.Read()
-		if err != nil {
+		if err := rb.ReadInto(&record); err != nil {
 			if errors.Is(err, ringbuf.ErrClosed) {
 				return
 			}
+			if errors.Is(err, os.ErrDeadlineExceeded) {
+				send()
+				rb.SetDeadline(time.Now().Add(eventPollInterval))
+			}
 			continue
 		}
 
-		if err := binary.Read(bytes.NewReader(record.RawSample), binary.LittleEndian, &event); err != nil {
+		raw := record.RawSample
+		if len(raw) < eventRecordSize {
 			continue
 		}
+		if binary.LittleEndian.Uint32(raw[4:8]) == eventAttackMode {
+			e.handleAttackTransition(raw)
+			continue
+		}
+		if batch == nil {
+			select {
+			case batch = <-e.eventFree:
+			default:
+				continue // Every batch is in flight, drop the record
+			}
+		}
 
-		// Send to aggregator
-		select {
-		case e.eventChan <- AggregatedEvent{
-			SourceIP:  event.SrcIP,
-			Reason:    event.Reason,
-			Count:     1,
-			FirstSeen: time.Now(),
-			LastSeen:  time.Now(),
-		}:
-		default:
-			// Channel full, drop event (safe degradation)
+		batch.records[batch.n] = decodeEventRecord(raw)
+		batch.n++
+		if batch.n == eventBatchSize {
+			send()
+			rb.SetDeadline(time.Now().Add(eventPollInterval))
 		}
 	}
 }
@@ -692,71 +1368,168 @@ func (e *EBPFService) readEBPFMaps() {
 	}
 
 	// Create new local slice (Double Buffering)
+	// Prefer the in-kernel top-K table: O(K) and ranked by volume. Fall back to
+	// walking ip_stats when heavy hitters are off or nobody is heavy yet.
+	var newTrafficData []TrafficEntry
+	if e.heavyHittersEnabled() {
+		if hitters, err := e.readHeavyHitters(objs); err != nil {
+			system.Warn("Error reading heavy hitters: %v", err)
+		} else if len(hitters) > 0 {
+			newTrafficData = e.trafficFromHeavyHitters(objs, hitters)
+		}
+	}
+	if newTrafficData == nil {
+		newTrafficData = e.trafficFromIPStats(objs)
+	}
+	newTrafficData = append(newTrafficData, e.trafficFromIP6Stats(objs)...)
+
+	// Swap pointer (Atomic-like)
+	e.mu.Lock()
+	e.trafficData = newTrafficData
+	e.mu.Unlock()
+
+	// Save periodic snapshot (every 1 minute)
+	e.saveTrafficSnapshot()
+}
+
+// trafficFromIPStats walks ip_stats and returns up to 1000 entries
+func (e *EBPFService) trafficFromIPStats(objs *xdpObjects) []TrafficEntry {
 	newTrafficData := make([]TrafficEntry, 0, 1000)
 
-	// Iterate over the map (Per-CPU)
+	// In sample mode XDP adds N per sampled packet, so counts are already scaled
+	_, err := batchReadPerCPU(objs.IpStats, 1000, false, func(key [4]byte, values []PacketStats) {
+		newTrafficData = append(newTrafficData, e.newTrafficEntry(key, sumPacketStats(values)))
+	})
+	if err == nil {
+		return newTrafficData
+	}
+	if !errors.Is(err, errBatchUnsupported) {
+		system.Warn("Error batch reading ip_stats map: %v", err)
+	}
+	newTrafficData = newTrafficData[:0]
+
+	// Fallback: iterate over the map (Per-CPU)
 	var key [4]byte
 	var values []PacketStats // Per-CPU means value is a slice
 
 	iter := objs.IpStats.Iterate()
 	for iter.Next(&key, &values) {
-		// Sum up Per-CPU values
-		var totalPackets uint64
-		var totalBytes uint64
-		var lastSeen uint64
-		var blocked bool
+		newTrafficData = append(newTrafficData, e.newTrafficEntry(key, sumPacketStats(values)))
 
-		for _, v := range values {
-			totalPackets += v.Packets
-			totalBytes += v.Bytes
-			if v.LastSeen > lastSeen {
-				lastSeen = v.LastSeen
-			}
-			if v.Blocked > 0 {
-				blocked = true
-			}
+		// Limit entries
+		if len(newTrafficData) >= 1000 {
+			break
 		}
+	}
+
+	if err := iter.Err(); err != nil {
+		system.Warn("Error iterating ip_stats map: %v", err)
+	}
+	return newTrafficData
+}
 
-		// Convert key bytes directly to IP
-		ip := net.IPv4(key[0], key[1], key[2], key[3])
+// trafficFromHeavyHitters builds entries for the ranked top talkers, taking
+// totals from ip_stats when the source has an entry there
+func (e *EBPFService) trafficFromHeavyHitters(objs *xdpObjects, hitters []heavyHitter) []TrafficEntry {
+	entries := make([]TrafficEntry, 0, len(hitters))
+	var values []PacketStats
+
+	for _, h := range hitters {
+		var key [4]byte
+		binary.LittleEndian.PutUint32(key[:], h.ip)
 
-		// Get country code
-		countryCode := "XX"
-		if e.geoIPService != nil {
-			countryCode = e.geoIPService.GetCountryCode(ip.String())
+		total := PacketStats{Packets: h.count, LastSeen: h.lastSeen}
+		if err := objs.IpStats.Lookup(key, &values); err == nil {
+			total = sumPacketStats(values)
 		}
+		entries = append(entries, e.newTrafficEntry(key, total))
+	}
+	return entries
+}
 
-		// Create entry
-		entry := TrafficEntry{
-			SourceIP:    ip.String(),
-			DestPort:    0,
-			Protocol:    "IP",
-			PacketCount: int(totalPackets),
-			ByteCount:   int64(totalBytes),
-			Timestamp:   e.bootTime.Add(time.Duration(lastSeen)),
-			Blocked:     blocked,
-			CountryCode: countryCode,
+// sumPacketStats folds per-CPU ip_stats values into one
+func sumPacketStats(values []PacketStats) PacketStats {
+	var total PacketStats
+	for _, v := range values {
+		total.Packets += v.Packets
+		total.Bytes += v.Bytes
+		if v.LastSeen > total.LastSeen {
+			total.LastSeen = v.LastSeen
 		}
+		if v.Blocked > 0 {
+			total.Blocked = 1
+		}
+	}
+	return total
+}
 
-		newTrafficData = append(newTrafficData, entry)
+// newTrafficEntry converts an ip_stats key/value pair to a TrafficEntry
+func (e *EBPFService) newTrafficEntry(key [4]byte, stats PacketStats) TrafficEntry {
+	// Convert key bytes directly to IP
+	ip := net.IPv4(key[0], key[1], key[2], key[3])
 
-		// Limit entries
-		if len(newTrafficData) >= 1000 {
-			break
-		}
+	// Get country code
+	countryCode := "XX"
+	if e.geoIPService != nil {
+		countryCode = e.geoIPService.GetCountryCode(ip.String())
 	}
 
-	if err := iter.Err(); err != nil {
-		system.Warn("Error iterating ip_stats map: %v", err)
+	return TrafficEntry{
+		SourceIP:    ip.String(),
+		DestPort:    0,
+		Protocol:    "IP",
+		PacketCount: int(stats.Packets),
+		ByteCount:   int64(stats.Bytes),
+		Timestamp:   e.bootTime.Add(time.Duration(stats.LastSeen)),
+		Blocked:     stats.Blocked > 0,
+		CountryCode: countryCode,
 	}
+}
 
-	// Swap pointer (Atomic-like)
-	e.mu.Lock()
-	e.trafficData = newTrafficData
-	e.mu.Unlock()
+// heavyHittersEnabled reports whether XDP is maintaining the top-K table
+func (e *EBPFService) heavyHittersEnabled() bool {
+	e.policyMu.Lock()
+	defer e.policyMu.Unlock()
+	return e.policy.HeavyHitters == 1
+}
 
-	// Save periodic snapshot (every 1 minute)
-	e.saveTrafficSnapshot()
+// readHeavyHitters reads every CPU's top-K table in one lookup, merges
+// candidates by source and returns them ranked by packets per window
+func (e *EBPFService) readHeavyHitters(objs *xdpObjects) ([]heavyHitter, error) {
+	var values []AcctState
+	if err := objs.AcctState.Lookup(uint32(0), &values); err != nil {
+		return nil, err
+	}
+
+	// Ignore candidates that have not been refreshed recently
+	var cutoff uint64
+	if now := uint64(time.Since(e.bootTime).Nanoseconds()); now > uint64(heavyHitterMaxAge) {
+		cutoff = now - uint64(heavyHitterMaxAge)
+	}
+
+	merged := make(map[uint32]*heavyHitter)
+	for i := range values {
+		for _, en := range values[i].TopK {
+			if en.IP == 0 || en.LastSeen < cutoff {
+				continue
+			}
+			if h, ok := merged[en.IP]; ok {
+				h.count += uint64(en.Count)
+				if en.LastSeen > h.lastSeen {
+					h.lastSeen = en.LastSeen
+				}
+			} else {
+				merged[en.IP] = &heavyHitter{ip: en.IP, count: uint64(en.Count), lastSeen: en.LastSeen}
+			}
+		}
+	}
+
+	hitters := make([]heavyHitter, 0, len(merged))
+	for _, h := range merged {
+		hitters = append(hitters, *h)
+	}
+	sort.Slice(hitters, func(i, j int) bool { return hitters[i].count > hitters[j].count })
+	return hitters, nil
 }
 
 // saveTrafficSnapshot saves traffic statistics to the database for historical analysis
@@ -782,37 +1555,12 @@ func (e *EBPFService) saveTrafficSnapshot() {
 	usedGlobalStats := false
 	if e.objs != nil {
 		if objs, ok := e.objs.(*xdpObjects); ok {
-			// Helper to sum PerCPU values
-			sumPerCPU := func(m *ebpf.Map, key uint32) (int64, error) {
-				var values []uint64
-				if err := m.Lookup(key, &values); err != nil {
-					// Fallback for non-PerCPU maps
-					var val uint64
-					if err2 := m.Lookup(key, &val); err2 == nil {
-						return int64(val), nil
-					}
-					return 0, err
-				}
-				var sum int64
-				for _, v := range values {
-					sum += int64(v)
-				}
-				return sum, nil
-			}
-
-			// STAT_TOTAL_PACKETS = 0
-			if val, err := sumPerCPU(objs.GlobalStats, 0); err == nil {
-				totalPackets = val
+			if gs, err := readGlobalStats(objs); err == nil {
+				totalPackets = int64(gs.TotalPackets)
+				blockedPackets = int64(gs.Blocked)
+				totalBytes = int64(gs.TotalBytes)
 				usedGlobalStats = true
 			}
-			// STAT_BLOCKED = 2
-			if val, err := sumPerCPU(objs.GlobalStats, 2); err == nil {
-				blockedPackets = val
-			}
-			// STAT_TOTAL_BYTES = 1
-			if val, err := sumPerCPU(objs.GlobalStats, 1); err == nil {
-				totalBytes = val
-			}
 		}
 	}
 
@@ -939,21 +1687,29 @@ func (e *EBPFService) Disable() {
 }
 
 func (e *EBPFService) detachEBPF() {
-	// Detach legacy TC first (if using tc command)
-	if e.tcLegacyAttached && e.tcLegacyIface != "" {
-		exec.Command("tc", "filter", "del", "dev", e.tcLegacyIface, "egress").Run()
-		exec.Command("tc", "qdisc", "del", "dev", e.tcLegacyIface, "clsact").Run()
-		e.tcLegacyAttached = false
-		system.Info("Legacy TC egress program detached from %s", e.tcLegacyIface)
+	e.detachLinks()
+	e.closeObjects()
+
+	// Clean up pinned maps
+	if e.bpfPinPath != "" {
+		os.RemoveAll(e.bpfPinPath)
 	}
+}
 
-	// Detach TC egress program (TCX method)
-	if e.tcLink != nil {
-		e.tcLink.Close()
-		e.tcLink = nil
-		system.Info("TC egress program detached")
+// detachLinks detaches the TC egress and XDP programs
+func (e *EBPFService) detachLinks() {
+	e.detachTC()
+
+	// Detach XDP program
+	if len(e.xdpLinks) > 0 {
+		closeXDPLinks(e.xdpLinks)
+		e.xdpLinks = nil
+		system.Info("eBPF XDP program detached")
 	}
+}
 
+// closeObjects releases the loaded programs and maps
+func (e *EBPFService) closeObjects() {
 	if e.tcObjs != nil {
 		if tcObjs, ok := e.tcObjs.(*tcObjects); ok {
 			tcObjs.Close()
@@ -961,13 +1717,6 @@ func (e *EBPFService) detachEBPF() {
 		e.tcObjs = nil
 	}
 
-	// Detach XDP program
-	if e.link != nil {
-		e.link.Close()
-		e.link = nil
-		system.Info("eBPF XDP program detached")
-	}
-
 	if e.objs != nil {
 		if objs, ok := e.objs.(*xdpObjects); ok {
 			objs.Close()
@@ -975,10 +1724,10 @@ func (e *EBPFService) detachEBPF() {
 		e.objs = nil
 	}
 
-	// Clean up pinned maps
-	if e.bpfPinPath != "" {
-		os.RemoveAll(e.bpfPinPath)
-	}
+	e.geoMu.Lock()
+	e.closeGeoMaps()
+	e.geoMu.Unlock()
+	e.closePolicyTrie()
 }
 
 // GetTrafficData returns current traffic data
@@ -1008,55 +1757,36 @@ func (e *EBPFService) getStatsInternal() (DetailedTrafficStats, RawTrafficStats)
 	now := time.Now()
 	var raw RawTrafficStats
 	var totalBytes int64
+	var verdicts map[string]int64
+	var blockExpired int64
+	var attackMode bool
 	countryCount := make(map[string]int)
 
 	if e.objs != nil {
 		if objs, ok := e.objs.(*xdpObjects); ok {
-			// Helper to sum PerCPU values
-			sumPerCPU := func(m *ebpf.Map, key uint32) (int64, error) {
-				var values []uint64
-				if err := m.Lookup(key, &values); err != nil {
-					// Fallback
-					var val uint64
-					if err2 := m.Lookup(key, &val); err2 == nil {
-						return int64(val), nil
-					}
-					return 0, err
-				}
-				var sum int64
-				for _, v := range values {
-					sum += int64(v)
-				}
-				return sum, nil
+			if gs, err := readGlobalStats(objs); err == nil {
+				raw.TotalPackets = int64(gs.TotalPackets)
+				totalBytes = int64(gs.TotalBytes)
+				raw.BlockedPackets = int64(gs.Blocked)
+				raw.RateLimitedPackets = int64(gs.RateLimited)
+				raw.GeoIPPackets = int64(gs.GeoIPBlocked)
+				raw.InvalidPackets = int64(gs.PktInvalid)
+				verdicts = gs.verdictCounts()
+				blockExpired = int64(gs.BlockExpired + e.blocksSwept.Load())
 			}
-
-			// STAT_TOTAL_PACKETS = 0
-			if val, err := sumPerCPU(objs.GlobalStats, 0); err == nil {
-				raw.TotalPackets = val
-			}
-			// STAT_TOTAL_BYTES = 1
-			if val, err := sumPerCPU(objs.GlobalStats, 1); err == nil {
-				totalBytes = val
-			}
-			// STAT_BLOCKED = 2
-			if val, err := sumPerCPU(objs.GlobalStats, 2); err == nil {
-				raw.BlockedPackets = val
-			}
-			// STAT_RATE_LIMITED = 4
-			if val, err := sumPerCPU(objs.GlobalStats, 4); err == nil {
-				raw.RateLimitedPackets = val
-			}
-			// STAT_GEOIP_BLOCKED = 6
-			if val, err := sumPerCPU(objs.GlobalStats, 6); err == nil {
-				raw.GeoIPPackets = val
-			}
-			// STAT_PKT_INVALID = 7
-			if val, err := sumPerCPU(objs.GlobalStats, 7); err == nil {
-				raw.InvalidPackets = val
+			if state, ok := e.readAttackState(objs); ok {
+				attackMode = state.Mode == attackModeActive
 			}
 		}
 	}
 
+	var egress *TCEgressStats
+	if tcObjs, ok := e.tcObjs.(*tcObjects); ok && tcObjs != nil {
+		if ts, err := readTCStats(tcObjs); err == nil {
+			egress = &ts
+		}
+	}
+
 	for _, entry := range e.trafficData {
 		countryCount[entry.CountryCode]++
 	}
@@ -1146,6 +1876,11 @@ func (e *EBPFService) getStatsInternal() (DetailedTrafficStats, RawTrafficStats)
 		GeoIPBlockPPS:   geoipPPS,
 		TotalPackets:    raw.TotalPackets,
 		BlockedPackets:  raw.BlockedPackets,
+		VerdictCounts:   verdicts,
+		EgressStats:     egress,
+		XDPAttachments:  e.xdpAttachments(),
+		BlockExpired:    blockExpired,
+		AttackMode:      attackMode,
 	}, raw
 }
 
@@ -1167,23 +1902,85 @@ func (e *EBPFService) LookupBlockedIP(ipStr string) *BlockedIPInfo {
 	if ip == nil {
 		return nil
 	}
+	if ip.To4() == nil {
+		value, found := e.lookupBlocked6(objs, ip)
+		if !found {
+			return nil
+		}
+		info := e.blockedIPInfo(ipStr, value)
+		return &info
+	}
 	ip = ip.To4()
-	if ip == nil {
-		return nil
+
+	// Manual host blocks first, then auto-blocks, then any covering prefix
+	var value BlockEntry
+	var hostKey [4]byte
+	copy(hostKey[:], ip)
+	if err := objs.ManualHosts.Lookup(hostKey, &value); err != nil {
+		if err := objs.BlockedHosts.Lookup(hostKey, &value); err != nil {
+			key := LpmKey{
+				PrefixLen: 32,
+			}
+			copy(key.Data[:], ip)
+			if err := objs.BlockedIps.Lookup(key, &value); err != nil {
+				return nil
+			}
+		}
 	}
 
-	// Construct Key
-	key := LpmKey{
-		PrefixLen: 32,
+	info := e.blockedIPInfo(ipStr, value)
+	return &info
+}
+
+// IterateBlockedIPs returns a list of currently blocked IPs from the eBPF maps
+func (e *EBPFService) IterateBlockedIPs() ([]BlockedIPInfo, error) {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+
+	if e.objs == nil {
+		return nil, nil
+	}
+
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		return nil, nil
 	}
-	copy(key.Data[:], ip)
 
+	const maxListed = 1000
+	var blockedList []BlockedIPInfo
 	var value BlockEntry
-	if err := objs.BlockedIps.Lookup(key, &value); err != nil {
-		return nil
+
+	// Prefixes first so a flood of host blocks cannot crowd them out
+	var key LpmKey
+	iter := objs.BlockedIps.Iterate()
+	for len(blockedList) < maxListed && iter.Next(&key, &value) {
+		ip := net.IP(key.Data[:]).String()
+		if key.PrefixLen < 32 {
+			ip = fmt.Sprintf("%s/%d", ip, key.PrefixLen)
+		}
+		blockedList = append(blockedList, e.blockedIPInfo(ip, value))
+	}
+	if err := iter.Err(); err != nil {
+		return blockedList, err
+	}
+
+	// Manual host blocks before auto-blocks, for the same reason
+	for _, hosts := range []*ebpf.Map{objs.ManualHosts, objs.BlockedHosts} {
+		var hostKey [4]byte
+		hostIter := hosts.Iterate()
+		for len(blockedList) < maxListed && hostIter.Next(&hostKey, &value) {
+			blockedList = append(blockedList, e.blockedIPInfo(net.IP(hostKey[:]).String(), value))
+		}
+		if err := hostIter.Err(); err != nil {
+			return blockedList, err
+		}
 	}
 
-	// Found - Parse details
+	return e.appendBlocked6(objs, blockedList, maxListed)
+}
+
+// blockedIPInfo converts a block_entry into its API form
+func (e *EBPFService) blockedIPInfo(ip string, value BlockEntry) BlockedIPInfo {
 	reason := "unknown"
 	switch value.Reason {
 	case 1:
@@ -1194,11 +1991,12 @@ func (e *EBPFService) LookupBlockedIP(ipStr string) *BlockedIPInfo {
 		reason = "geoip"
 	case 4:
 		reason = "flood"
+	case 5:
+		reason = "signature"
 	}
 
 	var expiresAt time.Time
 	var ttl int64 = -1
-
 	if value.ExpiresAt > 0 {
 		expiresAt = e.bootTime.Add(time.Duration(value.ExpiresAt) * time.Nanosecond)
 		remaining := time.Until(expiresAt)
@@ -1213,11 +2011,11 @@ func (e *EBPFService) LookupBlockedIP(ipStr string) *BlockedIPInfo {
 	countryName := "Unknown"
 	countryCode := "XX"
 	if e.geoIPService != nil {
-		countryName, countryCode = e.geoIPService.GetCountry(ipStr)
+		countryName, countryCode = e.geoIPService.GetCountry(strings.SplitN(ip, "/", 2)[0])
 	}
 
-	return &BlockedIPInfo{
-		IP:          ipStr,
+	return BlockedIPInfo{
+		IP:          ip,
 		Reason:      reason,
 		ExpiresAt:   expiresAt,
 		TTL:         ttl,
@@ -1226,76 +2024,6 @@ func (e *EBPFService) LookupBlockedIP(ipStr string) *BlockedIPInfo {
 	}
 }
 
-// IterateBlockedIPs returns a list of currently blocked IPs from the eBPF map
-func (e *EBPFService) IterateBlockedIPs() ([]BlockedIPInfo, error) {
-	e.mu.RLock()
-	defer e.mu.RUnlock()
-
-	if e.objs == nil {
-		return nil, nil
-	}
-
-	objs, ok := e.objs.(*xdpObjects)
-	if !ok {
-		return nil, nil
-	}
-
-	var blockedList []BlockedIPInfo
-	var key LpmKey
-	var value BlockEntry
-
-	iter := objs.BlockedIps.Iterate()
-	for iter.Next(&key, &value) {
-		ip := net.IP(key.Data[:]).String()
-
-		reason := "unknown"
-		switch value.Reason {
-		case 1:
-			reason = "manual"
-		case 2:
-			reason = "rate_limit"
-		case 3:
-			reason = "geoip"
-		case 4:
-			reason = "flood"
-		}
-
-		var expiresAt time.Time
-		var ttl int64 = -1
-		if value.ExpiresAt > 0 {
-			expiresAt = e.bootTime.Add(time.Duration(value.ExpiresAt) * time.Nanosecond)
-			remaining := time.Until(expiresAt)
-			if remaining > 0 {
-				ttl = int64(remaining.Seconds())
-			} else {
-				ttl = 0
-			}
-		}
-
-		// Get Country Info
-		countryName := "Unknown"
-		countryCode := "XX"
-		if e.geoIPService != nil {
-			countryName, countryCode = e.geoIPService.GetCountry(ip)
-		}
-
-		blockedList = append(blockedList, BlockedIPInfo{
-			IP:          ip,
-			Reason:      reason,
-			ExpiresAt:   expiresAt,
-			TTL:         ttl,
-			CountryCode: countryCode,
-			CountryName: countryName,
-		})
-
-		if len(blockedList) >= 1000 {
-			break
-		}
-	}
-
-	return blockedList, iter.Err()
-}
-
 // IsEnabled returns whether eBPF is currently enabled
 func (e *EBPFService) IsEnabled() bool {
 	e.mu.RLock()
@@ -1371,37 +2099,41 @@ func (e *EBPFService) UpdateBlockedIPs(ips []string) error {
 		return nil
 	}
 
+	// Single hosts go to the manual_hosts hash, real prefixes to the trie
+	var hostKeys [][4]byte
+	var hostValues []BlockEntry
+	var prefixKeys []LpmKey
+	var prefixValues []BlockEntry
 	for _, ipStr := range ips {
-		// Try single IP first
-		ip := net.ParseIP(ipStr)
-		prefixLen := uint32(32)
-		if ip == nil {
-			// Try CIDR
-			var ipNet *net.IPNet
-			var err error
-			ip, ipNet, err = net.ParseCIDR(ipStr)
-			if err == nil {
-				ones, _ := ipNet.Mask.Size()
-				prefixLen = uint32(ones)
-			} else {
-				continue
-			}
+		key, ok := parseLpmKey(ipStr)
+		if !ok {
+			continue
 		}
-
-		// Use LPM Key Structure
-		key := struct {
-			PrefixLen uint32
-			Data      [4]byte
-		}{
-			PrefixLen: prefixLen,
+		value := BlockEntry{Reason: 1} // manual, permanent
+		if key.PrefixLen == 32 {
+			hostKeys = append(hostKeys, key.Data)
+			hostValues = append(hostValues, value)
+		} else {
+			prefixKeys = append(prefixKeys, key)
+			prefixValues = append(prefixValues, value)
 		}
-		copy(key.Data[:], ip.To4())
+	}
 
-		blocked := uint32(1)
-		if err := objs.BlockedIps.Put(key, blocked); err != nil {
-			system.Warn("Failed to add blocked IP %s: %v", ipStr, err)
+	if n, err := batchPut(objs.ManualHosts, hostKeys, hostValues); err != nil {
+		system.Warn("Failed to add %d blocked hosts: %v", len(hostKeys)-n, err)
+	}
+	if len(prefixKeys) > 0 {
+		// Announce the prefixes before writing them so XDP starts walking the trie
+		prefixes := e.recordBlockRules(prefixKeys, prefixValues)
+		if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.BlockPrefixes = uint32(prefixes) }); err != nil {
+			system.Warn("Failed to publish blocked prefix count: %v", err)
+		}
+		if n, err := batchPut(objs.BlockedIps, prefixKeys, prefixValues); err != nil {
+			system.Warn("Failed to add %d blocked prefixes: %v", len(prefixKeys)-n, err)
 		}
+		e.refreshPolicyTrie(objs)
 	}
+	e.updateBlockedIPs6(objs, ips)
 
 	system.Info("Updated %d blocked IPs in eBPF map", len(ips))
 	return nil
@@ -1460,50 +2192,38 @@ func (e *EBPFService) UpdateAllowIPs(ips []string) error {
 		}
 	*/
 
+	keys := make([]LpmKey, 0, len(ips))
+	values := make([]uint32, 0, len(ips))
 	for _, ipStr := range ips {
-		// Try single IP first
-		ip := net.ParseIP(ipStr)
-		prefixLen := uint32(32)
-		if ip == nil {
-			// Try CIDR
-			var ipNet *net.IPNet
-			var err error
-			ip, ipNet, err = net.ParseCIDR(ipStr)
-			if err == nil {
-				ones, _ := ipNet.Mask.Size()
-				prefixLen = uint32(ones)
-			} else {
-				continue
-			}
+		key, ok := parseLpmKey(ipStr)
+		if !ok {
+			continue
 		}
+		keys = append(keys, key)
+		values = append(values, 1)
+	}
 
-		// Use LPM Key Structure
-		key := struct {
-			PrefixLen uint32
-			Data      [4]byte
-		}{
-			PrefixLen: prefixLen,
+	// CRITICAL FIX: Bound the map write with a timeout to prevent blocking server startup
+	e.recordAllowRules(keys)
+	done := make(chan error, 1)
+	go func() {
+		n, err := batchPut(objs.WhiteList, keys, values)
+		if err != nil {
+			err = fmt.Errorf("%d of %d entries failed: %w", len(keys)-n, len(keys), err)
 		}
-		copy(key.Data[:], ip.To4())
-
-		val := uint32(1)
-
-		// CRITICAL FIX: Put operations with timeout to prevent blocking server startup
-		// Use channel to make this operation interruptible
-		done := make(chan error, 1)
-		go func() {
-			done <- objs.WhiteList.Put(key, val)
-		}()
+		e.updateAllowIPs6(objs, ips)
+		done <- err
+		// Recompiling the policy trie can take a while with GeoIP folded in
+		e.refreshPolicyTrie(objs)
+	}()
 
-		select {
-		case err := <-done:
-			if err != nil {
-				system.Warn("Failed to add whitelist IP %s: %v", ipStr, err)
-			}
-		case <-time.After(100 * time.Millisecond):
-			// Timeout - skip this IP and continue
-			system.Warn("Timeout adding whitelist IP %s (skipped)", ipStr)
+	select {
+	case err := <-done:
+		if err != nil {
+			system.Warn("Failed to update whitelist: %v", err)
 		}
+	case <-time.After(5 * time.Second):
+		system.Warn("Timeout updating whitelist in eBPF map (continuing in background)")
 	}
 
 	system.Info("Updated whitelist in eBPF map: %d entries", len(ips))
@@ -1522,32 +2242,26 @@ func (e *EBPFService) ResetTrafficStats() error {
 	if e.objs != nil {
 		objs, ok := e.objs.(*xdpObjects)
 		if ok {
-			// Iterate and delete all keys
-			// Note: Deleting while iterating can be tricky in some kernels/implementations,
-			// but for hash maps it's generally supported or we collect keys first.
-			// Ideally, we could just close and recreate the map, but that requires reloading the program or using map-in-map.
-			// Simple approach: Delete keys one by one.
-
-			var key [4]byte
-			var values []PacketStats
-			var keysToDelete [][4]byte
-
-			iter := objs.IpStats.Iterate()
-			for iter.Next(&key, &values) {
-				keysToDelete = append(keysToDelete, key)
-			}
-			if err := iter.Err(); err != nil {
-				system.Warn("Error iterating ip_stats for reset: %v", err)
-			}
-
-			count := 0
-			for _, k := range keysToDelete {
-				if err := objs.IpStats.Delete(k); err != nil {
-					// system.Warn("Failed to delete key: %v", err)
-				} else {
-					count++
+			// Drain with BPF_MAP_LOOKUP_AND_DELETE_BATCH, falling back to
+			// collecting keys and deleting them one by one on older kernels.
+			count, err := batchReadPerCPU(objs.IpStats, 0, true, func(key [4]byte, values []PacketStats) {})
+			if errors.Is(err, errBatchUnsupported) {
+				var key [4]byte
+				var values []PacketStats
+				var keysToDelete [][4]byte
+
+				iter := objs.IpStats.Iterate()
+				for iter.Next(&key, &values) {
+					keysToDelete = append(keysToDelete, key)
+				}
+				if err := iter.Err(); err != nil {
+					system.Warn("Error iterating ip_stats for reset: %v", err)
 				}
+				count, _ = batchDelete(objs.IpStats, keysToDelete)
+			} else if err != nil {
+				system.Warn("Error draining ip_stats for reset: %v", err)
 			}
+			count += resetIP6Stats(objs)
 			system.Info("Reset %d traffic stats entries from eBPF map", count)
 		}
 	}
@@ -1555,17 +2269,6 @@ func (e *EBPFService) ResetTrafficStats() error {
 	return nil
 }
 
-// SyncAllowedPorts is deprecated - simplified XDP filter doesn't use allowed_ports map
-// Traffic is now controlled by Whitelist, Blacklist, Connection Tracking, and GeoIP
-func (e *EBPFService) SyncAllowedPorts() error {
-	// No-op: Simplified XDP filter passes all traffic that:
-	// 1. Is whitelisted
-	// 2. Is from a tracked connection (response)
-	// 3. Passes GeoIP check
-	// Game ports are implicitly allowed if they pass GeoIP.
-	return nil
-}
-
 // StartAutoResetLoop starts the background task to reset stats periodically
 func (e *EBPFService) StartAutoResetLoop(db *gorm.DB) {
 	// Initialize the channel if not already (should be done in Enable/New, but safe guard)
@@ -1621,12 +2324,108 @@ type PortStats struct {
 	Bytes   uint64 `json:"bytes"`
 }
 
-// UpdateConfig updates the eBPF config map with current settings
-func (e *EBPFService) UpdateConfig(hardBlocking bool, rateLimitPPS int) error {
+// updatePolicy applies mutate to a copy of the cached policy and publishes it
+// to the BPF policy map in one update, so XDP never sees a partial change.
+// It then links the stages the policy needs and fails if that fails.
+func (e *EBPFService) updatePolicy(objs *xdpObjects, mutate func(p *XDPPolicy)) error {
+	e.policyMu.Lock()
+	defer e.policyMu.Unlock()
+
+	next := e.policy
+	mutate(&next)
+	if err := objs.Policy.Put(uint32(0), next); err != nil {
+		return err
+	}
+	e.policy = next
+
+	// Link only the stages this policy needs
+	if err := linkPipeline(objs, &next); err != nil {
+		return fmt.Errorf("linking XDP pipeline: %w", err)
+	}
+	return nil
+}
+
+// boolToU32 converts a setting flag to the 0/1 form used by the BPF policy
+func boolToU32(b bool) uint32 {
+	if b {
+		return 1
+	}
+	return 0
+}
+
+// applySettingsPolicy copies the XDP-related security settings into p
+func applySettingsPolicy(p *XDPPolicy, settings *models.SecuritySettings) {
+	rateLimitPPS := settings.XDPRateLimitPPS
+	if rateLimitPPS < 0 {
+		rateLimitPPS = 0
+	}
+	blockTTLMinutes := settings.BlockTTLMinutes
+	if blockTTLMinutes < 0 {
+		blockTTLMinutes = 0
+	}
+	sampleRate := uint32(1)
+	if settings.XDPStatsSampleRate > 1 {
+		sampleRate = roundUpPow2(uint32(settings.XDPStatsSampleRate))
+	}
+	sketchThreshold := settings.XDPStatsSketchThreshold
+	if sketchThreshold < 1 {
+		sketchThreshold = 1
+	}
+	insertBudget := settings.XDPStatsInsertBudget
+	if insertBudget < 0 {
+		insertBudget = 0
+	}
+
+	p.HardBlocking = boolToU32(settings.XDPHardBlocking)
+	p.RateLimitPPS = uint32(rateLimitPPS)
+	p.RateLimitMode = rateLimitModeFromString(settings.XDPRateLimitMode)
+	p.RateLimitCPUPPS = perCPURateLimit(rateLimitPPS, settings.XDPRateLimitCPUShare)
+	p.FlowRatePPS = uint32(max(settings.XDPFlowRateLimitPPS, 0))
+	netRatePPS := max(settings.XDPNetRateLimitPPS, 0)
+	p.NetRatePPS = uint32(netRatePPS)
+	p.NetRateCPUPPS = perCPURateLimit(netRatePPS, settings.XDPRateLimitCPUShare)
+	p.RateLimitBPS = byteRate(settings.XDPRateLimitMbps, 1)
+	// Each CPU XDP may run on refills its own global bucket, so the uplink
+	// limit is split evenly across the possible CPUs
+	nCPU, err := ebpf.PossibleCPU()
+	if err != nil {
+		system.Warn("Failed to count CPUs, global bandwidth limit applies per CPU: %v", err)
+		nCPU = 1
+	}
+	p.GlobalCPUBPS = byteRate(settings.XDPGlobalLimitMbps, nCPU)
+	p.SizeTinyPPS = uint32(max(settings.XDPTinyPacketPPS, 0))
+	p.SizeLargePPS = uint32(max(settings.XDPLargePacketPPS, 0))
+	p.EnableBlockTTL = boolToU32(settings.EnableBlockTTL)
+	p.BlockTTLSeconds = uint32(blockTTLMinutes * 60)
+	p.EnablePktValidation = boolToU32(settings.EnablePacketValidation)
+	p.StatsMode = statsModeFromString(settings.XDPStatsMode)
+	p.StatsSampleRate = sampleRate
+	p.StatsSketchThresh = uint32(sketchThreshold)
+	p.StatsInsertBudget = uint32(insertBudget)
+	p.HeavyHitters = boolToU32(settings.XDPHeavyHitters)
+	p.PolicyTrie = boolToU32(settings.XDPPolicyTrie)
+	p.ReflectionFilter = boolToU32(settings.XDPReflectionFilter)
+	p.A2SCache = boolToU32(settings.XDPA2SCache)
+	p.SynProxy = boolToU32(settings.XDPSynProxy)
+	p.FragFilter = boolToU32(settings.XDPFragFilter)
+
+	attackRatePPS := max(settings.XDPAttackRatePPS, 0)
+	p.AttackTripPPS = uint32(max(settings.XDPAttackTripPPS, 0))
+	p.AttackTripMbps = uint32(max(settings.XDPAttackTripMbps, 0))
+	p.AttackRelaxPct = uint32(min(max(settings.XDPAttackRelaxPct, 0), 100))
+	p.AttackHoldSeconds = uint32(max(settings.XDPAttackHoldSeconds, 0))
+	p.AttackRatePPS = uint32(attackRatePPS)
+	p.AttackRateCPUPPS = perCPURateLimit(attackRatePPS, settings.XDPRateLimitCPUShare)
+	p.AttackHardGeo = boolToU32(settings.XDPAttackHardGeo)
+	p.AttackFlowTTL = uint32(max(settings.XDPAttackFlowTTL, 0))
+}
+
+// UpdateConfig publishes the XDP-related security settings as a new policy
+func (e *EBPFService) UpdateConfig(settings *models.SecuritySettings) error {
 	e.mu.RLock()
 	defer e.mu.RUnlock()
 
-	if e.objs == nil {
+	if e.objs == nil || settings == nil {
 		return nil
 	}
 
@@ -1635,29 +2434,51 @@ func (e *EBPFService) UpdateConfig(hardBlocking bool, rateLimitPPS int) error {
 		return nil
 	}
 
-	// Config map indices
-	const (
-		configHardBlocking    = uint32(0)
-		configRateLimitPPS    = uint32(1)
-		configMaintenanceMode = uint32(2)
-	)
+	e.policyMu.Lock()
+	prevPolicyTrie := e.policy.PolicyTrie
+	prevSynProxy := e.policy.SynProxy
+	e.policyMu.Unlock()
+	e.keepOnExit.Store(settings.XDPKeepOnExit)
+
+	err := e.updatePolicy(objs, func(p *XDPPolicy) { applySettingsPolicy(p, settings) })
+	if err != nil {
+		system.Warn("Failed to update XDP policy: %v", err)
+		return err
+	}
+
+	// A new interface list or mode re-attaches once the caller releases e.mu
+	ifaces, mode := parseInterfaceList(settings.XDPInterfaces), attachModeFromString(settings.XDPAttachMode)
+	if !slices.Equal(ifaces, e.attachIfaces) || mode != e.attachMode {
+		go e.reattachXDP(ifaces, mode)
+	}
 
-	// Set hard blocking mode
-	hardBlockVal := uint32(0)
-	if hardBlocking {
-		hardBlockVal = 1
+	// The SYN proxy flag lives in port_policy next to each TCP service port
+	if prevSynProxy != boolToU32(settings.XDPSynProxy) {
+		if err := e.SyncAllowedPorts(); err != nil {
+			system.Warn("Failed to sync port policy: %v", err)
+		}
 	}
-	if err := objs.Config.Put(configHardBlocking, hardBlockVal); err != nil {
-		system.Warn("Failed to update hard blocking config: %v", err)
+
+	// Turning the policy trie on compiles it, turning it off retires it
+	if prevPolicyTrie != boolToU32(settings.XDPPolicyTrie) {
+		e.refreshPolicyTrie(objs)
 	}
 
-	// Set rate limit PPS
-	rateLimitVal := uint32(rateLimitPPS)
-	if err := objs.Config.Put(configRateLimitPPS, rateLimitVal); err != nil {
-		system.Warn("Failed to update rate limit config: %v", err)
+	// Switching GeoIP engines rebuilds the GeoIP maps right away
+	engine := geoEngineFromString(settings.XDPGeoEngine)
+	e.geoMu.Lock()
+	engineChanged := e.geoEngine != engine
+	e.geoEngine = engine
+	e.geoMu.Unlock()
+	if engineChanged {
+		if err := e.UpdateGeoIPData(); err != nil {
+			system.Warn("Failed to rebuild GeoIP maps for %s engine: %v", engine, err)
+		}
 	}
 
-	system.Info("Updated eBPF config: hard_blocking=%v, rate_limit_pps=%d", hardBlocking, rateLimitPPS)
+	system.Info("Updated eBPF config: hard_blocking=%v, rate_limit_pps=%d (%s), rate_limit_mbps=%d, global_limit_mbps=%d, block_ttl=%v, pkt_validation=%v, stats_mode=%s",
+		settings.XDPHardBlocking, max(settings.XDPRateLimitPPS, 0), settings.XDPRateLimitMode, max(settings.XDPRateLimitMbps, 0),
+		max(settings.XDPGlobalLimitMbps, 0), settings.EnableBlockTTL, settings.EnablePacketValidation, settings.XDPStatsMode)
 	return nil
 }
 
@@ -1675,13 +2496,7 @@ func (e *EBPFService) UpdateMaintenanceMode(enabled bool) error {
 		return nil
 	}
 
-	const configMaintenanceMode = uint32(2)
-	val := uint32(0)
-	if enabled {
-		val = 1
-	}
-
-	if err := objs.Config.Put(configMaintenanceMode, val); err != nil {
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.MaintenanceMode = boolToU32(enabled) }); err != nil {
 		system.Warn("Failed to update maintenance mode config: %v", err)
 		return err
 	}
@@ -1758,12 +2573,6 @@ func (e *EBPFService) AddBlockedIP(ipStr string, duration time.Duration) error {
 		return fmt.Errorf("invalid IP: %s", ipStr)
 	}
 
-	// Construct Key
-	key := LpmKey{
-		PrefixLen: 32,
-	}
-	copy(key.Data[:], ip.To4())
-
 	// Construct Value
 	var expiresAt uint64 = 0
 	if duration > 0 {
@@ -1777,7 +2586,23 @@ func (e *EBPFService) AddBlockedIP(ipStr string, duration time.Duration) error {
 		Reason:    1, // manual
 	}
 
-	if err := objs.BlockedIps.Put(key, value); err != nil {
+	// IPv6 hosts are blocked as /128 in blocked_ips6
+	if ip.To4() == nil {
+		key := LpmKey6{PrefixLen: 128}
+		copy(key.Data[:], ip.To16())
+		if err := e.putBlocked6(objs, []LpmKey6{key}, []BlockEntry{value}); err != nil {
+			return fmt.Errorf("failed to add blocked IP %s: %w", ipStr, err)
+		}
+		system.Info("Added blocked IP: %s (Duration: %s)", ipStr, duration)
+		return nil
+	}
+
+	// Construct Key
+	var key [4]byte
+	copy(key[:], ip.To4())
+
+	// manual_hosts never evicts: a full map is an error, not a lost block
+	if err := objs.ManualHosts.Put(key, value); err != nil {
 		return fmt.Errorf("failed to add blocked IP %s: %w", ipStr, err)
 	}
 
@@ -1804,17 +2629,26 @@ func (e *EBPFService) RemoveBlockedIP(ipStr string) error {
 		return fmt.Errorf("invalid IP: %s", ipStr)
 	}
 
-	// Construct Key
-	key := LpmKey{
-		PrefixLen: 32,
+	if ip.To4() == nil {
+		if err := e.removeBlocked6(objs, ip); err != nil {
+			return fmt.Errorf("failed to remove blocked IP %s: %w", ipStr, err)
+		}
+		system.Info("Removed blocked IP: %s", ipStr)
+		return nil
 	}
-	copy(key.Data[:], ip.To4())
 
-	if err := objs.BlockedIps.Delete(key); err != nil {
+	// Construct Key
+	var key [4]byte
+	copy(key[:], ip.To4())
+
+	// Lift both a manual block and an auto-block of the host
+	errManual := objs.ManualHosts.Delete(key)
+	errAuto := objs.BlockedHosts.Delete(key)
+	if errManual != nil && errAuto != nil {
 		// Verify if it actually failed or just didn't exist
 		// For BPF maps, delete on non-existent key returns error, which is fine to ignore or report as "not found"
 		// But for now we just return error if it's strictly a system error
-		return fmt.Errorf("failed to remove blocked IP %s: %w", ipStr, err)
+		return fmt.Errorf("failed to remove blocked IP %s: %w", ipStr, errManual)
 	}
 
 	system.Info("Removed blocked IP: %s", ipStr)
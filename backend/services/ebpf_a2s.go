@@ -0,0 +1,255 @@
+//go:build linux
+
+package services
+
+import (
+	"bytes"
+	"crypto/rand"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net"
+	"strings"
+	"time"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+)
+
+// A2S query cache (v2.1)
+// Every few seconds the loader asks each UDP service port of the origins
+// for A2S_INFO and A2S_RULES over the tunnel and stores the replies in
+// a2s_cache under the public port. XDP answers matching queries itself
+// (see a2s_respond), so floods of A2S queries never reach the game server.
+// The challenge secret rotates on a timer; XDP accepts the current and the
+// previous one.
+
+// Cache sizing, matches A2S_* in xdp_filter.c
+const (
+	a2sReplyMax  = 1400
+	a2sKindInfo  = 0
+	a2sKindRules = 1
+)
+
+const (
+	a2sRefreshInterval = 5 * time.Second
+	a2sSecretRotation  = 30 * time.Second
+	a2sQueryTimeout    = 1 * time.Second
+	a2sMaxRangePorts   = 16 // Ports probed per service port range
+)
+
+// a2sHeader prefixes every single-packet A2S message
+var a2sHeader = []byte{0xFF, 0xFF, 0xFF, 0xFF}
+
+// errA2SUncacheable marks replies XDP cannot serve (split or oversized)
+var errA2SUncacheable = errors.New("A2S reply cannot be cached")
+
+// A2SKey matches the C struct a2s_key
+type A2SKey struct {
+	Port uint16
+	Kind uint8
+	_    uint8 // padding
+}
+
+// A2SReply matches the C struct a2s_reply
+type A2SReply struct {
+	UpdatedAt uint64
+	Len       uint32
+	_         uint32 // padding
+	Data      [a2sReplyMax]byte
+}
+
+// A2SSecret matches the C struct a2s_secret
+type A2SSecret struct {
+	Current  uint32
+	Previous uint32
+}
+
+// a2sRequest builds an A2S_INFO or A2S_RULES query carrying challenge
+// (nil asks the server for one)
+func a2sRequest(kind uint8, challenge []byte) []byte {
+	req := append([]byte{}, a2sHeader...)
+	if kind == a2sKindInfo {
+		req = append(req, 0x54)
+		req = append(req, "Source Engine Query\x00"...)
+		return append(req, challenge...)
+	}
+	req = append(req, 0x56)
+	if challenge == nil {
+		return append(req, a2sHeader...)
+	}
+	return append(req, challenge...)
+}
+
+// a2sQuery asks addr for kind, answering one challenge round trip
+func a2sQuery(addr string, kind uint8) ([]byte, error) {
+	conn, err := net.DialTimeout("udp", addr, a2sQueryTimeout)
+	if err != nil {
+		return nil, err
+	}
+	defer conn.Close()
+	conn.SetDeadline(time.Now().Add(2 * a2sQueryTimeout))
+
+	buf := make([]byte, 4096)
+	req := a2sRequest(kind, nil)
+	for attempt := 0; attempt < 2; attempt++ {
+		if _, err := conn.Write(req); err != nil {
+			return nil, err
+		}
+		n, err := conn.Read(buf)
+		if err != nil {
+			return nil, err
+		}
+		if n < 5 || !bytes.Equal(buf[:4], a2sHeader) || n > a2sReplyMax {
+			return nil, errA2SUncacheable
+		}
+		if buf[4] == 0x41 && n >= 9 {
+			req = a2sRequest(kind, append([]byte{}, buf[5:9]...))
+			continue
+		}
+		return append([]byte{}, buf[:n]...), nil
+	}
+	return nil, fmt.Errorf("A2S server at %s kept sending challenges", addr)
+}
+
+// startA2SCacheLoop keeps a2s_cache and a2s_secret fresh while the cache is enabled
+func (e *EBPFService) startA2SCacheLoop(stop <-chan struct{}) {
+	refresh := time.NewTicker(a2sRefreshInterval)
+	defer refresh.Stop()
+	rotate := time.NewTicker(a2sSecretRotation)
+	defer rotate.Stop()
+
+	cached := map[A2SKey]bool{}
+	for {
+		select {
+		case <-stop:
+			return
+		case <-rotate.C:
+			e.rotateA2SSecret()
+		case <-refresh.C:
+			cached = e.refreshA2SCache(cached)
+		}
+	}
+}
+
+// rotateA2SSecret moves the current challenge secret to previous and draws a new one
+func (e *EBPFService) rotateA2SSecret() {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+
+	if objs, ok := e.objs.(*xdpObjects); ok {
+		e.rotateA2SSecretLocked(objs)
+	}
+}
+
+// rotateA2SSecretLocked does the rotation. Caller holds e.mu.
+func (e *EBPFService) rotateA2SSecretLocked(objs *xdpObjects) {
+	var secret A2SSecret
+	if err := objs.A2sSecret.Lookup(uint32(0), &secret); err != nil {
+		system.Warn("Failed to read a2s_secret: %v", err)
+		return
+	}
+	var b [4]byte
+	if _, err := rand.Read(b[:]); err != nil {
+		return
+	}
+	secret.Previous = secret.Current
+	secret.Current = binary.LittleEndian.Uint32(b[:]) | 1
+	if err := objs.A2sSecret.Put(uint32(0), secret); err != nil {
+		system.Warn("Failed to rotate a2s_secret: %v", err)
+	}
+}
+
+// refreshA2SCache queries every UDP service port and replaces the cached
+// replies. Entries that were cached last round but not refreshed are
+// removed. Returns the keys now cached.
+func (e *EBPFService) refreshA2SCache(prev map[A2SKey]bool) map[A2SKey]bool {
+	e.policyMu.Lock()
+	enabled := e.policy.A2SCache == 1
+	e.policyMu.Unlock()
+	if !enabled || e.db == nil {
+		return prev
+	}
+
+	// Query without holding e.mu: a dead origin costs up to two timeouts per port
+	type target struct {
+		addr string
+		port uint16
+	}
+	var services []models.Service
+	if err := e.db.Preload("Ports").Preload("Origin").Find(&services).Error; err != nil {
+		system.Warn("Failed to load services for A2S cache: %v", err)
+		return prev
+	}
+	var targets []target
+	for _, svc := range services {
+		if svc.Origin.WgIP == "" {
+			continue
+		}
+		for _, p := range svc.Ports {
+			if strings.ToLower(p.Protocol) != "udp" {
+				continue
+			}
+			span := max(p.PublicPortEnd-p.PublicPort, 0)
+			for off := 0; off <= span && off < a2sMaxRangePorts; off++ {
+				targets = append(targets, target{
+					addr: net.JoinHostPort(svc.Origin.WgIP, fmt.Sprint(p.PrivatePort+off)),
+					port: uint16(p.PublicPort + off),
+				})
+			}
+		}
+	}
+
+	var keys []A2SKey
+	var values []A2SReply
+	for _, t := range targets {
+		for _, kind := range []uint8{a2sKindInfo, a2sKindRules} {
+			reply, err := a2sQuery(t.addr, kind)
+			if err != nil {
+				continue
+			}
+			value := A2SReply{Len: uint32(len(reply))}
+			copy(value.Data[:], reply)
+			keys = append(keys, A2SKey{Port: t.port, Kind: kind})
+			values = append(values, value)
+		}
+	}
+
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		return prev
+	}
+
+	// The first refresh after a (re)load also seeds the challenge secret
+	var secret A2SSecret
+	if err := objs.A2sSecret.Lookup(uint32(0), &secret); err == nil && secret.Current == 0 {
+		e.rotateA2SSecretLocked(objs)
+	}
+
+	now := uint64(time.Since(e.bootTime).Nanoseconds())
+	next := make(map[A2SKey]bool, len(keys))
+	for i := range values {
+		values[i].UpdatedAt = now
+		next[keys[i]] = true
+	}
+	if n, err := batchPut(objs.A2sCache, keys, values); err != nil {
+		system.Warn("Failed to update a2s_cache (%d of %d replies): %v", n, len(keys), err)
+	}
+
+	var stale []A2SKey
+	for key := range prev {
+		if !next[key] {
+			stale = append(stale, key)
+		}
+	}
+	if len(stale) > 0 {
+		if _, err := batchDelete(objs.A2sCache, stale); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			system.Warn("Failed to expire a2s_cache entries: %v", err)
+		}
+	}
+	return next
+}
@@ -0,0 +1,280 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"fmt"
+	"net"
+	"slices"
+	"strings"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// XDP attachment (v2.1)
+// The filter is attached to every configured interface (physical NICs or
+// a bond) in an explicit mode. Native mode runs in the driver before any
+// skb is built; generic mode runs after it at roughly a third of the
+// throughput, so falling back to it is logged loudly and every interface
+// reports the mode it actually got.
+
+// XDP attach modes, as in xdp_attach_mode. NIC offload is refused by
+// models.ValidateXDPAttachMode: this filter's maps and helpers cannot be
+// offloaded.
+const (
+	xdpModeNative  = "native"
+	xdpModeGeneric = "generic"
+)
+
+var xdpModeFlags = map[string]link.XDPAttachFlags{
+	xdpModeNative:  link.XDPDriverMode,
+	xdpModeGeneric: link.XDPGenericMode,
+}
+
+// xdpLink is the XDP program attached to one interface
+type xdpLink struct {
+	name    string
+	ifindex int
+	mode    string
+	link    link.Link
+	pinned  bool // opened from a pin left by the previous process
+}
+
+// attachModeFromString maps xdp_attach_mode to a mode, native by default
+func attachModeFromString(s string) string {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case xdpModeGeneric:
+		return xdpModeGeneric
+	default:
+		return xdpModeNative
+	}
+}
+
+// xdpModeChain lists the modes tried for a requested mode, in order
+func xdpModeChain(mode string) []string {
+	switch mode {
+	case xdpModeGeneric:
+		return []string{xdpModeGeneric}
+	default:
+		return []string{xdpModeNative, xdpModeGeneric}
+	}
+}
+
+// parseInterfaceList splits xdp_interfaces into unique interface names
+func parseInterfaceList(s string) []string {
+	var names []string
+	for _, name := range strings.FieldsFunc(s, func(r rune) bool { return r == ',' || r == ' ' }) {
+		if !slices.Contains(names, name) {
+			names = append(names, name)
+		}
+	}
+	return names
+}
+
+// loadAttachConfig takes the XDP interfaces and mode from the saved settings
+func (e *EBPFService) loadAttachConfig(settings *models.SecuritySettings) {
+	if settings == nil {
+		return
+	}
+	e.attachIfaces = parseInterfaceList(settings.XDPInterfaces)
+	e.attachMode = attachModeFromString(settings.XDPAttachMode)
+	e.keepOnExit.Store(settings.XDPKeepOnExit)
+}
+
+// resolveInterfaces returns the configured XDP interfaces, or the detected
+// primary interface when none are configured
+func (e *EBPFService) resolveInterfaces() ([]*net.Interface, error) {
+	if len(e.attachIfaces) == 0 {
+		iface, err := e.detectInterface()
+		if err != nil {
+			return nil, err
+		}
+		return []*net.Interface{iface}, nil
+	}
+
+	ifaces := make([]*net.Interface, 0, len(e.attachIfaces))
+	for _, name := range e.attachIfaces {
+		iface, err := net.InterfaceByName(name)
+		if err != nil {
+			return nil, fmt.Errorf("XDP interface %s: %w", name, err)
+		}
+		ifaces = append(ifaces, iface)
+	}
+	return ifaces, nil
+}
+
+// attachXDP attaches prog to every interface in ifaces, or to none of them.
+// A link already on an interface, held from the running program or pinned
+// by the previous process, gets prog in place, and only once every other
+// interface has its new link: if one of those fails, they are closed again
+// and the existing links keep the old program.
+func (e *EBPFService) attachXDP(prog *ebpf.Program, ifaces []*net.Interface) error {
+	held := slices.Clone(e.xdpLinks)
+	links := make([]xdpLink, len(ifaces))
+	existing := make([]bool, len(ifaces))
+	for i, iface := range ifaces {
+		if j := slices.IndexFunc(held, func(l xdpLink) bool { return l.ifindex == iface.Index }); j >= 0 {
+			links[i], existing[i] = held[j], true
+			held = slices.Delete(held, j, j+1)
+		} else if l, ok := e.pinnedXDPLink(iface); ok {
+			links[i], existing[i] = l, true
+		}
+	}
+
+	for i, iface := range ifaces {
+		if existing[i] {
+			continue
+		}
+		l, err := attachXDPMode(prog, iface, e.attachMode)
+		if err != nil {
+			for k, l := range links {
+				// Held links stay in e.xdpLinks; pinned ones stay pinned
+				if l.link != nil && (!existing[k] || l.pinned) {
+					l.link.Close()
+				}
+			}
+			return err
+		}
+		links[i] = l
+	}
+
+	// Held links on interfaces no longer configured are detached
+	closeXDPLinks(held)
+
+	var errs []error
+	attached := links[:0]
+	for i, l := range links {
+		if existing[i] {
+			if err := l.link.Update(prog); err != nil {
+				system.Warn("Failed to replace XDP program on %s in place: %v", l.name, err)
+				if l.pinned {
+					l.link.Unpin()
+				}
+				l.link.Close()
+				if l, err = attachXDPMode(prog, ifaces[i], e.attachMode); err != nil {
+					errs = append(errs, err)
+					continue
+				}
+			} else {
+				system.Info("XDP program on %s replaced in place (%s mode)", l.name, l.mode)
+			}
+		}
+		// From here the link lives only as long as this process holds it
+		if l.pinned {
+			l.link.Unpin()
+			l.pinned = false
+		}
+		attached = append(attached, l)
+	}
+	e.xdpLinks = attached
+	if len(attached) > 0 {
+		e.ifaceName = attached[0].name
+	}
+	return errors.Join(errs...)
+}
+
+// attachXDPMode attaches prog to iface in the first mode of mode's chain
+// that the interface accepts
+func attachXDPMode(prog *ebpf.Program, iface *net.Interface, mode string) (xdpLink, error) {
+	var errs []error
+	for _, m := range xdpModeChain(mode) {
+		l, err := link.AttachXDP(link.XDPOptions{
+			Program:   prog,
+			Interface: iface.Index,
+			Flags:     xdpModeFlags[m],
+		})
+		if err != nil {
+			errs = append(errs, fmt.Errorf("%s: %w", m, err))
+			continue
+		}
+
+		switch {
+		case m == xdpModeGeneric && mode != xdpModeGeneric:
+			system.Warn("!!! XDP on %s fell back to GENERIC mode: the driver has no native XDP support. "+
+				"Packets are filtered after skb allocation at roughly 1/3 of native throughput (%v)", iface.Name, errors.Join(errs...))
+		case m != mode:
+			system.Warn("XDP %s mode not available on %s, using %s mode (%v)", mode, iface.Name, m, errors.Join(errs...))
+		}
+		system.Info("XDP attached to %s in %s mode", iface.Name, m)
+		return xdpLink{name: iface.Name, ifindex: iface.Index, mode: m, link: l}, nil
+	}
+	return xdpLink{}, fmt.Errorf("attaching XDP to %s: %w", iface.Name, errors.Join(errs...))
+}
+
+func closeXDPLinks(links []xdpLink) {
+	for _, l := range links {
+		l.link.Close()
+	}
+}
+
+// reattachXDP moves XDP and TC egress to a new interface list or mode.
+// Only one XDP mode can be active on an interface, so the old links are
+// closed first and filtering pauses for the moment in between.
+func (e *EBPFService) reattachXDP(ifaceNames []string, mode string) {
+	e.mu.Lock()
+	defer e.mu.Unlock()
+
+	prevIfaces, prevMode := e.attachIfaces, e.attachMode
+	e.attachIfaces, e.attachMode = ifaceNames, mode
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok || !e.isRunning {
+		return
+	}
+	ifaces, err := e.resolveInterfaces()
+	if err != nil {
+		system.Warn("Keeping current XDP interfaces: %v", err)
+		e.attachIfaces, e.attachMode = prevIfaces, prevMode
+		return
+	}
+
+	e.detachTC()
+	closeXDPLinks(e.xdpLinks)
+	e.xdpLinks = nil
+
+	if err := e.attachXDP(objs.XdpTrafficFilter, ifaces); err != nil {
+		// Put the previous attachment back rather than run unfiltered
+		system.Error("Failed to re-attach XDP: %v", err)
+		e.attachIfaces, e.attachMode = prevIfaces, prevMode
+		prev, err := e.resolveInterfaces()
+		if err == nil {
+			err = e.attachXDP(objs.XdpTrafficFilter, prev)
+		}
+		if err != nil {
+			system.Error("Failed to restore XDP attachment, traffic is UNFILTERED: %v", err)
+			return
+		}
+	}
+	if tcObjs, ok := e.tcObjs.(*tcObjects); ok && tcObjs != nil {
+		if err := e.attachTC(tcObjs); err != nil {
+			system.Warn("Failed to re-attach TC egress program: %v", err)
+		}
+	}
+	system.Info("XDP attached to %s", strings.Join(e.xdpInterfaceNames(), ", "))
+}
+
+// xdpInterfaceNames lists the interfaces XDP is attached to. Caller holds e.mu.
+func (e *EBPFService) xdpInterfaceNames() []string {
+	names := make([]string, len(e.xdpLinks))
+	for i, l := range e.xdpLinks {
+		names[i] = l.name
+	}
+	return names
+}
+
+// xdpAttachments reports the interface and mode of every XDP link. Caller
+// holds e.mu.
+func (e *EBPFService) xdpAttachments() []XDPAttachment {
+	if len(e.xdpLinks) == 0 {
+		return nil
+	}
+	list := make([]XDPAttachment, len(e.xdpLinks))
+	for i, l := range e.xdpLinks {
+		list[i] = XDPAttachment{Interface: l.name, Mode: l.mode}
+	}
+	return list
+}
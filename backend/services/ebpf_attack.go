@@ -0,0 +1,92 @@
+//go:build linux
+
+package services
+
+import (
+	"encoding/binary"
+	"fmt"
+	"time"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+)
+
+// Attack mode (v2.1)
+// XDP decides on its own when the link is under attack: it sums per-CPU
+// ingress windows every ~134ms, applies the attack_* policy overrides as
+// soon as a trip rate holds for two windows, and relaxes with hysteresis.
+// It reports every transition on the ring buffer; userspace only logs and
+// records them.
+
+const (
+	eventAttackMode  = 0x100 // EVENT_ATTACK_MODE in xdp_filter.c
+	attackModeActive = 1
+)
+
+// AttackState matches the C struct attack_state
+type AttackState struct {
+	Epoch       uint64
+	Since       uint64
+	LastPPS     uint64
+	LastMbps    uint64
+	Transitions uint64
+	Mode        uint32
+	Streak      uint32
+}
+
+// handleAttackTransition logs and records one EVENT_ATTACK_MODE record.
+// raw is the ring buffer sample and is not kept.
+func (e *EBPFService) handleAttackTransition(raw []byte) {
+	active := binary.LittleEndian.Uint32(raw[0:4]) == attackModeActive
+	seen := e.bootTime.Add(time.Duration(binary.LittleEndian.Uint64(raw[8:16])))
+	pps := int64(binary.LittleEndian.Uint32(raw[16:20]))
+	mbps := int64(binary.LittleEndian.Uint32(raw[20:24]))
+
+	event := models.AttackEvent{
+		Timestamp:  seen,
+		SourceIP:   "*",
+		AttackType: "attack_mode",
+		PPS:        pps,
+		BPS:        mbps * 1000000 / 8,
+	}
+	if active {
+		e.attackSince.Store(seen.UnixNano())
+		event.Action = "escalated"
+		event.Details = fmt.Sprintf("XDP attack mode on at %d pps, %d Mbit/s", pps, mbps)
+		system.Warn("XDP entered attack mode: %d pps, %d Mbit/s ingress", pps, mbps)
+	} else {
+		if since := e.attackSince.Swap(0); since > 0 {
+			event.Duration = int(seen.Sub(time.Unix(0, since)).Seconds())
+		}
+		event.Action = "relaxed"
+		event.Details = fmt.Sprintf("XDP attack mode off after %ds, ingress down to %d pps, %d Mbit/s",
+			event.Duration, pps, mbps)
+		system.Info("XDP left attack mode after %ds: %d pps, %d Mbit/s ingress", event.Duration, pps, mbps)
+	}
+
+	// Keep the ring buffer reader off the DB
+	if e.db != nil {
+		go func() {
+			if err := e.db.Create(&event).Error; err != nil {
+				system.Warn("Failed to save attack mode event: %v", err)
+			}
+		}()
+	}
+}
+
+// readAttackState returns the attack mode state, and false if the state
+// machine is off
+func (e *EBPFService) readAttackState(objs *xdpObjects) (AttackState, bool) {
+	var state AttackState
+	e.policyMu.Lock()
+	enabled := e.policy.attackModeEnabled()
+	e.policyMu.Unlock()
+	if !enabled || objs.AttackState == nil {
+		return state, false
+	}
+	if err := objs.AttackState.Lookup(uint32(0), &state); err != nil {
+		system.Warn("Failed to read attack_state: %v", err)
+		return state, false
+	}
+	return state, true
+}
@@ -0,0 +1,162 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"sync"
+	"syscall"
+
+	"github.com/cilium/ebpf"
+)
+
+// Batch map helpers (v2.1)
+// Bulk map syncs go through BPF_MAP_*_BATCH so loading hundreds of thousands
+// of entries costs a handful of syscalls. Kernels older than 5.6 and map
+// types without batch support (e.g. LPM tries) fall back to per-key calls;
+// the first refusal is remembered per map type so later syncs (including
+// ones against freshly created inner maps) skip straight to it.
+
+// batchChunk is the number of entries moved per batch syscall
+const batchChunk = 4096
+
+// errENOTSUPP is the kernel-internal ENOTSUPP some map types return for batch ops
+const errENOTSUPP = syscall.Errno(524)
+
+// errBatchUnsupported is returned by batch readers when the caller must fall back
+var errBatchUnsupported = errors.New("batch operations not supported")
+
+// noBatchTypes remembers map types whose batch calls were refused
+var noBatchTypes sync.Map // map[ebpf.MapType]struct{}
+
+func isBatchUnsupported(err error) bool {
+	return errors.Is(err, ebpf.ErrNotSupported) || errors.Is(err, syscall.EINVAL) || errors.Is(err, errENOTSUPP)
+}
+
+func batchAllowed(m *ebpf.Map) bool {
+	_, refused := noBatchTypes.Load(m.Type())
+	return !refused
+}
+
+func refuseBatch(m *ebpf.Map) {
+	noBatchTypes.Store(m.Type(), struct{}{})
+}
+
+// batchPut writes keys[i] -> values[i] into m and returns how many were written
+func batchPut[K, V any](m *ebpf.Map, keys []K, values []V) (int, error) {
+	written := 0
+	if batchAllowed(m) {
+		for written < len(keys) {
+			end := written + batchChunk
+			if end > len(keys) {
+				end = len(keys)
+			}
+			n, err := m.BatchUpdate(keys[written:end], values[written:end], nil)
+			written += n
+			if err == nil {
+				continue
+			}
+			if written == 0 && isBatchUnsupported(err) {
+				refuseBatch(m)
+				break
+			}
+			return written, err
+		}
+		if written == len(keys) {
+			return written, nil
+		}
+	}
+
+	// Fallback: one syscall per element
+	var firstErr error
+	for i := written; i < len(keys); i++ {
+		if err := m.Put(keys[i], values[i]); err != nil {
+			if firstErr == nil {
+				firstErr = err
+			}
+			continue
+		}
+		written++
+	}
+	return written, firstErr
+}
+
+// batchDelete removes keys from m and returns how many were deleted
+func batchDelete[K any](m *ebpf.Map, keys []K) (int, error) {
+	deleted := 0
+	if batchAllowed(m) {
+		for deleted < len(keys) {
+			end := deleted + batchChunk
+			if end > len(keys) {
+				end = len(keys)
+			}
+			n, err := m.BatchDelete(keys[deleted:end], nil)
+			deleted += n
+			if err == nil {
+				continue
+			}
+			if deleted == 0 && isBatchUnsupported(err) {
+				refuseBatch(m)
+				break
+			}
+			return deleted, err
+		}
+		if deleted == len(keys) {
+			return deleted, nil
+		}
+	}
+
+	for i := deleted; i < len(keys); i++ {
+		if err := m.Delete(keys[i]); err == nil {
+			deleted++
+		}
+	}
+	return deleted, nil
+}
+
+// batchReadPerCPU visits up to limit entries of a per-CPU hash map, deleting
+// them as it goes if drain is set. fn receives one value per possible CPU.
+// Returns errBatchUnsupported (with nothing visited) if the caller must fall
+// back to Iterate.
+func batchReadPerCPU[K, V any](m *ebpf.Map, limit int, drain bool, fn func(key K, values []V)) (int, error) {
+	if !batchAllowed(m) {
+		return 0, errBatchUnsupported
+	}
+	nCPU, err := ebpf.PossibleCPU()
+	if err != nil {
+		return 0, err
+	}
+
+	chunk := batchChunk
+	if limit > 0 && limit < chunk {
+		chunk = limit
+	}
+	keys := make([]K, chunk)
+	values := make([]V, chunk*nCPU)
+
+	var cursor ebpf.MapBatchCursor
+	visited := 0
+	for limit <= 0 || visited < limit {
+		var n int
+		if drain {
+			n, err = m.BatchLookupAndDelete(&cursor, keys, values, nil)
+		} else {
+			n, err = m.BatchLookup(&cursor, keys, values, nil)
+		}
+		if visited == 0 && n == 0 && err != nil && isBatchUnsupported(err) {
+			refuseBatch(m)
+			return 0, errBatchUnsupported
+		}
+		for i := 0; i < n && (limit <= 0 || visited < limit); i++ {
+			fn(keys[i], values[i*nCPU:(i+1)*nCPU])
+			visited++
+		}
+		if errors.Is(err, ebpf.ErrKeyNotExist) {
+			return visited, nil
+		}
+		if err != nil {
+			return visited, err
+		}
+	}
+	return visited, nil
+}
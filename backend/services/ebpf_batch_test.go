@@ -0,0 +1,95 @@
+//go:build linux
+
+package services
+
+import (
+	"testing"
+
+	"github.com/cilium/ebpf"
+)
+
+// GeoIP sync cost: the merged synthetic country set (see ebpf_geo_test.go)
+// loaded into fresh inner maps built from the compiled program's specs,
+// through batchPut and through its per-key fallback. Creating maps needs
+// CAP_BPF, so the benchmarks skip without it.
+
+// benchInnerSpec returns the inner map spec of a map-in-map in xdp_filter.c
+func benchInnerSpec(b *testing.B, name string) *ebpf.MapSpec {
+	spec, err := loadXdp()
+	if err != nil {
+		b.Fatalf("loading eBPF spec: %v", err)
+	}
+	m, ok := spec.Maps[name]
+	if !ok || m.InnerMap == nil {
+		b.Fatalf("%s map-in-map definition missing from eBPF spec", name)
+	}
+	return m.InnerMap.Copy()
+}
+
+// benchLoad fills a fresh map from spec with batchPut once per iteration.
+// perKey refuses batch calls for the map type first, so batchPut takes the
+// per-key fallback.
+func benchLoad[K, V any](b *testing.B, spec *ebpf.MapSpec, keys []K, values []V, perKey bool) {
+	probe, err := ebpf.NewMap(spec)
+	if err != nil {
+		b.Skipf("cannot create %v map (needs CAP_BPF): %v", spec.Type, err)
+	}
+	if perKey {
+		refuseBatch(probe)
+		defer noBatchTypes.Delete(spec.Type)
+	}
+	probe.Close()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		b.StopTimer()
+		m, err := ebpf.NewMap(spec)
+		if err != nil {
+			b.Fatalf("creating %v map: %v", spec.Type, err)
+		}
+		b.StartTimer()
+		n, err := batchPut(m, keys, values)
+		b.StopTimer()
+		batched := batchAllowed(m)
+		m.Close()
+		if err != nil || n != len(keys) {
+			b.Fatalf("loaded %d of %d entries: %v", n, len(keys), err)
+		}
+		if !perKey && !batched && i == 0 {
+			b.Logf("%v refuses batch updates, batchPut used the per-key fallback", spec.Type)
+		}
+		b.StartTimer()
+	}
+	if s := b.Elapsed().Seconds(); s > 0 {
+		b.ReportMetric(float64(len(keys))*float64(b.N)/s, "entries/s")
+	}
+}
+
+func BenchmarkGeoTrieLoad(b *testing.B) {
+	spec := benchInnerSpec(b, "geo_allowed")
+	keys := buildGeoTrieKeys(mergeCIDRs(syntheticCountryCIDRs()), int(spec.MaxEntries))
+	values := make([]uint32, len(keys))
+	for i := range values {
+		values[i] = 1
+	}
+
+	b.Run("batch", func(b *testing.B) { benchLoad(b, spec, keys, values, false) })
+	b.Run("per-key", func(b *testing.B) { benchLoad(b, spec, keys, values, true) })
+}
+
+func BenchmarkGeoBitmapLoad(b *testing.B) {
+	spec := benchInnerSpec(b, "geo_bitmap")
+	words, _ := buildGeoBitmap(mergeCIDRs(syntheticCountryCIDRs()))
+	var indexes []uint32
+	var values []GeoWord
+	for i, w := range words {
+		if w != (GeoWord{}) {
+			indexes = append(indexes, uint32(i))
+			values = append(values, w)
+		}
+	}
+
+	b.Run("batch", func(b *testing.B) { benchLoad(b, spec, indexes, values, false) })
+	b.Run("per-key", func(b *testing.B) { benchLoad(b, spec, indexes, values, true) })
+}
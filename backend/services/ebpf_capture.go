@@ -0,0 +1,111 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"fmt"
+
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+)
+
+// AF_XDP capture (v2.1)
+// While a capture runs, XDP redirects sampled drops to capture_xsks, one
+// AF_XDP socket per RX queue, instead of dropping them. The sockets belong
+// to the PCAP service; this side only publishes them and the filter.
+
+// CaptureInterface returns the first interface XDP is attached to, or ""
+// if none. Captures cover that interface only: capture_xsks is keyed by RX
+// queue alone.
+func (e *EBPFService) CaptureInterface() string {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+	if len(e.xdpLinks) == 0 {
+		return ""
+	}
+	return e.xdpLinks[0].name
+}
+
+// StartXDPCapture publishes the AF_XDP sockets in fds (by RX queue) and
+// starts redirecting the drops that match filter
+func (e *EBPFService) StartXDPCapture(fds map[uint32]int, filter XDPCaptureFilter) error {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		return fmt.Errorf("XDP program is not loaded")
+	}
+
+	e.captureMu.Lock()
+	e.captureFDs = fds
+	e.captureMu.Unlock()
+	if !e.restoreCaptureSockets(objs) {
+		e.clearCaptureSockets(objs)
+		return fmt.Errorf("publishing capture sockets failed")
+	}
+
+	rate := roundUpPow2(max(filter.Rate, 1))
+	err := e.updatePolicy(objs, func(p *XDPPolicy) {
+		p.CaptureRate = rate
+		p.CaptureProto = filter.Proto
+		p.CapturePort = filter.Port
+		p.CaptureHost = filter.Host
+	})
+	if err != nil {
+		e.clearCaptureSockets(objs)
+		return fmt.Errorf("publishing capture policy: %w", err)
+	}
+	system.Info("XDP capture started on %d queue(s), 1-in-%d drops", len(fds), rate)
+	return nil
+}
+
+// StopXDPCapture stops redirecting drops and unpublishes the sockets. The
+// caller may close them once it returns.
+func (e *EBPFService) StopXDPCapture() {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		e.captureMu.Lock()
+		e.captureFDs = nil
+		e.captureMu.Unlock()
+		return
+	}
+
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.CaptureRate = 0 }); err != nil {
+		system.Warn("Failed to turn off XDP capture: %v", err)
+	}
+	e.clearCaptureSockets(objs)
+}
+
+// restoreCaptureSockets writes the capture sockets to capture_xsks and
+// reports whether a capture is running. Called from loadEBPFProgram under
+// e.mu, so it only takes captureMu.
+func (e *EBPFService) restoreCaptureSockets(objs *xdpObjects) bool {
+	e.captureMu.Lock()
+	defer e.captureMu.Unlock()
+	if len(e.captureFDs) == 0 {
+		return false
+	}
+	for queue, fd := range e.captureFDs {
+		if err := objs.CaptureXsks.Put(queue, uint32(fd)); err != nil {
+			system.Warn("Failed to publish capture socket for queue %d: %v", queue, err)
+			return false
+		}
+	}
+	return true
+}
+
+// clearCaptureSockets removes the capture sockets from capture_xsks
+func (e *EBPFService) clearCaptureSockets(objs *xdpObjects) {
+	e.captureMu.Lock()
+	defer e.captureMu.Unlock()
+	for queue := range e.captureFDs {
+		if err := objs.CaptureXsks.Delete(queue); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			system.Warn("Failed to remove capture socket for queue %d: %v", queue, err)
+		}
+	}
+	e.captureFDs = nil
+}
@@ -0,0 +1,254 @@
+//go:build linux
+
+package services
+
+import (
+	"encoding/binary"
+	"errors"
+	"time"
+
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+)
+
+// In-kernel event pre-aggregation (v2.1)
+// XDP counts drops per (src_ip, reason) in the per-CPU event_counts hash
+// instead of emitting one ring buffer record per packet. The aggregator
+// drains the hash every batch interval, so counts stay exact under floods.
+// The ring buffer only carries drops that did not fit in the hash, sampled
+// adaptively and weighted by their sampling period.
+
+// eventPollInterval bounds how long batched (unwoken) ring buffer records wait
+const eventPollInterval = 500 * time.Millisecond
+
+// EventKey matches the C struct event_key
+type EventKey struct {
+	SrcIP  uint32
+	Reason uint32
+}
+
+// EventCount matches the C struct event_count
+type EventCount struct {
+	Count     uint64
+	FirstSeen uint64
+	LastSeen  uint64
+}
+
+// drainEventCounts empties event_counts and calls fn once per key with the
+// counts summed over all CPUs
+func (e *EBPFService) drainEventCounts(fn func(key EventKey, total EventCount)) {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok || objs.EventCounts == nil {
+		return
+	}
+
+	visit := func(key EventKey, values []EventCount) {
+		var total EventCount
+		for _, v := range values {
+			if v.Count == 0 {
+				continue
+			}
+			total.Count += v.Count
+			if total.FirstSeen == 0 || v.FirstSeen < total.FirstSeen {
+				total.FirstSeen = v.FirstSeen
+			}
+			total.LastSeen = max(total.LastSeen, v.LastSeen)
+		}
+		if total.Count > 0 {
+			fn(key, total)
+		}
+	}
+
+	_, err := batchReadPerCPU(objs.EventCounts, 0, true, visit)
+	if err == nil {
+		return
+	}
+	if !errors.Is(err, errBatchUnsupported) {
+		system.Warn("Failed to drain event_counts: %v", err)
+		return
+	}
+
+	// Fallback: read everything, then delete what was read
+	var (
+		key    EventKey
+		values []EventCount
+		keys   []EventKey
+	)
+	iter := objs.EventCounts.Iterate()
+	for iter.Next(&key, &values) {
+		visit(key, values)
+		keys = append(keys, key)
+	}
+	if err := iter.Err(); err != nil {
+		system.Warn("Failed to iterate event_counts: %v", err)
+	}
+	for _, k := range keys {
+		if err := objs.EventCounts.Delete(k); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			system.Warn("Failed to delete event_counts entry: %v", err)
+			return
+		}
+	}
+}
+
+// Event pipeline buffers
+// The ring buffer reader decodes records into fixed-size batches taken from
+// a free list and hands whole batches to the aggregator, which counts them in
+// an open-addressing table reused across flushes. Neither side allocates per
+// record; a flush only allocates for what it writes to the DB.
+
+const (
+	eventRecordSize = 24 // sizeof(struct event_data)
+	eventBatchSize  = 256
+	eventBatchPool  = 64 // batches in flight between reader and aggregator
+
+	aggTableBits = 17
+	aggTableSize = 1 << aggTableBits
+	aggMaxKeys   = aggTableSize * 3 / 4 // keep probes short
+
+	eventGeoCacheMax = 65536
+	eventGeoCacheTTL = 10 * time.Minute
+)
+
+// eventRecord is one decoded ring buffer sample
+type eventRecord struct {
+	SrcIP  uint32
+	Reason uint32
+	Count  uint32
+	Seen   uint64 // bpf_ktime_get_ns
+}
+
+// decodeEventRecord decodes one C struct event_data sample of at least
+// eventRecordSize bytes
+func decodeEventRecord(raw []byte) eventRecord {
+	return eventRecord{
+		SrcIP:  binary.LittleEndian.Uint32(raw[0:4]),
+		Reason: binary.LittleEndian.Uint32(raw[4:8]),
+		Seen:   binary.LittleEndian.Uint64(raw[8:16]),
+		Count:  max(binary.LittleEndian.Uint32(raw[16:20]), 1),
+	}
+}
+
+type eventBatch struct {
+	n       int
+	records [eventBatchSize]eventRecord
+}
+
+// newEventFreeList returns a channel holding every batch the pipeline may use
+func newEventFreeList() chan *eventBatch {
+	free := make(chan *eventBatch, eventBatchPool)
+	for i := 0; i < eventBatchPool; i++ {
+		free <- &eventBatch{}
+	}
+	return free
+}
+
+// aggSlot is live only while its epoch matches the table's
+type aggSlot struct {
+	key   uint64 // src_ip<<32 | reason
+	epoch uint32
+	count int64
+	first uint64
+	last  uint64
+}
+
+// aggTable is a linear-probing (src_ip, reason) counter table. reset is O(1)
+// apart from truncating the list of occupied slots.
+type aggTable struct {
+	slots []aggSlot
+	used  []uint32
+	epoch uint32
+}
+
+func newAggTable() *aggTable {
+	return &aggTable{
+		slots: make([]aggSlot, aggTableSize),
+		used:  make([]uint32, 0, aggMaxKeys),
+		epoch: 1,
+	}
+}
+
+// add merges count drops into the slot for (srcIP, reason). Returns false if
+// the key is new and the table is full.
+func (t *aggTable) add(srcIP, reason uint32, count int64, first, last uint64) bool {
+	key := uint64(srcIP)<<32 | uint64(reason)
+	i := uint32((key * 0x9E3779B97F4A7C15) >> (64 - aggTableBits))
+	for {
+		s := &t.slots[i]
+		if s.epoch != t.epoch {
+			if len(t.used) >= aggMaxKeys {
+				return false
+			}
+			*s = aggSlot{key: key, epoch: t.epoch, count: count, first: first, last: last}
+			t.used = append(t.used, i)
+			return true
+		}
+		if s.key == key {
+			s.count += count
+			s.first = min(s.first, first)
+			s.last = max(s.last, last)
+			return true
+		}
+		i = (i + 1) & (aggTableSize - 1)
+	}
+}
+
+func (t *aggTable) len() int {
+	return len(t.used)
+}
+
+func (t *aggTable) each(fn func(s *aggSlot)) {
+	for _, i := range t.used {
+		fn(&t.slots[i])
+	}
+}
+
+func (t *aggTable) reset() {
+	t.used = t.used[:0]
+	t.epoch++
+	if t.epoch == 0 {
+		clear(t.slots)
+		t.epoch = 1
+	}
+}
+
+// eventGeo is a cached string form and country of one source IP
+type eventGeo struct {
+	ip   string
+	name string
+	code string
+}
+
+// eventGeoCache memoizes intToIP and GetCountry for repeat attackers. It is
+// dropped when full and periodically so GeoIP database updates show up.
+type eventGeoCache struct {
+	entries map[uint32]eventGeo
+	resetAt time.Time
+}
+
+func newEventGeoCache() *eventGeoCache {
+	return &eventGeoCache{
+		entries: make(map[uint32]eventGeo, 4096),
+		resetAt: time.Now().Add(eventGeoCacheTTL),
+	}
+}
+
+func (c *eventGeoCache) get(ip uint32, geo *GeoIPService) eventGeo {
+	if g, ok := c.entries[ip]; ok {
+		return g
+	}
+	if len(c.entries) >= eventGeoCacheMax || time.Now().After(c.resetAt) {
+		clear(c.entries)
+		c.resetAt = time.Now().Add(eventGeoCacheTTL)
+	}
+
+	g := eventGeo{ip: intToIP(ip), name: "Unknown", code: "XX"}
+	if geo != nil {
+		g.name, g.code = geo.GetCountry(g.ip)
+	}
+	c.entries[ip] = g
+	return g
+}
@@ -0,0 +1,145 @@
+//go:build linux
+
+package services
+
+import (
+	"fmt"
+	"math/rand"
+	"testing"
+)
+
+// GeoIP engine cost over a synthetic full country set: time to merge the
+// country lists and compile them for each engine, and the kernel memory each
+// engine then holds. The trie stores one node per prefix; the bitmap is a
+// preallocated array plus a trie for the mixed /24s only.
+
+// geoTrieNodeBytes is one geo_allowed element in the kernel: the 40-byte
+// struct lpm_trie_node, 4 bytes of key data and a 4-byte value, rounded up
+// to the 64-byte allocator bucket. Intermediate nodes come on top.
+const geoTrieNodeBytes = 64
+
+// syntheticCountryCIDRs returns IPv4 lists for 250 countries covering the
+// unicast space the way RIR allocations do: mostly /24 to /20 blocks, a tail
+// of large ones, a few sub-/24s and unallocated gaps, about 220k CIDRs in all
+func syntheticCountryCIDRs() map[string][]string {
+	rng := rand.New(rand.NewSource(1))
+	prefixes := []struct {
+		len    int
+		weight int // relative share of blocks
+	}{
+		{29, 20}, {28, 30}, {27, 40}, {26, 50}, {25, 60},
+		{24, 6000}, {23, 1000}, {22, 1200}, {21, 600}, {20, 450}, {19, 250},
+		{18, 120}, {17, 80}, {16, 180}, {15, 40}, {14, 30}, {13, 15},
+		{12, 10}, {11, 5}, {10, 3}, {8, 1},
+	}
+	total := 0
+	for _, p := range prefixes {
+		total += p.weight
+	}
+
+	countries := make(map[string][]string, 250)
+	for cursor := uint64(1) << 24; cursor < 224<<24; {
+		pick, plen := rng.Intn(total), 24
+		for _, p := range prefixes {
+			if pick < p.weight {
+				plen = p.len
+				break
+			}
+			pick -= p.weight
+		}
+		size := uint64(1) << (32 - plen)
+		cursor = (cursor + size - 1) &^ (size - 1)
+		if cursor+size > 224<<24 {
+			break
+		}
+		if rng.Intn(10) > 0 { // ~10% stays unallocated
+			cc := fmt.Sprintf("c%03d", rng.Intn(250))
+			countries[cc] = append(countries[cc], fmt.Sprintf("%d.%d.%d.%d/%d",
+				byte(cursor>>24), byte(cursor>>16), byte(cursor>>8), byte(cursor), plen))
+		}
+		cursor += size
+	}
+	return countries
+}
+
+// geoBenchSets are the allow-lists benchmarked: every country, which merges
+// into few ranges, and every other country, which leaves the most fragments
+func geoBenchSets() []struct {
+	name  string
+	cidrs map[string][]string
+} {
+	all := syntheticCountryCIDRs()
+	half := make(map[string][]string, len(all)/2)
+	for cc, cidrs := range all {
+		if cc[len(cc)-1]%2 == 0 {
+			half[cc] = cidrs
+		}
+	}
+	return []struct {
+		name  string
+		cidrs map[string][]string
+	}{{"all", all}, {"half", half}}
+}
+
+func BenchmarkGeoMerge(b *testing.B) {
+	for _, set := range geoBenchSets() {
+		b.Run(set.name, func(b *testing.B) {
+			cidrs := 0
+			for _, list := range set.cidrs {
+				cidrs += len(list)
+			}
+			b.ReportAllocs()
+			b.ResetTimer()
+			var ranges []IPv4Range
+			for i := 0; i < b.N; i++ {
+				ranges = mergeCIDRs(set.cidrs)
+			}
+			b.ReportMetric(float64(cidrs), "cidrs")
+			b.ReportMetric(float64(len(ranges)), "ranges")
+		})
+	}
+}
+
+func BenchmarkGeoCompileTrie(b *testing.B) {
+	for _, set := range geoBenchSets() {
+		b.Run(set.name, func(b *testing.B) {
+			ranges := mergeCIDRs(set.cidrs)
+			b.ReportAllocs()
+			b.ResetTimer()
+			var keys []LpmKey
+			for i := 0; i < b.N; i++ {
+				keys = buildGeoTrieKeys(ranges, 1<<30)
+			}
+			b.ReportMetric(float64(len(keys)), "entries")
+			b.ReportMetric(float64(len(keys)*geoTrieNodeBytes), "kernel-B")
+		})
+	}
+}
+
+func BenchmarkGeoCompileBitmap(b *testing.B) {
+	for _, set := range geoBenchSets() {
+		b.Run(set.name, func(b *testing.B) {
+			ranges := mergeCIDRs(set.cidrs)
+			b.ReportAllocs()
+			b.ResetTimer()
+			var words []GeoWord
+			var keys []LpmKey
+			for i := 0; i < b.N; i++ {
+				var partial []IPv4Range
+				words, partial = buildGeoBitmap(ranges)
+				keys = buildGeoTrieKeys(partial, 1<<30)
+			}
+			used := 0
+			for _, w := range words {
+				if w != (GeoWord{}) {
+					used++
+				}
+			}
+			// The array map preallocates every word, used or not
+			bitmapBytes := geoBitmapWords * 16
+			b.ReportMetric(float64(used), "words")
+			b.ReportMetric(float64(len(keys)), "entries")
+			b.ReportMetric(float64(bitmapBytes+len(keys)*geoTrieNodeBytes), "kernel-B")
+		})
+	}
+}
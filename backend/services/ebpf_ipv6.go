@@ -0,0 +1,308 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"fmt"
+	"net"
+	"time"
+
+	"kg-proxy-web-gui/backend/system"
+)
+
+// IPv6 filtering (v2.1)
+// XDP filters IPv6 sources with their own maps: tries over the full address
+// for the allow, block and GeoIP lists, and hashes keyed by the source /64
+// (the first 8 address bytes, raw) for auto-blocks, rate limits and stats.
+// The helpers here route the IPv6 entries of the existing loaders into them.
+
+// ip6StatsLimit bounds the ip6_stats entries merged into the traffic view
+const ip6StatsLimit = 1000
+
+// LpmKey6 matches the C struct lpm_key6
+type LpmKey6 struct {
+	PrefixLen uint32
+	Data      [16]uint8
+}
+
+// parseLpmKey6 parses an IPv6 address or CIDR into an LPM trie key. IPv4
+// (including IPv4-mapped addresses) is left to parseLpmKey.
+func parseLpmKey6(s string) (LpmKey6, bool) {
+	key := LpmKey6{PrefixLen: 128}
+
+	ip := net.ParseIP(s)
+	if ip == nil {
+		_, ipNet, err := net.ParseCIDR(s)
+		if err != nil {
+			return key, false
+		}
+		ones, bits := ipNet.Mask.Size()
+		if bits != 128 {
+			return key, false
+		}
+		key.PrefixLen = uint32(ones)
+		ip = ipNet.IP
+	}
+
+	if ip.To4() != nil || len(ip) != net.IPv6len {
+		return key, false
+	}
+	copy(key.Data[:], ip)
+	return key, true
+}
+
+// ipv6Net returns the blocked_nets6/ip6_stats key of an IPv6 address
+func ipv6Net(ip net.IP) [8]byte {
+	var key [8]byte
+	copy(key[:], ip.To16())
+	return key
+}
+
+// updateAllowIPs6 writes the IPv6 entries of ips to white_list6 and returns
+// how many there were
+func (e *EBPFService) updateAllowIPs6(objs *xdpObjects, ips []string) int {
+	var keys []LpmKey6
+	var values []uint32
+	for _, ipStr := range ips {
+		if key, ok := parseLpmKey6(ipStr); ok {
+			keys = append(keys, key)
+			values = append(values, 1)
+		}
+	}
+	if n, err := batchPut(objs.WhiteList6, keys, values); err != nil {
+		system.Warn("Failed to add %d IPv6 whitelist entries: %v", len(keys)-n, err)
+	}
+	return len(keys)
+}
+
+// putBlocked6 writes manual IPv6 blocks to blocked_ips6, announcing the new
+// entry count to XDP first so it starts walking the trie
+func (e *EBPFService) putBlocked6(objs *xdpObjects, keys []LpmKey6, values []BlockEntry) error {
+	if len(keys) == 0 {
+		return nil
+	}
+
+	e.ruleMu.Lock()
+	for _, key := range keys {
+		e.block6Keys[key] = struct{}{}
+	}
+	count := len(e.block6Keys)
+	e.ruleMu.Unlock()
+
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.Block6Prefixes = uint32(count) }); err != nil {
+		system.Warn("Failed to publish blocked IPv6 prefix count: %v", err)
+	}
+	if n, err := batchPut(objs.BlockedIps6, keys, values); err != nil {
+		return fmt.Errorf("%d of %d IPv6 blocks failed: %w", len(keys)-n, len(keys), err)
+	}
+	return nil
+}
+
+// updateBlockedIPs6 writes the IPv6 entries of ips as permanent manual blocks
+func (e *EBPFService) updateBlockedIPs6(objs *xdpObjects, ips []string) {
+	var keys []LpmKey6
+	var values []BlockEntry
+	for _, ipStr := range ips {
+		if key, ok := parseLpmKey6(ipStr); ok {
+			keys = append(keys, key)
+			values = append(values, BlockEntry{Reason: 1}) // manual, permanent
+		}
+	}
+	if err := e.putBlocked6(objs, keys, values); err != nil {
+		system.Warn("Failed to update blocked IPv6 entries: %v", err)
+	}
+}
+
+// removeBlocked6 lifts both a manual /128 block and an auto-block of the
+// address's /64
+func (e *EBPFService) removeBlocked6(objs *xdpObjects, ip net.IP) error {
+	key := LpmKey6{PrefixLen: 128}
+	copy(key.Data[:], ip.To16())
+
+	errHost := objs.BlockedIps6.Delete(key)
+	errNet := objs.BlockedNets6.Delete(ipv6Net(ip))
+	if errHost == nil {
+		e.ruleMu.Lock()
+		delete(e.block6Keys, key)
+		count := len(e.block6Keys)
+		e.ruleMu.Unlock()
+		if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.Block6Prefixes = uint32(count) }); err != nil {
+			system.Warn("Failed to publish blocked IPv6 prefix count: %v", err)
+		}
+	}
+	if errHost != nil && errNet != nil {
+		return errHost
+	}
+	return nil
+}
+
+// lookupBlocked6 returns the block covering ip, /64 auto-blocks first
+func (e *EBPFService) lookupBlocked6(objs *xdpObjects, ip net.IP) (BlockEntry, bool) {
+	var value BlockEntry
+	if err := objs.BlockedNets6.Lookup(ipv6Net(ip), &value); err == nil {
+		return value, true
+	}
+	key := LpmKey6{PrefixLen: 128}
+	copy(key.Data[:], ip.To16())
+	if err := objs.BlockedIps6.Lookup(key, &value); err == nil {
+		return value, true
+	}
+	return value, false
+}
+
+// appendBlocked6 adds IPv6 blocks to list until it holds limit entries
+func (e *EBPFService) appendBlocked6(objs *xdpObjects, list []BlockedIPInfo, limit int) ([]BlockedIPInfo, error) {
+	var value BlockEntry
+
+	var key LpmKey6
+	iter := objs.BlockedIps6.Iterate()
+	for len(list) < limit && iter.Next(&key, &value) {
+		ip := net.IP(key.Data[:]).String()
+		if key.PrefixLen < 128 {
+			ip = fmt.Sprintf("%s/%d", ip, key.PrefixLen)
+		}
+		list = append(list, e.blockedIPInfo(ip, value))
+	}
+	if err := iter.Err(); err != nil {
+		return list, err
+	}
+
+	var netKey [8]byte
+	netIter := objs.BlockedNets6.Iterate()
+	for len(list) < limit && netIter.Next(&netKey, &value) {
+		list = append(list, e.blockedIPInfo(net6String(netKey), value))
+	}
+	return list, netIter.Err()
+}
+
+// net6String formats a /64 key as a CIDR
+func net6String(key [8]byte) string {
+	ip := make(net.IP, net.IPv6len)
+	copy(ip, key[:])
+	return ip.String() + "/64"
+}
+
+// trafficFromIP6Stats walks ip6_stats and returns up to ip6StatsLimit entries
+func (e *EBPFService) trafficFromIP6Stats(objs *xdpObjects) []TrafficEntry {
+	entries := make([]TrafficEntry, 0, 64)
+	visit := func(key [8]byte, values []PacketStats) {
+		stats := sumPacketStats(values)
+		prefix := net6String(key)
+
+		countryCode := "XX"
+		if e.geoIPService != nil {
+			countryCode = e.geoIPService.GetCountryCode(prefix[:len(prefix)-3])
+		}
+		entries = append(entries, TrafficEntry{
+			SourceIP:    prefix,
+			Protocol:    "IPv6",
+			PacketCount: int(stats.Packets),
+			ByteCount:   int64(stats.Bytes),
+			Timestamp:   e.bootTime.Add(time.Duration(stats.LastSeen)),
+			Blocked:     stats.Blocked > 0,
+			CountryCode: countryCode,
+		})
+	}
+
+	_, err := batchReadPerCPU(objs.Ip6Stats, ip6StatsLimit, false, visit)
+	if err == nil {
+		return entries
+	}
+	if !errors.Is(err, errBatchUnsupported) {
+		system.Warn("Error batch reading ip6_stats map: %v", err)
+	}
+	entries = entries[:0]
+
+	var key [8]byte
+	var values []PacketStats
+	iter := objs.Ip6Stats.Iterate()
+	for len(entries) < ip6StatsLimit && iter.Next(&key, &values) {
+		visit(key, values)
+	}
+	if err := iter.Err(); err != nil {
+		system.Warn("Error iterating ip6_stats map: %v", err)
+	}
+	return entries
+}
+
+// resetIP6Stats empties ip6_stats and returns how many entries it held
+func resetIP6Stats(objs *xdpObjects) int {
+	count, err := batchReadPerCPU(objs.Ip6Stats, 0, true, func(key [8]byte, values []PacketStats) {})
+	if errors.Is(err, errBatchUnsupported) {
+		var key [8]byte
+		var values []PacketStats
+		var keysToDelete [][8]byte
+
+		iter := objs.Ip6Stats.Iterate()
+		for iter.Next(&key, &values) {
+			keysToDelete = append(keysToDelete, key)
+		}
+		count, _ = batchDelete(objs.Ip6Stats, keysToDelete)
+	} else if err != nil {
+		system.Warn("Error draining ip6_stats for reset: %v", err)
+	}
+	return count
+}
+
+// publishGeo6 brings geo_allowed6 in line with the loaded IPv6 country
+// lists: new prefixes go in before stale ones come out, so an allowed source
+// is never dropped mid-update. Caller holds geoMu.
+func (e *EBPFService) publishGeo6(objs *xdpObjects) {
+	want := make(map[LpmKey6]struct{})
+	for _, cidrs := range e.geoIPService.GetAllCountryCIDRs6() {
+		for _, cidr := range cidrs {
+			if key, ok := parseLpmKey6(cidr); ok {
+				want[key] = struct{}{}
+			}
+		}
+	}
+
+	var added, stale []LpmKey6
+	for key := range want {
+		if _, ok := e.geo6Keys[key]; !ok {
+			added = append(added, key)
+		}
+	}
+	for key := range e.geo6Keys {
+		if _, ok := want[key]; !ok {
+			stale = append(stale, key)
+		}
+	}
+	if len(added) == 0 && len(stale) == 0 {
+		return
+	}
+
+	values := make([]uint32, len(added))
+	for i := range values {
+		values[i] = 1
+	}
+	n, err := batchPut(objs.GeoAllowed6, added, values)
+	if err != nil {
+		// Leave geo6_loaded alone: an incomplete trie would drop allowed sources
+		system.Warn("Failed to load IPv6 GeoIP prefixes (%d of %d): %v", n, len(added), err)
+		return
+	}
+	for _, key := range added {
+		e.geo6Keys[key] = struct{}{}
+	}
+
+	if len(want) == 0 {
+		// Unpublish before emptying the trie
+		if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.Geo6Loaded = 0 }); err != nil {
+			system.Warn("Failed to publish IPv6 GeoIP state: %v", err)
+		}
+	}
+	if _, err := batchDelete(objs.GeoAllowed6, stale); err != nil {
+		system.Warn("Failed to remove stale IPv6 GeoIP prefixes: %v", err)
+	}
+	for _, key := range stale {
+		delete(e.geo6Keys, key)
+	}
+	if len(want) > 0 {
+		if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.Geo6Loaded = 1 }); err != nil {
+			system.Warn("Failed to publish IPv6 GeoIP state: %v", err)
+		}
+	}
+	system.Info("IPv6 GeoIP map updated: %d prefixes (+%d -%d)", len(want), len(added), len(stale))
+}
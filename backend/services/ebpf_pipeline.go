@@ -0,0 +1,81 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"fmt"
+
+	"github.com/cilium/ebpf"
+)
+
+// XDP tail-call pipeline (v2.1)
+// xdp_traffic_filter only runs the always-on bypasses and then tail-calls the
+// stage programs linked into xdp_stages. Stages that the policy does not need
+// are left out of the array, so XDP skips them without running any of their
+// code. Slots are fixed, so one stage can be replaced without detaching XDP.
+
+// Pipeline slots, match STAGE_* in xdp_filter.c
+const (
+	stageACL       uint32 = 0
+	stageConntrack uint32 = 1
+	stageSignature uint32 = 2
+	stageA2S       uint32 = 3
+	stageSynProxy  uint32 = 4
+	stageRateLimit uint32 = 5
+	stageGeoIP     uint32 = 6
+	stageAccount   uint32 = 7
+)
+
+// pipelineStage describes one slot of xdp_stages
+type pipelineStage struct {
+	slot    uint32
+	name    string
+	prog    func(objs *xdpObjects) *ebpf.Program
+	enabled func(p *XDPPolicy) bool
+}
+
+func alwaysStage(*XDPPolicy) bool { return true }
+
+var pipelineStages = []pipelineStage{
+	{stageACL, "acl", func(o *xdpObjects) *ebpf.Program { return o.XdpStageAcl }, alwaysStage},
+	{stageConntrack, "conntrack", func(o *xdpObjects) *ebpf.Program { return o.XdpStageConntrack }, alwaysStage},
+	{stageSignature, "signature", func(o *xdpObjects) *ebpf.Program { return o.XdpStageSignature },
+		func(p *XDPPolicy) bool { return p.SignatureShapes != 0 }},
+	{stageA2S, "a2s", func(o *xdpObjects) *ebpf.Program { return o.XdpStageA2s }, alwaysStage},
+	{stageSynProxy, "syn_proxy", func(o *xdpObjects) *ebpf.Program { return o.XdpStageSynProxy },
+		func(p *XDPPolicy) bool { return p.SynProxy == 1 }},
+	{stageRateLimit, "rate_limit", func(o *xdpObjects) *ebpf.Program { return o.XdpStageRateLimit },
+		(*XDPPolicy).rateLimited},
+	{stageGeoIP, "geoip", func(o *xdpObjects) *ebpf.Program { return o.XdpStageGeoip },
+		func(p *XDPPolicy) bool { return p.HardBlocking == 1 || (p.attackModeEnabled() && p.AttackHardGeo == 1) }},
+	{stageAccount, "account", func(o *xdpObjects) *ebpf.Program { return o.XdpStageAccount }, alwaysStage},
+}
+
+// linkPipeline makes xdp_stages match policy p: enabled stages are linked,
+// disabled ones are unlinked. Called with every published policy.
+func linkPipeline(objs *xdpObjects, p *XDPPolicy) error {
+	var errs []error
+	for _, stage := range pipelineStages {
+		var prog *ebpf.Program
+		if stage.enabled(p) {
+			prog = stage.prog(objs)
+		}
+		if err := setPipelineStage(objs, stage.slot, prog); err != nil {
+			errs = append(errs, fmt.Errorf("stage %s: %w", stage.name, err))
+		}
+	}
+	return errors.Join(errs...)
+}
+
+// setPipelineStage links prog into slot, or unlinks the slot if prog is nil.
+// The swap is atomic for packets: each one sees either the old or new stage.
+func setPipelineStage(objs *xdpObjects, slot uint32, prog *ebpf.Program) error {
+	if prog == nil {
+		if err := objs.XdpStages.Delete(slot); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			return err
+		}
+		return nil
+	}
+	return objs.XdpStages.Put(slot, prog)
+}
@@ -0,0 +1,180 @@
+//go:build linux
+
+package services
+
+import (
+	"fmt"
+	"sort"
+	"strings"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+)
+
+// Per-port policy (v2.1)
+// port_policy holds one byte per destination port: the PORT_* action in the
+// low nibble and a rate-limit class in the high nibble. It replaces the
+// hard-coded WireGuard/management bypasses. Game ports come from the
+// service ports, everything else from models.PortRule. Rules with the same
+// PPS limit share a class; each class is a per-source token bucket.
+
+// Port actions and encoding, match PORT_* in xdp_filter.c
+const (
+	portFilter = 0
+	portBypass = 1
+	portGame   = 2
+	portDrop   = 3
+	portTunnel = 4
+
+	portSynProxy   = 0x08 // Flag on TCP service ports while the SYN proxy is on
+	portClassShift = 4
+	portClasses    = 8
+)
+
+// portKeys are the port_policy indices, shared by every sync
+var portKeys = func() []uint32 {
+	keys := make([]uint32, 65536)
+	for i := range keys {
+		keys[i] = uint32(i)
+	}
+	return keys
+}()
+
+// portActionFromString maps a PortRule action to PORT_*
+func portActionFromString(action string) (uint8, bool) {
+	switch action {
+	case "filter":
+		return portFilter, true
+	case "bypass":
+		return portBypass, true
+	case "drop":
+		return portDrop, true
+	case "tunnel":
+		return portTunnel, true
+	}
+	return 0, false
+}
+
+// compilePortPolicy builds the port_policy table. Explicit rules override
+// game ports, and narrower rules override wider ones. With synProxy set, TCP
+// service ports keep the PORT_SYNPROXY flag whatever their action.
+func compilePortPolicy(rules []models.PortRule, servicePorts []models.ServicePort, synProxy bool) ([]uint8, [portClasses]uint32, bool) {
+	table := make([]uint8, 65536)
+	var classPPS [portClasses]uint32
+
+	gamePorts := false
+	for _, sp := range servicePorts {
+		end := max(sp.PublicPortEnd, sp.PublicPort)
+		for port := sp.PublicPort; port <= end && port < 65536; port++ {
+			if port > 0 {
+				table[port] = portGame
+				gamePorts = true
+			}
+		}
+	}
+
+	sort.SliceStable(rules, func(i, j int) bool {
+		return max(rules[i].PortEnd-rules[i].Port, 0) > max(rules[j].PortEnd-rules[j].Port, 0)
+	})
+	classes := map[int]uint8{}
+	for _, rule := range rules {
+		action, ok := portActionFromString(rule.Action)
+		if !ok || rule.Port < 1 || rule.Port > 65535 {
+			system.Warn("Port rule %d (%s): invalid, skipped", rule.Port, rule.Action)
+			continue
+		}
+
+		class := uint8(0)
+		if rule.PPSLimit > 0 {
+			c, seen := classes[rule.PPSLimit]
+			if !seen && len(classes) < portClasses-1 {
+				c = uint8(len(classes) + 1)
+				classes[rule.PPSLimit] = c
+				classPPS[c] = uint32(rule.PPSLimit)
+				seen = true
+			}
+			if seen {
+				class = c
+			} else {
+				system.Warn("Port rule %d: more than %d distinct PPS limits, left unlimited", rule.Port, portClasses-1)
+			}
+		}
+
+		end := max(rule.PortEnd, rule.Port)
+		for port := rule.Port; port <= end && port < 65536; port++ {
+			table[port] = action | class<<portClassShift
+		}
+	}
+
+	if synProxy {
+		for _, sp := range servicePorts {
+			if strings.ToLower(sp.Protocol) != "tcp" {
+				continue
+			}
+			end := max(sp.PublicPortEnd, sp.PublicPort)
+			for port := max(sp.PublicPort, 1); port <= end && port < 65536; port++ {
+				table[port] |= portSynProxy
+			}
+		}
+	}
+	return table, classPPS, gamePorts
+}
+
+// SyncAllowedPorts writes the port rules and game ports to port_policy
+func (e *EBPFService) SyncAllowedPorts() error {
+	// No e.mu here: called from loadEBPFProgram under e.mu, like UpdateAllowIPs
+	if e.objs == nil || e.db == nil {
+		return nil
+	}
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		return nil
+	}
+
+	var rules []models.PortRule
+	if err := e.db.Find(&rules).Error; err != nil {
+		return fmt.Errorf("loading port rules: %w", err)
+	}
+	var servicePorts []models.ServicePort
+	if err := e.db.Find(&servicePorts).Error; err != nil {
+		return fmt.Errorf("loading service ports: %w", err)
+	}
+	e.policyMu.Lock()
+	synProxy := e.policy.SynProxy == 1
+	e.policyMu.Unlock()
+	table, classPPS, gamePorts := compilePortPolicy(rules, servicePorts, synProxy)
+
+	e.portMu.Lock()
+	defer e.portMu.Unlock()
+
+	// Only rewrite the ports that changed since the last sync to these maps
+	var keys []uint32
+	var values []uint8
+	if e.portObjs == objs && e.portTable != nil {
+		for port, v := range table {
+			if e.portTable[port] != v {
+				keys = append(keys, uint32(port))
+				values = append(values, v)
+			}
+		}
+	} else {
+		keys, values = portKeys, table
+	}
+	if n, err := batchPut(objs.PortPolicy, keys, values); err != nil {
+		// Force a full rewrite next time
+		e.portObjs = nil
+		return fmt.Errorf("writing port_policy (%d of %d ports): %w", n, len(keys), err)
+	}
+	e.portTable = table
+	e.portObjs = objs
+
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) {
+		p.GamePorts = boolToU32(gamePorts)
+		p.PortClassPPS = classPPS
+	}); err != nil {
+		return fmt.Errorf("publishing XDP policy: %w", err)
+	}
+
+	system.Info("XDP port policy synced: %d rules, %d ports updated, game ports=%v", len(rules), len(keys), gamePorts)
+	return nil
+}
@@ -0,0 +1,260 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"net"
+	"os"
+	"path/filepath"
+	"slices"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// Hot reload (v2.1)
+// Stateful maps (rate limiters, auto-blocks, conntrack, stats) are pinned
+// by name, so a new program picks them up instead of starting empty; maps
+// whose layout changed are dropped and start fresh. With xdp_keep_on_exit,
+// shutdown also pins the XDP and TCX links instead of detaching, and the
+// next start swaps its program into them with a link update. The old
+// program keeps filtering until then, so an upgrade has no unprotected gap.
+// ReloadProgram does the same within one process with the links it holds,
+// without pinning anything.
+
+const (
+	xdpLinkPinPrefix = "xdp_link_"
+	tcLinkPinPrefix  = "tc_link_"
+)
+
+// loadSavedSettings returns the saved security settings, or nil
+func (e *EBPFService) loadSavedSettings() *models.SecuritySettings {
+	if e.db == nil {
+		return nil
+	}
+	var settings models.SecuritySettings
+	if err := e.db.First(&settings, 1).Error; err != nil {
+		return nil
+	}
+	return &settings
+}
+
+// dropIncompatiblePins unpins every pinned map whose type, key, value or
+// size no longer matches spec, so it is recreated empty
+func (e *EBPFService) dropIncompatiblePins(spec *ebpf.CollectionSpec) {
+	for name, ms := range spec.Maps {
+		if ms.Pinning != ebpf.PinByName {
+			continue
+		}
+		pin := filepath.Join(e.bpfPinPath, name)
+		m, err := ebpf.LoadPinnedMap(pin, nil)
+		if err != nil {
+			if !errors.Is(err, os.ErrNotExist) {
+				system.Warn("Failed to open pinned map %s, recreating it: %v", name, err)
+				os.Remove(pin)
+			}
+			continue
+		}
+		compatible := m.Type() == ms.Type && m.KeySize() == ms.KeySize &&
+			m.ValueSize() == ms.ValueSize && m.MaxEntries() == ms.MaxEntries && m.Flags() == ms.Flags
+		m.Close()
+		if !compatible {
+			system.Warn("Pinned map %s changed layout, starting it empty", name)
+			os.Remove(pin)
+		}
+	}
+}
+
+// removeMapPins unpins every map of spec that is pinned by name
+func (e *EBPFService) removeMapPins(spec *ebpf.CollectionSpec) {
+	for name, ms := range spec.Maps {
+		if ms.Pinning == ebpf.PinByName {
+			os.Remove(filepath.Join(e.bpfPinPath, name))
+		}
+	}
+}
+
+// migrateManualHosts moves manual /32 blocks that an older version kept in
+// the pinned blocked_hosts LRU into manual_hosts, where they are safe from
+// eviction
+func (e *EBPFService) migrateManualHosts(objs *xdpObjects) {
+	var (
+		key    [4]byte
+		value  BlockEntry
+		keys   [][4]byte
+		values []BlockEntry
+	)
+	iter := objs.BlockedHosts.Iterate()
+	for iter.Next(&key, &value) {
+		if value.Reason == 1 { // manual
+			keys = append(keys, key)
+			values = append(values, value)
+		}
+	}
+	if err := iter.Err(); err != nil {
+		system.Warn("Failed to scan blocked_hosts for manual blocks: %v", err)
+	}
+	if len(keys) == 0 {
+		return
+	}
+
+	n, err := batchPut(objs.ManualHosts, keys, values)
+	if err != nil {
+		system.Warn("Failed to move %d manual blocks out of blocked_hosts: %v", len(keys)-n, err)
+	}
+	// Only what made it into manual_hosts leaves the LRU
+	if _, err := batchDelete(objs.BlockedHosts, keys[:n]); err != nil {
+		system.Warn("Failed to remove migrated manual blocks from blocked_hosts: %v", err)
+	}
+	system.Info("Moved %d manual host blocks to manual_hosts", n)
+}
+
+func (e *EBPFService) xdpLinkPin(iface, mode string) string {
+	return filepath.Join(e.bpfPinPath, xdpLinkPinPrefix+iface+"_"+mode)
+}
+
+func (e *EBPFService) tcLinkPin(iface string) string {
+	return filepath.Join(e.bpfPinPath, tcLinkPinPrefix+iface)
+}
+
+// pinnedXDPLink opens the link a previous process left pinned on iface. The
+// pin stays until attachXDP has swapped the new program in, so the old
+// program survives a failed start. A link in a mode the current setting
+// would not pick is detached instead.
+func (e *EBPFService) pinnedXDPLink(iface *net.Interface) (xdpLink, bool) {
+	for _, mode := range []string{xdpModeNative, xdpModeGeneric} {
+		pin := e.xdpLinkPin(iface.Name, mode)
+		l, err := link.LoadPinnedLink(pin, nil)
+		if err != nil {
+			if !errors.Is(err, os.ErrNotExist) {
+				system.Warn("Failed to open pinned XDP link %s: %v", pin, err)
+				os.Remove(pin)
+			}
+			continue
+		}
+		if !slices.Contains(xdpModeChain(e.attachMode), mode) {
+			l.Unpin()
+			l.Close()
+			continue
+		}
+		return xdpLink{name: iface.Name, ifindex: iface.Index, mode: mode, link: l, pinned: true}, true
+	}
+	return xdpLink{}, false
+}
+
+// adoptTCXLink does the same for a pinned TCX egress link
+func (e *EBPFService) adoptTCXLink(prog *ebpf.Program, iface string) (link.Link, bool) {
+	l, err := link.LoadPinnedLink(e.tcLinkPin(iface), nil)
+	if err != nil {
+		return nil, false
+	}
+	l.Unpin()
+	if err := l.Update(prog); err != nil {
+		system.Warn("Failed to replace TC egress program on %s in place: %v", iface, err)
+		l.Close()
+		return nil, false
+	}
+	return l, true
+}
+
+// releaseStaleLinks detaches links a previous process pinned on interfaces
+// this one no longer uses
+func (e *EBPFService) releaseStaleLinks() {
+	for _, prefix := range []string{xdpLinkPinPrefix, tcLinkPinPrefix} {
+		pins, _ := filepath.Glob(filepath.Join(e.bpfPinPath, prefix+"*"))
+		for _, pin := range pins {
+			if l, err := link.LoadPinnedLink(pin, nil); err == nil {
+				l.Unpin()
+				l.Close()
+				system.Info("Detached stale link %s", filepath.Base(pin))
+			} else {
+				os.Remove(pin)
+			}
+		}
+	}
+}
+
+// pinLinks pins every XDP and TCX link so they outlive the process. XDP
+// links are all or nothing: if one cannot be pinned, none stay pinned.
+func (e *EBPFService) pinLinks() bool {
+	for i, l := range e.xdpLinks {
+		if err := l.link.Pin(e.xdpLinkPin(l.name, l.mode)); err != nil {
+			system.Warn("Failed to pin XDP link on %s, detaching instead: %v", l.name, err)
+			for _, pinned := range e.xdpLinks[:i] {
+				pinned.link.Unpin()
+			}
+			return false
+		}
+	}
+	// An unpinned TCX link only costs egress tracking until the next start
+	for iface, l := range e.tcLinks {
+		if err := l.Pin(e.tcLinkPin(iface)); err != nil {
+			system.Warn("Failed to pin TC egress link on %s: %v", iface, err)
+		}
+	}
+	return true
+}
+
+// Shutdown stops eBPF monitoring for process exit. Pinned maps are kept, so
+// the next start resumes with the same state. The programs are detached as
+// in Disable, unless xdp_keep_on_exit is set: then they stay attached for
+// the next start to replace in place.
+func (e *EBPFService) Shutdown() {
+	e.mu.Lock()
+	defer e.mu.Unlock()
+
+	if !e.isRunning {
+		return
+	}
+	e.enabled = false
+	e.isRunning = false
+	close(e.stopChan)
+
+	if e.keepOnExit.Load() && e.pinLinks() {
+		e.releaseLinks()
+		system.Info("eBPF XDP program left attached for the next start")
+	} else {
+		e.detachLinks()
+	}
+	e.closeObjects()
+}
+
+// releaseLinks closes the link handles after pinLinks. Closing pinned links
+// leaves the programs attached. Legacy tc filters are replaced by the next
+// start, so they stay too.
+func (e *EBPFService) releaseLinks() {
+	closeXDPLinks(e.xdpLinks)
+	for _, l := range e.tcLinks {
+		l.Close()
+	}
+	e.xdpLinks, e.tcLinks, e.tcLegacyIfaces = nil, nil, nil
+}
+
+// ReloadProgram loads a fresh program and swaps it into the attached links
+// in place, so load-time settings such as reflection_ports take effect
+// without a filtering gap. The links are held across the reload and never
+// pinned. If loading fails, the links keep the old program attached and the
+// change waits for a restart.
+func (e *EBPFService) ReloadProgram() error {
+	e.mu.Lock()
+	defer e.mu.Unlock()
+
+	if !e.isRunning {
+		return nil
+	}
+	e.isRunning = false
+	close(e.stopChan)
+	// Closing the objects leaves the program attached through its links
+	e.closeObjects()
+
+	if err := e.start(); err != nil {
+		system.Error("eBPF program reload failed, the previous program stays attached until restart: %v", err)
+		return err
+	}
+	system.Info("eBPF XDP program reloaded in place")
+	return nil
+}
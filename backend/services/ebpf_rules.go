@@ -0,0 +1,257 @@
+//go:build linux
+
+package services
+
+import (
+	"encoding/binary"
+	"fmt"
+	"sort"
+	"time"
+
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+)
+
+// Unified policy trie (v2.1)
+// Whitelist, blacklist and GeoIP prefixes are compiled into one LPM trie
+// (policy_rules) so XDP resolves all three with a single walk. Each node's
+// value is the union of the flags of every prefix covering it, which makes
+// the longest match sufficient. white_list/blocked_ips are still written as
+// before and remain the fallback when the policy trie is off or unpublished.
+
+// Policy rule flags, match RULE_* in xdp_filter.c
+const (
+	ruleAllow     = 1
+	ruleBlock     = 2
+	ruleGeo       = 4
+	ruleGeoLoaded = 8
+)
+
+// PolicyRule matches the C struct policy_rule
+type PolicyRule struct {
+	Flags     uint32
+	_         uint32 // padding
+	ExpiresAt uint64
+}
+
+// policyPrefix is one compiled rule before it is written to the trie
+type policyPrefix struct {
+	key   LpmKey
+	start uint32 // network address in host byte order
+	end   uint32
+	rule  PolicyRule
+}
+
+// recordAllowRules remembers whitelist prefixes for the policy trie
+func (e *EBPFService) recordAllowRules(keys []LpmKey) {
+	e.ruleMu.Lock()
+	defer e.ruleMu.Unlock()
+	for _, key := range keys {
+		e.allowRules[key] = struct{}{}
+	}
+}
+
+// recordBlockRules remembers blacklist prefixes for the policy trie and
+// returns how many are recorded. /32 blocks live in manual_hosts, which XDP
+// checks in both modes, so they are not part of the trie.
+func (e *EBPFService) recordBlockRules(keys []LpmKey, values []BlockEntry) int {
+	e.ruleMu.Lock()
+	defer e.ruleMu.Unlock()
+	for i, key := range keys {
+		if key.PrefixLen < 32 {
+			e.blockRules[key] = values[i]
+		}
+	}
+	return len(e.blockRules)
+}
+
+// refreshPolicyTrie recompiles policy_rules if the policy trie is enabled
+func (e *EBPFService) refreshPolicyTrie(objs *xdpObjects) {
+	e.geoMu.Lock()
+	geoRanges := e.policyGeoRangesLocked()
+	e.geoMu.Unlock()
+
+	if err := e.rebuildPolicyTrie(objs, geoRanges); err != nil {
+		system.Warn("Failed to rebuild policy trie: %v", err)
+	}
+}
+
+// policyGeoRangesLocked returns the GeoIP ranges to compile into the policy
+// trie: the merged ranges in trie mode once GeoIP is loaded, nil otherwise
+// (the bitmap engine keeps answering GeoIP on its own). Caller holds geoMu.
+func (e *EBPFService) policyGeoRangesLocked() []IPv4Range {
+	if e.geoIPService == nil || e.geoFingerprint == 0 || geoEngineFromString(e.geoEngine) != geoEngineTrie {
+		return nil
+	}
+	return e.geoIPService.GetMergedCIDRRanges()
+}
+
+// rebuildPolicyTrie compiles the recorded rule sets plus geoRanges into a
+// fresh inner trie and swaps it into policy_rules
+func (e *EBPFService) rebuildPolicyTrie(objs *xdpObjects, geoRanges []IPv4Range) error {
+	e.policyMu.Lock()
+	enabled := e.policy.PolicyTrie == 1
+	e.policyMu.Unlock()
+
+	e.ruleMu.Lock()
+	defer e.ruleMu.Unlock()
+
+	if !enabled {
+		e.retirePolicyTrieLocked(objs)
+		return nil
+	}
+	if e.ruleInnerSpec == nil {
+		return nil
+	}
+
+	start := time.Now()
+	now := uint64(time.Since(e.bootTime).Nanoseconds())
+	prefixes, geoIncluded := compilePolicyRules(e.allowRules, e.blockRules, geoRanges, now, int(e.ruleInnerSpec.MaxEntries))
+
+	keys := make([]LpmKey, len(prefixes))
+	values := make([]PolicyRule, len(prefixes))
+	for i, p := range prefixes {
+		keys[i] = p.key
+		values[i] = p.rule
+	}
+
+	inner, err := ebpf.NewMap(e.ruleInnerSpec)
+	if err != nil {
+		return fmt.Errorf("creating policy_rules inner trie: %w", err)
+	}
+	// A partial trie would both miss blocks and fail GeoIP lookups, so it is all or nothing
+	if n, err := batchPut(inner, keys, values); err != nil || n != len(keys) {
+		inner.Close()
+		return fmt.Errorf("filling policy_rules (%d of %d prefixes): %w", n, len(keys), err)
+	}
+	if err := objs.PolicyRules.Put(uint32(0), inner); err != nil {
+		inner.Close()
+		return fmt.Errorf("swapping policy_rules inner trie: %w", err)
+	}
+	if e.ruleInner != nil {
+		e.ruleInner.Close()
+	}
+	e.ruleInner = inner
+
+	system.Info("Policy trie compiled: %d prefixes (geoip=%v) in %s",
+		len(keys), geoIncluded, time.Since(start).Round(time.Millisecond))
+	return nil
+}
+
+// retirePolicyTrieLocked unpublishes policy_rules so XDP falls back to the
+// separate tries. Caller holds ruleMu.
+func (e *EBPFService) retirePolicyTrieLocked(objs *xdpObjects) {
+	if e.ruleInner == nil {
+		return
+	}
+	if err := objs.PolicyRules.Delete(uint32(0)); err != nil {
+		system.Warn("Failed to retire policy_rules: %v", err)
+	}
+	e.ruleInner.Close()
+	e.ruleInner = nil
+}
+
+// closePolicyTrie releases our handle on the inner trie after the outer
+// map has gone away with the program objects
+func (e *EBPFService) closePolicyTrie() {
+	e.ruleMu.Lock()
+	defer e.ruleMu.Unlock()
+	if e.ruleInner != nil {
+		e.ruleInner.Close()
+		e.ruleInner = nil
+	}
+}
+
+// laterExpiry returns the later of two block expiries, 0 meaning permanent
+func laterExpiry(a, b uint64) uint64 {
+	if a == 0 || b == 0 {
+		return 0
+	}
+	return max(a, b)
+}
+
+// compilePolicyRules merges the rule sets into trie entries with inherited
+// flags. GeoIP is only included if everything fits within limit; otherwise
+// XDP keeps using the GeoIP maps. Block entries already expired at now are
+// dropped.
+func compilePolicyRules(allow map[LpmKey]struct{}, block map[LpmKey]BlockEntry, geoRanges []IPv4Range, now uint64, limit int) ([]policyPrefix, bool) {
+	own := make(map[LpmKey]PolicyRule, len(allow)+len(block))
+	for key := range allow {
+		r := own[key]
+		r.Flags |= ruleAllow
+		own[key] = r
+	}
+	for key, entry := range block {
+		if entry.ExpiresAt > 0 && entry.ExpiresAt <= now {
+			continue
+		}
+		r := own[key]
+		r.Flags |= ruleBlock
+		r.ExpiresAt = entry.ExpiresAt
+		own[key] = r
+	}
+
+	geoKeys := buildGeoTrieKeys(geoRanges, limit)
+	geoIncluded := len(geoKeys) > 0 && len(own)+len(geoKeys)+1 <= limit
+	if geoIncluded {
+		for _, key := range geoKeys {
+			r := own[key]
+			r.Flags |= ruleGeo
+			own[key] = r
+		}
+	} else if len(geoRanges) > 0 {
+		system.Warn("Policy trie limit reached, GeoIP stays in the separate GeoIP maps")
+	}
+
+	// Root entry: every lookup hits, and it says whether GeoIP is compiled in
+	root := own[LpmKey{}]
+	if geoIncluded {
+		root.Flags |= ruleGeoLoaded
+	}
+	own[LpmKey{}] = root
+
+	prefixes := make([]policyPrefix, 0, len(own))
+	for key, rule := range own {
+		if key.PrefixLen > 32 {
+			continue
+		}
+		start := binary.BigEndian.Uint32(key.Data[:]) & ^(uint32(0xFFFFFFFF) >> key.PrefixLen)
+		binary.BigEndian.PutUint32(key.Data[:], start)
+		prefixes = append(prefixes, policyPrefix{
+			key:   key,
+			start: start,
+			end:   start | uint32(0xFFFFFFFF)>>key.PrefixLen,
+			rule:  rule,
+		})
+	}
+
+	// Sweep in address order, shortest prefix first, keeping the chain of
+	// covering prefixes on a stack so each entry inherits their flags
+	sort.Slice(prefixes, func(i, j int) bool {
+		if prefixes[i].start != prefixes[j].start {
+			return prefixes[i].start < prefixes[j].start
+		}
+		return prefixes[i].key.PrefixLen < prefixes[j].key.PrefixLen
+	})
+	var stack []int
+	for i := range prefixes {
+		p := &prefixes[i]
+		for len(stack) > 0 && prefixes[stack[len(stack)-1]].end < p.start {
+			stack = stack[:len(stack)-1]
+		}
+		if len(stack) > 0 {
+			parent := prefixes[stack[len(stack)-1]].rule
+			if parent.Flags&ruleBlock != 0 {
+				if p.rule.Flags&ruleBlock != 0 {
+					p.rule.ExpiresAt = laterExpiry(p.rule.ExpiresAt, parent.ExpiresAt)
+				} else {
+					p.rule.ExpiresAt = parent.ExpiresAt
+				}
+			}
+			p.rule.Flags |= parent.Flags
+		}
+		stack = append(stack, i)
+	}
+	return prefixes, geoIncluded
+}
@@ -0,0 +1,346 @@
+//go:build linux
+
+package services
+
+import (
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"sort"
+	"strings"
+	"time"
+
+	"kg-proxy-web-gui/backend/models"
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+	"gorm.io/gorm"
+)
+
+// In-kernel attack signatures (v2.1)
+// Enabled models.AttackSignature rows are compiled into sig_rules so XDP
+// applies their action in the fast path. Each signature gets a slot that
+// indexes its per-CPU PPS bucket (sig_buckets) and hit counter (sig_hits);
+// the hit counters are folded back into HitCount/LastHit periodically.
+
+// Signature limits and encodings, match SIG_* in xdp_filter.c
+const (
+	sigSlots      = 64
+	sigSetMax     = 4
+	sigPayloadMax = 16
+
+	sigActionLog       = 0
+	sigActionRateLimit = 1
+	sigActionBlock     = 2
+
+	sigShapeBoth = 1
+	sigShapeSrc  = 2
+	sigShapeDst  = 4
+	sigShapeAny  = 8
+)
+
+// SigKey matches the C struct sig_key
+type SigKey struct {
+	SrcPort  uint16
+	DstPort  uint16
+	Protocol uint8
+	_        [3]uint8 // padding
+}
+
+// SigRule matches the C struct sig_rule
+type SigRule struct {
+	Slot       uint16
+	Action     uint8
+	PayloadLen uint8
+	Payload    [sigPayloadMax]byte
+}
+
+// SigSet matches the C struct sig_set
+type SigSet struct {
+	Count uint32
+	_     uint32 // padding
+	Rules [sigSetMax]SigRule
+}
+
+// SigBucket matches the C struct sig_bucket
+type SigBucket struct {
+	Tokens     uint64
+	LastUpdate uint64
+	Rate       uint32
+	_          uint32 // padding
+}
+
+// compiledSignatures is the map content built from the signature table
+type compiledSignatures struct {
+	sets   map[SigKey]*SigSet
+	shapes uint32
+	ids    []uint // signature ID per slot
+	rates  []uint32
+}
+
+// sigProtocol maps the signature protocol name to its IP protocol number
+func sigProtocol(name string) (uint8, bool) {
+	switch strings.ToUpper(name) {
+	case "TCP":
+		return 6, true
+	case "UDP":
+		return 17, true
+	case "ICMP":
+		return 1, true
+	}
+	return 0, false
+}
+
+// sigAction maps the signature action name to SIG_ACTION_*
+func sigAction(name string) uint8 {
+	switch strings.ToLower(name) {
+	case "block":
+		return sigActionBlock
+	case "rate_limit":
+		return sigActionRateLimit
+	}
+	return sigActionLog
+}
+
+// sigShape returns the SIG_SHAPE_* a key is stored under
+func sigShape(key SigKey) uint32 {
+	switch {
+	case key.SrcPort != 0 && key.DstPort != 0:
+		return sigShapeBoth
+	case key.SrcPort != 0:
+		return sigShapeSrc
+	case key.DstPort != 0:
+		return sigShapeDst
+	}
+	return sigShapeAny
+}
+
+// compileSignatures turns enabled signatures into sig_rules entries. Rules
+// that cannot be expressed in-kernel are skipped with a warning. PPS limits
+// are split evenly across nCPU per-CPU buckets.
+func compileSignatures(sigs []models.AttackSignature, nCPU int) compiledSignatures {
+	type pending struct {
+		key  SigKey
+		rule SigRule
+	}
+
+	out := compiledSignatures{sets: make(map[SigKey]*SigSet)}
+	var rules []pending
+	for _, sig := range sigs {
+		proto, ok := sigProtocol(sig.Protocol)
+		if !ok {
+			system.Warn("Signature %q: protocol %q not supported in XDP, skipped", sig.Name, sig.Protocol)
+			continue
+		}
+		if sig.SrcPort < 0 || sig.SrcPort > 65535 || sig.DstPort < 0 || sig.DstPort > 65535 {
+			system.Warn("Signature %q: invalid port, skipped", sig.Name)
+			continue
+		}
+		payload, err := hex.DecodeString(strings.ReplaceAll(sig.Payload, " ", ""))
+		if err != nil || len(payload) > sigPayloadMax {
+			system.Warn("Signature %q: payload must be at most %d hex bytes, skipped", sig.Name, sigPayloadMax)
+			continue
+		}
+		if len(out.ids) == sigSlots {
+			system.Warn("Signature %q: more than %d signatures enabled, skipped", sig.Name, sigSlots)
+			continue
+		}
+
+		slot := len(out.ids)
+		rate := uint32(0)
+		action := sigAction(sig.Action)
+		if action == sigActionRateLimit && sig.PPSLimit > 0 {
+			rate = uint32((sig.PPSLimit + nCPU - 1) / nCPU)
+		}
+		out.ids = append(out.ids, sig.ID)
+		out.rates = append(out.rates, rate)
+
+		p := pending{
+			key:  SigKey{SrcPort: uint16(sig.SrcPort), DstPort: uint16(sig.DstPort), Protocol: proto},
+			rule: SigRule{Slot: uint16(slot), Action: action, PayloadLen: uint8(len(payload))},
+		}
+		copy(p.rule.Payload[:], payload)
+		rules = append(rules, p)
+	}
+
+	// Within a key the first match wins, so longer payload prefixes go first
+	sort.SliceStable(rules, func(i, j int) bool {
+		return rules[i].rule.PayloadLen > rules[j].rule.PayloadLen
+	})
+	for _, p := range rules {
+		set := out.sets[p.key]
+		if set == nil {
+			set = &SigSet{}
+			out.sets[p.key] = set
+		}
+		if set.Count == sigSetMax {
+			system.Warn("Signature slot %d: more than %d signatures share one port key, skipped", p.rule.Slot, sigSetMax)
+			continue
+		}
+		set.Rules[set.Count] = p.rule
+		set.Count++
+		out.shapes |= sigShape(p.key)
+	}
+	return out
+}
+
+// SyncSignatures recompiles the enabled attack signatures into XDP
+func (e *EBPFService) SyncSignatures() error {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+
+	if e.objs == nil || e.db == nil {
+		return nil
+	}
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok {
+		return nil
+	}
+
+	var sigs []models.AttackSignature
+	if err := e.db.Where("enabled = ?", true).Order("id").Find(&sigs).Error; err != nil {
+		return fmt.Errorf("loading signatures: %w", err)
+	}
+	nCPU, err := ebpf.PossibleCPU()
+	if err != nil {
+		return err
+	}
+	compiled := compileSignatures(sigs, nCPU)
+
+	e.sigMu.Lock()
+	defer e.sigMu.Unlock()
+
+	// Slots are about to be reassigned: bank the hits counted so far
+	e.flushSignatureHitsLocked(objs)
+
+	// Stop matching while the rule set is replaced
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.SignatureShapes = 0 }); err != nil {
+		return fmt.Errorf("publishing XDP policy: %w", err)
+	}
+
+	var stale []SigKey
+	var key SigKey
+	var set SigSet
+	iter := objs.SigRules.Iterate()
+	for iter.Next(&key, &set) {
+		stale = append(stale, key)
+	}
+	if _, err := batchDelete(objs.SigRules, stale); err != nil {
+		return fmt.Errorf("clearing sig_rules: %w", err)
+	}
+
+	zeroHits := make([]uint64, nCPU)
+	buckets := make([]SigBucket, nCPU)
+	for slot := 0; slot < sigSlots; slot++ {
+		rate := uint32(0)
+		if slot < len(compiled.rates) {
+			rate = compiled.rates[slot]
+		}
+		for cpu := range buckets {
+			buckets[cpu] = SigBucket{Tokens: uint64(rate), Rate: rate}
+		}
+		if err := objs.SigBuckets.Put(uint32(slot), buckets); err != nil {
+			return fmt.Errorf("writing sig_buckets: %w", err)
+		}
+		if err := objs.SigHits.Put(uint32(slot), zeroHits); err != nil {
+			return fmt.Errorf("resetting sig_hits: %w", err)
+		}
+	}
+
+	keys := make([]SigKey, 0, len(compiled.sets))
+	values := make([]SigSet, 0, len(compiled.sets))
+	for k, s := range compiled.sets {
+		keys = append(keys, k)
+		values = append(values, *s)
+	}
+	if n, err := batchPut(objs.SigRules, keys, values); err != nil {
+		return fmt.Errorf("writing sig_rules (%d of %d keys): %w", n, len(keys), err)
+	}
+
+	e.sigSlotIDs = compiled.ids
+	e.sigLastHits = make([]uint64, len(compiled.ids))
+	if err := e.updatePolicy(objs, func(p *XDPPolicy) { p.SignatureShapes = compiled.shapes }); err != nil {
+		return fmt.Errorf("publishing XDP policy: %w", err)
+	}
+
+	system.Info("Attack signatures synced to XDP: %d rules under %d keys", len(compiled.ids), len(keys))
+	return nil
+}
+
+// syncSignatureHits adds the hits XDP counted since the last call to each
+// signature's HitCount
+func (e *EBPFService) syncSignatureHits() {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+
+	objs, ok := e.objs.(*xdpObjects)
+	if !ok || e.db == nil {
+		return
+	}
+	e.sigMu.Lock()
+	defer e.sigMu.Unlock()
+	e.flushSignatureHitsLocked(objs)
+}
+
+// flushSignatureHitsLocked reads sig_hits and writes the deltas to the DB.
+// Caller holds sigMu.
+func (e *EBPFService) flushSignatureHitsLocked(objs *xdpObjects) {
+	if len(e.sigSlotIDs) == 0 {
+		return
+	}
+
+	now := time.Now()
+	var perCPU []uint64
+	for slot, id := range e.sigSlotIDs {
+		if err := objs.SigHits.Lookup(uint32(slot), &perCPU); err != nil {
+			if !errors.Is(err, ebpf.ErrKeyNotExist) {
+				system.Warn("Failed to read sig_hits: %v", err)
+			}
+			return
+		}
+		var total uint64
+		for _, v := range perCPU {
+			total += v
+		}
+		if total <= e.sigLastHits[slot] {
+			continue
+		}
+		delta := total - e.sigLastHits[slot]
+		err := e.db.Model(&models.AttackSignature{}).Where("id = ?", id).Updates(map[string]interface{}{
+			"hit_count": gorm.Expr("hit_count + ?", delta),
+			"last_hit":  now,
+		}).Error
+		if err != nil {
+			system.Warn("Failed to update signature hit count: %v", err)
+			continue
+		}
+		e.sigLastHits[slot] = total
+	}
+}
+
+// reflectionPorts builds the reflection_ports bitmap from the enabled
+// builtin UDP reflection signatures, or from the seed list without a DB.
+// It is baked into the program at load time, so a change to one of those
+// signatures goes through ReloadProgram.
+func (e *EBPFService) reflectionPorts() [65536 / 64]uint64 {
+	sigs := models.SeedDefaultSignatures()
+	if e.db != nil {
+		var stored []models.AttackSignature
+		if err := e.db.Where("is_builtin = ? AND enabled = ?", true, true).Find(&stored).Error; err == nil {
+			sigs = stored
+		}
+	}
+
+	var bitmap [65536 / 64]uint64
+	var ports []int
+	for _, sig := range sigs {
+		if !sig.Enabled || sig.Category != "reflection" || strings.ToUpper(sig.Protocol) != "UDP" ||
+			sig.SrcPort <= 0 || sig.SrcPort > 65535 {
+			continue
+		}
+		bitmap[sig.SrcPort/64] |= 1 << (sig.SrcPort % 64)
+		ports = append(ports, sig.SrcPort)
+	}
+	system.Info("XDP reflection filter ports: %v", ports)
+	return bitmap
+}
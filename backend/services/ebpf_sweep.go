@@ -0,0 +1,144 @@
+//go:build linux
+
+package services
+
+import (
+	"errors"
+	"time"
+
+	"kg-proxy-web-gui/backend/system"
+
+	"github.com/cilium/ebpf"
+)
+
+// Block expiry sweep (v2.1)
+// XDP deletes an expired block when its source sends again. Sources that
+// never come back (spoofed floods) would hold their slots until LRU eviction
+// pushes out live blocks instead, so userspace sweeps the block maps: every
+// blockSweepInterval it reads the next blockSweepBatch entries of each map,
+// resuming where the previous run stopped, and deletes the expired ones. A
+// run visits at most one batch per map whatever the map size; a full pass
+// over a 300k-entry blocked_hosts takes about 75 runs.
+
+const (
+	blockSweepInterval = time.Second
+	blockSweepBatch    = 4096
+)
+
+// sweepCursor is where the sweep of one block map resumes
+type sweepCursor[K any] struct {
+	m       *ebpf.Map
+	batch   ebpf.MapBatchCursor
+	last    K    // NextKey fallback: resume after this key
+	hasLast bool // false = start from the first key
+	keys    []K
+	values  []BlockEntry
+	expired []K
+}
+
+// sweep visits up to blockSweepBatch entries of m from where the previous
+// call stopped, deletes the expired ones and returns how many it deleted
+func (c *sweepCursor[K]) sweep(name string, m *ebpf.Map, now uint64) int {
+	if m == nil {
+		return 0
+	}
+	if c.m != m {
+		// New program objects: start over
+		*c = sweepCursor[K]{
+			m:      m,
+			keys:   make([]K, blockSweepBatch),
+			values: make([]BlockEntry, blockSweepBatch),
+		}
+	}
+
+	n, err := c.read()
+	if err != nil {
+		system.Warn("Block sweep of %s failed: %v", name, err)
+	}
+	c.expired = c.expired[:0]
+	for i := 0; i < n; i++ {
+		if v := c.values[i]; v.ExpiresAt != 0 && now >= v.ExpiresAt {
+			c.expired = append(c.expired, c.keys[i])
+		} else {
+			// Resume the fallback walk after a key that stays in the map
+			c.last = c.keys[i]
+		}
+	}
+	if len(c.expired) == 0 {
+		return 0
+	}
+	deleted, err := batchDelete(m, c.expired)
+	if err != nil {
+		system.Warn("Failed to delete expired blocks from %s: %v", name, err)
+	}
+	return deleted
+}
+
+// read loads the next batch into keys/values, wrapping to the first key
+// after the end of the map
+func (c *sweepCursor[K]) read() (int, error) {
+	if batchAllowed(c.m) {
+		n, err := c.m.BatchLookup(&c.batch, c.keys, c.values, nil)
+		switch {
+		case err == nil:
+			return n, nil
+		case errors.Is(err, ebpf.ErrKeyNotExist):
+			c.batch = ebpf.MapBatchCursor{}
+			return n, nil
+		case n == 0 && isBatchUnsupported(err):
+			refuseBatch(c.m)
+		default:
+			c.batch = ebpf.MapBatchCursor{}
+			return n, err
+		}
+	}
+
+	// Per-key fallback: NextKey from the last key kept. If that key was
+	// deleted meanwhile the kernel restarts from the first key.
+	var prev interface{}
+	if c.hasLast {
+		prev = c.last
+	}
+	n := 0
+	for n < len(c.keys) {
+		if err := c.m.NextKey(prev, &c.keys[n]); err != nil {
+			c.hasLast = false
+			if errors.Is(err, ebpf.ErrKeyNotExist) {
+				return n, nil
+			}
+			return n, err
+		}
+		prev = c.keys[n]
+		if err := c.m.Lookup(c.keys[n], &c.values[n]); err != nil {
+			continue // deleted between the two calls
+		}
+		n++
+	}
+	c.hasLast = true
+	return n, nil
+}
+
+// startBlockSweepLoop sweeps expired blocks until the service stops
+func (e *EBPFService) startBlockSweepLoop(stop <-chan struct{}) {
+	ticker := time.NewTicker(blockSweepInterval)
+	defer ticker.Stop()
+
+	var hosts, manual sweepCursor[[4]byte]
+	var nets6 sweepCursor[[8]byte]
+	for {
+		select {
+		case <-stop:
+			return
+		case <-ticker.C:
+			e.mu.RLock()
+			if objs, ok := e.objs.(*xdpObjects); ok {
+				now := uint64(time.Since(e.bootTime).Nanoseconds())
+				swept := hosts.sweep("blocked_hosts", objs.BlockedHosts, now) +
+					manual.sweep("manual_hosts", objs.ManualHosts, now) +
+					nets6.sweep("blocked_nets6", objs.BlockedNets6, now)
+				e.blocksSwept.Add(uint64(swept))
+			}
+			e.mu.RUnlock()
+		}
+	}
+}
@@ -3,6 +3,7 @@
 package services
 
 import (
+	"kg-proxy-web-gui/backend/models"
 	"time"
 
 	"gorm.io/gorm"
@@ -18,26 +19,34 @@ func NewEBPFService() *EBPFService {
 	return &EBPFService{enabled: false}
 }
 
-func (e *EBPFService) SetGeoIPService(g *GeoIPService)                        {}
-func (e *EBPFService) SetDatabase(db *gorm.DB)                                {}
-func (e *EBPFService) Enable() error                                          { return nil }
-func (e *EBPFService) Disable()                                               {}
-func (e *EBPFService) IsEnabled() bool                                        { return false }
-func (e *EBPFService) GetTrafficData() []TrafficEntry                         { return nil }
-func (e *EBPFService) GetStats() DetailedTrafficStats                         { return DetailedTrafficStats{} }
-func (e *EBPFService) LookupBlockedIP(ip string) *BlockedIPInfo               { return nil }
-func (e *EBPFService) IterateBlockedIPs() ([]BlockedIPInfo, error)            { return nil, nil }
-func (e *EBPFService) AddBlockedIP(ip string, duration time.Duration) error   { return nil }
-func (e *EBPFService) RemoveBlockedIP(ip string) error                        { return nil }
-func (e *EBPFService) UpdateGeoIPData()                                       {}
-func (e *EBPFService) StartAutoResetLoop(db *gorm.DB)                         {}
-func (e *EBPFService) UpdateConfig(hardBlocking bool, rateLimitPPS int) error { return nil }
-func (e *EBPFService) GetPortStats() []PortStats                              { return nil }
-func (e *EBPFService) ResetTrafficStats() error                               { return nil }
-func (e *EBPFService) UpdateAllowIPs(ips []string) error                      { return nil }
-func (e *EBPFService) SyncWhitelist() error                                   { return nil }
-func (e *EBPFService) SyncAllowedPorts() error                                { return nil }
-func (e *EBPFService) UpdateMaintenanceMode(enabled bool) error               { return nil }
+func (e *EBPFService) SetGeoIPService(g *GeoIPService)                      {}
+func (e *EBPFService) SetDatabase(db *gorm.DB)                              {}
+func (e *EBPFService) Enable() error                                        { return nil }
+func (e *EBPFService) Disable()                                             {}
+func (e *EBPFService) Shutdown()                                            {}
+func (e *EBPFService) ReloadProgram() error                                 { return nil }
+func (e *EBPFService) IsEnabled() bool                                      { return false }
+func (e *EBPFService) GetTrafficData() []TrafficEntry                       { return nil }
+func (e *EBPFService) GetStats() DetailedTrafficStats                       { return DetailedTrafficStats{} }
+func (e *EBPFService) LookupBlockedIP(ip string) *BlockedIPInfo             { return nil }
+func (e *EBPFService) IterateBlockedIPs() ([]BlockedIPInfo, error)          { return nil, nil }
+func (e *EBPFService) AddBlockedIP(ip string, duration time.Duration) error { return nil }
+func (e *EBPFService) RemoveBlockedIP(ip string) error                      { return nil }
+func (e *EBPFService) UpdateGeoIPData()                                     {}
+func (e *EBPFService) StartAutoResetLoop(db *gorm.DB)                       {}
+func (e *EBPFService) UpdateConfig(settings *models.SecuritySettings) error { return nil }
+func (e *EBPFService) GetPortStats() []PortStats                            { return nil }
+func (e *EBPFService) ResetTrafficStats() error                             { return nil }
+func (e *EBPFService) UpdateAllowIPs(ips []string) error                    { return nil }
+func (e *EBPFService) SyncWhitelist() error                                 { return nil }
+func (e *EBPFService) SyncAllowedPorts() error                              { return nil }
+func (e *EBPFService) SyncSignatures() error                                { return nil }
+func (e *EBPFService) UpdateMaintenanceMode(enabled bool) error             { return nil }
+func (e *EBPFService) CaptureInterface() string                             { return "" }
+func (e *EBPFService) StopXDPCapture()                                      {}
+func (e *EBPFService) StartXDPCapture(fds map[uint32]int, filter XDPCaptureFilter) error {
+	return nil
+}
 
 // PortStats dummy struct for method signature
 type PortStats struct {
@@ -104,6 +104,16 @@ func (s *FirewallService) ApplyRules() error {
 		system.Warn("Failed to apply kernel hardening: %v", err)
 	}
 
+	// SYNPROXY only sees the XDP cookie ACK as INVALID if conntrack does not
+	// pick up TCP flows mid-stream
+	tcpLoose := "1"
+	if settings.XDPSynProxy {
+		tcpLoose = "0"
+	}
+	if _, err := s.Executor.Execute("sysctl", "-w", "net.netfilter.nf_conntrack_tcp_loose="+tcpLoose); err != nil {
+		system.Warn("Failed to set nf_conntrack_tcp_loose: %v", err)
+	}
+
 	// 2. Generate ipset.rules
 	ipsetRules, err := s.generateIPSetRules(&settings)
 	if err != nil {
@@ -291,6 +301,13 @@ func (s *FirewallService) generateIPTablesRules(settings *models.SecuritySetting
 	sb.WriteString(":DDOS_PRE - [0:0]\n")
 	sb.WriteString(":GEO_GUARD - [0:0]\n")
 
+	// XDP SYN proxy: cookie ACKs have no conntrack entry yet. They skip the
+	// INVALID drops below but still pass GEO_GUARD on their way to SYNPROXY.
+	for _, dport := range synProxyPorts(settings, services) {
+		sb.WriteString(fmt.Sprintf("-A PREROUTING -p tcp --dport %s -m conntrack --ctstate INVALID,UNTRACKED -j GEO_GUARD\n", dport))
+		sb.WriteString(fmt.Sprintf("-A PREROUTING -p tcp --dport %s -m conntrack --ctstate INVALID,UNTRACKED -j ACCEPT\n", dport))
+	}
+
 	if settings.GlobalProtection {
 		// 0. Unconditional Bypass for WireGuard (Internal & External)
 		// Allow all traffic from WireGuard interfaces (VPN internal traffic)
@@ -489,6 +506,11 @@ func (s *FirewallService) generateIPTablesRules(settings *models.SecuritySetting
 			// DNAT Rule
 			// -p udp --dport 2302 -j DNAT --to-destination 10.200.0.2:2302
 			sb.WriteString(fmt.Sprintf("-A PREROUTING -p %s --dport %s -j DNAT --to-destination %s\n", protocol, dport, toDest))
+
+			// SYNPROXY opens the origin connection from the local stack
+			if protocol == "tcp" && settings.XDPSynProxy {
+				sb.WriteString(fmt.Sprintf("-A OUTPUT -p tcp -m addrtype --dst-type LOCAL --dport %s -j DNAT --to-destination %s\n", dport, toDest))
+			}
 		}
 	}
 
@@ -512,6 +534,13 @@ func (s *FirewallService) generateIPTablesRules(settings *models.SecuritySetting
 	// Allow established connections (INPUT)
 	sb.WriteString("-A INPUT -m conntrack --ctstate ESTABLISHED,RELATED -j ACCEPT\n")
 
+	// XDP SYN proxy: SYNPROXY checks the cookie in the client's ACK and
+	// completes the handshake with the origin (MSS matches SYN_PROXY_MSS)
+	for _, dport := range synProxyPorts(settings, services) {
+		sb.WriteString(fmt.Sprintf("-A INPUT -p tcp --dport %s -m conntrack --ctstate INVALID,UNTRACKED -j SYNPROXY --sack-perm --timestamp --wscale 7 --mss 1360\n", dport))
+		sb.WriteString(fmt.Sprintf("-A INPUT -p tcp --dport %s -m conntrack --ctstate INVALID -j DROP\n", dport))
+	}
+
 	// CRITICAL: Allow all outbound traffic from server (OUTPUT chain)
 	// This is essential for:
 	// - Discord webhook notifications (HTTPS to discord.com)
@@ -592,6 +621,12 @@ func (s *FirewallService) generateRawTableRules(settings *models.SecuritySetting
 	sb.WriteString("-A PREROUTING -p udp --dport 51820 -j CT --notrack\n")
 	sb.WriteString("-A OUTPUT -p udp --sport 51820 -j CT --notrack\n")
 
+	// 2. XDP SYN proxy: SYNs that still reach netfilter (XDP not loaded) go
+	// to SYNPROXY untracked
+	for _, dport := range synProxyPorts(settings, services) {
+		sb.WriteString(fmt.Sprintf("-A PREROUTING -p tcp --dport %s --syn -j CT --notrack\n", dport))
+	}
+
 	// NOTE: We do NOT apply NOTRACK to Game Ports because they require NAT (Port Forwarding).
 	// NAT relies on Conntrack. If we NOTRACK them, players cannot connect.
 	// Instead, we rely on aggressive UDP timeouts in hardening.go to clear the table quickly.
@@ -599,3 +634,25 @@ func (s *FirewallService) generateRawTableRules(settings *models.SecuritySetting
 	sb.WriteString("COMMIT\n")
 	return sb.String(), nil
 }
+
+// synProxyPorts returns the --dport values of the TCP service ports the XDP
+// SYN proxy answers for, or nil while it is off
+func synProxyPorts(settings *models.SecuritySettings, services []models.Service) []string {
+	if !settings.XDPSynProxy {
+		return nil
+	}
+	var dports []string
+	for _, svc := range services {
+		for _, port := range svc.Ports {
+			if strings.ToLower(port.Protocol) != "tcp" {
+				continue
+			}
+			if port.PublicPortEnd > port.PublicPort {
+				dports = append(dports, fmt.Sprintf("%d:%d", port.PublicPort, port.PublicPortEnd))
+			} else {
+				dports = append(dports, fmt.Sprintf("%d", port.PublicPort))
+			}
+		}
+	}
+	return dports
+}
@@ -3,13 +3,16 @@ package services
 import (
 	"archive/tar"
 	"compress/gzip"
+	"encoding/binary"
 	"encoding/json"
 	"fmt"
 	"io"
+	"math/bits"
 	"net"
 	"net/http"
 	"os"
 	"path/filepath"
+	"sort"
 	"strings"
 	"sync"
 	"time"
@@ -21,14 +24,16 @@ import (
 
 // GeoIPService provides IP geolocation using MaxMind GeoLite2
 type GeoIPService struct {
-	dbPath       string
-	db           *geoip2.Reader
-	vpnRanges    []net.IPNet
-	torExitNodes []net.IP
-	countryCIDRs map[string][]string // country code -> CIDR strings
-	mu           sync.RWMutex
-	lastUpdate   time.Time
-	licenseKey   string
+	dbPath        string
+	db            *geoip2.Reader
+	vpnRanges     []net.IPNet
+	torExitNodes  []net.IP
+	countryCIDRs  map[string][]string // country code -> CIDR strings
+	countryCIDRs6 map[string][]string // country code -> IPv6 CIDR strings
+	mergedRanges  []IPv4Range         // union of countryCIDRs, nil until computed
+	mu            sync.RWMutex
+	lastUpdate    time.Time
+	licenseKey    string
 
 	// IP Intelligence (IPinfo.io)
 	ipInfoAPIKey string
@@ -509,12 +514,98 @@ func (g *GeoIPService) GetAllCountryCIDRs() map[string][]string {
 	return copy
 }
 
+// GetAllCountryCIDRs6 returns all loaded country IPv6 CIDRs
+func (g *GeoIPService) GetAllCountryCIDRs6() map[string][]string {
+	g.mu.RLock()
+	defer g.mu.RUnlock()
+
+	copy := make(map[string][]string, len(g.countryCIDRs6))
+	for k, v := range g.countryCIDRs6 {
+		copy[k] = v
+	}
+	return copy
+}
+
+// IPv4Range is an inclusive range of IPv4 addresses in host byte order
+type IPv4Range struct {
+	Start uint32
+	End   uint32
+}
+
+// ForEachCIDR calls fn with the minimal set of CIDRs covering the range
+func (r IPv4Range) ForEachCIDR(fn func(base uint32, prefixLen int)) {
+	start, end := uint64(r.Start), uint64(r.End)
+	for start <= end {
+		size := bits.TrailingZeros32(uint32(start)) // 32 for 0.0.0.0
+		for size > 0 && start+(1<<size)-1 > end {
+			size--
+		}
+		fn(uint32(start), 32-size)
+		start += 1 << size
+	}
+}
+
+// GetMergedCIDRRanges returns the union of all loaded country CIDRs as
+// sorted, non-overlapping ranges. Adjacent CIDRs, including ones from
+// different countries, are coalesced, so the eBPF GeoIP tables only need
+// to know "allowed or not" per address.
+func (g *GeoIPService) GetMergedCIDRRanges() []IPv4Range {
+	g.mu.Lock()
+	defer g.mu.Unlock()
+
+	if g.mergedRanges == nil {
+		g.mergedRanges = mergeCIDRs(g.countryCIDRs)
+	}
+	return g.mergedRanges
+}
+
+// mergeCIDRs parses the IPv4 CIDRs of every country and coalesces them
+func mergeCIDRs(countryCIDRs map[string][]string) []IPv4Range {
+	total := 0
+	for _, cidrs := range countryCIDRs {
+		total += len(cidrs)
+	}
+	ranges := make([]IPv4Range, 0, total)
+	for _, cidrs := range countryCIDRs {
+		for _, cidr := range cidrs {
+			_, ipNet, err := net.ParseCIDR(cidr)
+			if err != nil {
+				continue
+			}
+			ip4 := ipNet.IP.To4()
+			ones, maskBits := ipNet.Mask.Size()
+			if ip4 == nil || maskBits != 32 {
+				continue
+			}
+			start := binary.BigEndian.Uint32(ip4)
+			ranges = append(ranges, IPv4Range{Start: start, End: start | uint32(0xFFFFFFFF)>>ones})
+		}
+	}
+
+	sort.Slice(ranges, func(i, j int) bool { return ranges[i].Start < ranges[j].Start })
+
+	merged := ranges[:0]
+	for _, r := range ranges {
+		if n := len(merged); n > 0 && (merged[n-1].End == 0xFFFFFFFF || r.Start <= merged[n-1].End+1) {
+			if r.End > merged[n-1].End {
+				merged[n-1].End = r.End
+			}
+			continue
+		}
+		merged = append(merged, r)
+	}
+	return merged
+}
+
 // DownloadCountryCIDRs downloads CIDR lists for specified countries
 func (g *GeoIPService) DownloadCountryCIDRs(countries []string) error {
 	g.mu.Lock()
 	if g.countryCIDRs == nil {
 		g.countryCIDRs = make(map[string][]string)
 	}
+	if g.countryCIDRs6 == nil {
+		g.countryCIDRs6 = make(map[string][]string)
+	}
 	g.mu.Unlock()
 
 	for _, country := range countries {
@@ -525,49 +616,68 @@ func (g *GeoIPService) DownloadCountryCIDRs(countries []string) error {
 
 		// Download from ipverse GitHub (RIR-sourced data)
 		url := fmt.Sprintf("https://raw.githubusercontent.com/ipverse/rir-ip/master/country/%s/ipv4-aggregated.txt", country)
-
-		resp, err := http.Get(url)
+		cidrs, err := downloadCIDRList(url)
 		if err != nil {
 			system.Warn("Failed to download CIDR for %s: %v", country, err)
 			continue
 		}
 
-		if resp.StatusCode != 200 {
-			resp.Body.Close()
-			system.Warn("Failed to download CIDR for %s: HTTP %d", country, resp.StatusCode)
-			continue
-		}
+		g.mu.Lock()
+		g.countryCIDRs[country] = cidrs
+		g.mergedRanges = nil
+		g.mu.Unlock()
 
-		body, err := io.ReadAll(resp.Body)
-		resp.Body.Close()
+		system.Info("Loaded %d CIDRs for country %s", len(cidrs), strings.ToUpper(country))
+
+		// IPv6 list for the XDP filter; a failure keeps the previous list
+		url6 := fmt.Sprintf("https://raw.githubusercontent.com/ipverse/rir-ip/master/country/%s/ipv6-aggregated.txt", country)
+		cidrs6, err := downloadCIDRList(url6)
 		if err != nil {
-			system.Warn("Failed to read CIDR for %s: %v", country, err)
+			system.Warn("Failed to download IPv6 CIDR for %s: %v", country, err)
 			continue
 		}
 
-		lines := strings.Split(string(body), "\n")
-		cidrs := make([]string, 0, len(lines))
-		for _, line := range lines {
-			line = strings.TrimSpace(line)
-			if line == "" || strings.HasPrefix(line, "#") {
-				continue
-			}
-			// Validate CIDR format
-			if _, _, err := net.ParseCIDR(line); err == nil {
-				cidrs = append(cidrs, line)
-			}
-		}
-
 		g.mu.Lock()
-		g.countryCIDRs[country] = cidrs
+		g.countryCIDRs6[country] = cidrs6
 		g.mu.Unlock()
-
-		system.Info("Loaded %d CIDRs for country %s", len(cidrs), strings.ToUpper(country))
 	}
 
 	return nil
 }
 
+// downloadCIDRList fetches a newline-separated CIDR list, skipping comments
+// and invalid lines
+func downloadCIDRList(url string) ([]string, error) {
+	resp, err := http.Get(url)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+
+	if resp.StatusCode != 200 {
+		return nil, fmt.Errorf("HTTP %d", resp.StatusCode)
+	}
+
+	body, err := io.ReadAll(resp.Body)
+	if err != nil {
+		return nil, err
+	}
+
+	lines := strings.Split(string(body), "\n")
+	cidrs := make([]string, 0, len(lines))
+	for _, line := range lines {
+		line = strings.TrimSpace(line)
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+		// Validate CIDR format
+		if _, _, err := net.ParseCIDR(line); err == nil {
+			cidrs = append(cidrs, line)
+		}
+	}
+	return cidrs, nil
+}
+
 // SetIPInfoAPIKey sets the IPinfo.io API key
 func (g *GeoIPService) SetIPInfoAPIKey(key string) {
 	g.mu.Lock()
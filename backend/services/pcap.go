@@ -1,7 +1,12 @@
 package services
 
 import (
+	"encoding/binary"
+	"fmt"
+	"net"
 	"path/filepath"
+	"strconv"
+	"strings"
 	"sync"
 	"time"
 )
@@ -9,12 +14,14 @@ import (
 // PCAPService defines the interface for packet capture
 type PCAPService interface {
 	StartCapture(interfaceName string, duration time.Duration, filter string) (string, error)
+	StartXDPCapture(duration time.Duration, filter string, sampleRate int) (string, error)
 	StopCapture() error
 	IsCapturing() bool
 	GetStatus() PCAPStatus
 	GetCaptureFiles() ([]string, error)
 	DeleteCaptureFile(filename string) error
 	GetCaptureDir() string
+	SetEBPF(ebpf *EBPFService)
 }
 
 // PCAPStatus holds the current status of the capture service
@@ -25,6 +32,8 @@ type PCAPStatus struct {
 	CurrentFile   string    `json:"current_file"`
 	InterfaceName string    `json:"interface_name"`
 	Filter        string    `json:"filter"`
+	Source        string    `json:"source"`            // "tcpdump" or "xdp"
+	Packets       uint64    `json:"packets,omitempty"` // XDP captures only
 }
 
 var (
@@ -40,3 +49,57 @@ func getCaptureDir() string {
 	// In a real app this might be configurable
 	return filepath.Join(".", "captures")
 }
+
+// isCaptureFile reports whether name is a capture file we wrote
+func isCaptureFile(name string) bool {
+	ext := filepath.Ext(name)
+	return ext == ".pcap" || ext == ".pcapng"
+}
+
+// XDPCaptureFilter is the capture filter XDP applies itself, matching the
+// capture_* fields of xdp_policy
+type XDPCaptureFilter struct {
+	Rate  uint32 // 1-in-N drops, rounded up to a power of two
+	Proto uint32 // IP protocol, 0 = any
+	Port  uint32 // Source or destination port, 0 = any
+	Host  uint32 // IPv4 source or destination as XDP reads it, 0 = any
+}
+
+// parseXDPCaptureFilter parses the tcpdump-style subset XDP can match:
+// tcp/udp/icmp, "port N" and "host A.B.C.D", joined by "and"
+func parseXDPCaptureFilter(filter string) (XDPCaptureFilter, error) {
+	var f XDPCaptureFilter
+	words := strings.Fields(strings.ToLower(filter))
+	for i := 0; i < len(words); i++ {
+		switch w := words[i]; w {
+		case "and", "&&":
+		case "tcp":
+			f.Proto = 6
+		case "udp":
+			f.Proto = 17
+		case "icmp":
+			f.Proto = 1
+		case "port", "host":
+			if i+1 == len(words) {
+				return f, fmt.Errorf("capture filter: %q needs a value", w)
+			}
+			i++
+			if w == "port" {
+				port, err := strconv.ParseUint(words[i], 10, 16)
+				if err != nil || port == 0 {
+					return f, fmt.Errorf("capture filter: invalid port %q", words[i])
+				}
+				f.Port = uint32(port)
+			} else {
+				ip := net.ParseIP(words[i]).To4()
+				if ip == nil {
+					return f, fmt.Errorf("capture filter: invalid IPv4 host %q", words[i])
+				}
+				f.Host = binary.NativeEndian.Uint32(ip)
+			}
+		default:
+			return f, fmt.Errorf("capture filter: %q is not supported by XDP capture (use tcp, udp, icmp, port N, host IPv4)", w)
+		}
+	}
+	return f, nil
+}
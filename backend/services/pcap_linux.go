@@ -6,20 +6,29 @@ import (
 	"context"
 	"fmt"
 	"kg-proxy-web-gui/backend/system"
+	"net"
 	"os"
 	"os/exec"
 	"path/filepath"
 	"sort"
 	"sync"
+	"sync/atomic"
 	"time"
+
+	"golang.org/x/sys/unix"
 )
 
+// xdpCaptureMaxBytes stops an XDP capture before it fills the disk
+const xdpCaptureMaxBytes = 1 << 30
+
 type LinuxPCAPService struct {
 	mu         sync.Mutex
 	status     PCAPStatus
 	cancelFunc context.CancelFunc
 	cmd        *exec.Cmd
 	captureDir string
+	ebpf       *EBPFService
+	xdpPackets atomic.Uint64 // Packets written by the running XDP capture
 }
 
 // NewPCAPService creates a new instance of the Linux PCAP service
@@ -92,6 +101,7 @@ func (s *LinuxPCAPService) StartCapture(interfaceName string, duration time.Dura
 		CurrentFile:   filename,
 		InterfaceName: interfaceName,
 		Filter:        filter,
+		Source:        "tcpdump",
 	}
 
 	// Monitor process in background
@@ -124,6 +134,154 @@ func (s *LinuxPCAPService) StartCapture(interfaceName string, duration time.Dura
 	return filename, nil
 }
 
+// SetEBPF connects the eBPF service whose XDP program feeds XDP captures
+func (s *LinuxPCAPService) SetEBPF(ebpf *EBPFService) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.ebpf = ebpf
+}
+
+// StartXDPCapture writes a 1-in-sampleRate sample of the packets XDP drops
+// to a pcapng file. The packets arrive on AF_XDP sockets, so the capture
+// costs no tcpdump process or stack traversal on the protected interface.
+// filter takes the subset of tcpdump syntax XDP matches itself.
+func (s *LinuxPCAPService) StartXDPCapture(duration time.Duration, filter string, sampleRate int) (string, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if s.status.IsCapturing {
+		return "", fmt.Errorf("capture already in progress")
+	}
+	if s.ebpf == nil {
+		return "", fmt.Errorf("XDP capture is not available")
+	}
+	xdpFilter, err := parseXDPCaptureFilter(filter)
+	if err != nil {
+		return "", err
+	}
+	xdpFilter.Rate = uint32(max(sampleRate, 1))
+
+	interfaceName := s.ebpf.CaptureInterface()
+	if interfaceName == "" {
+		return "", fmt.Errorf("XDP program is not attached")
+	}
+	iface, err := net.InterfaceByName(interfaceName)
+	if err != nil {
+		return "", fmt.Errorf("XDP interface %s: %w", interfaceName, err)
+	}
+
+	sockets, err := openXSKSockets(iface.Index, xskQueueCount(interfaceName))
+	if err != nil {
+		return "", err
+	}
+
+	timestamp := time.Now().Format("20060102-150405")
+	filename := fmt.Sprintf("capture_xdp_%s.pcapng", timestamp)
+	fullPath := filepath.Join(s.captureDir, filename)
+	file, err := os.Create(fullPath)
+	if err != nil {
+		closeXSKSockets(sockets)
+		return "", fmt.Errorf("creating capture file: %w", err)
+	}
+	writer, err := newPCAPNGWriter(file)
+	if err != nil {
+		file.Close()
+		closeXSKSockets(sockets)
+		return "", fmt.Errorf("writing capture file: %w", err)
+	}
+
+	fds := make(map[uint32]int, len(sockets))
+	for _, sock := range sockets {
+		fds[sock.queue] = sock.fd
+	}
+	if err := s.ebpf.StartXDPCapture(fds, xdpFilter); err != nil {
+		file.Close()
+		os.Remove(fullPath)
+		closeXSKSockets(sockets)
+		return "", err
+	}
+
+	if duration == 0 {
+		duration = 5 * time.Minute
+	}
+	ctx, cancel := context.WithTimeout(context.Background(), duration)
+	s.cancelFunc = cancel
+	s.xdpPackets.Store(0)
+	s.status = PCAPStatus{
+		IsCapturing:   true,
+		StartTime:     time.Now(),
+		CurrentFile:   filename,
+		InterfaceName: interfaceName,
+		Filter:        filter,
+		Source:        "xdp",
+	}
+	system.Info("XDP capture writing to %s (%d queue(s))", filename, len(sockets))
+
+	go s.runXDPCapture(ctx, sockets, writer, file)
+	return filename, nil
+}
+
+// runXDPCapture drains the capture sockets into writer until ctx ends or
+// the file reaches xdpCaptureMaxBytes
+func (s *LinuxPCAPService) runXDPCapture(ctx context.Context, sockets []*xskSocket, writer *pcapngWriter, file *os.File) {
+	pfds := make([]unix.PollFd, len(sockets))
+	for i, sock := range sockets {
+		pfds[i] = unix.PollFd{Fd: int32(sock.fd), Events: unix.POLLIN}
+	}
+
+	var now time.Time
+	var writeErr error
+	write := func(packet []byte) {
+		if writeErr == nil {
+			writeErr = writer.writePacket(now, packet)
+		}
+	}
+	drain := func() {
+		now = time.Now()
+		for _, sock := range sockets {
+			s.xdpPackets.Add(uint64(sock.receive(write)))
+		}
+	}
+
+	for ctx.Err() == nil && writeErr == nil && writer.written < xdpCaptureMaxBytes {
+		if _, err := unix.Poll(pfds, 200); err != nil && err != unix.EINTR {
+			system.Warn("XDP capture poll failed: %v", err)
+			break
+		}
+		drain()
+	}
+
+	// Stop the redirect before closing the sockets, then pick up what is left
+	s.ebpf.StopXDPCapture()
+	drain()
+	var dropped uint64
+	for _, sock := range sockets {
+		dropped += sock.dropped()
+	}
+	closeXSKSockets(sockets)
+	if err := writer.flush(); err != nil && writeErr == nil {
+		writeErr = err
+	}
+	file.Close()
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.status.IsCapturing = false
+	s.status.Duration = time.Since(s.status.StartTime).String()
+	s.status.Packets = s.xdpPackets.Load()
+	s.cancelFunc = nil
+
+	switch {
+	case writeErr != nil:
+		system.Warn("XDP capture stopped on write error: %v", writeErr)
+	case writer.written >= xdpCaptureMaxBytes:
+		system.Warn("XDP capture stopped at the %d MB size limit: %s", xdpCaptureMaxBytes>>20, s.status.CurrentFile)
+	default:
+		system.Info("XDP capture finished: %s (%d packets, %d dropped by the kernel)",
+			s.status.CurrentFile, s.status.Packets, dropped)
+	}
+}
+
 func (s *LinuxPCAPService) StopCapture() error {
 	s.mu.Lock()
 	defer s.mu.Unlock()
@@ -150,6 +308,9 @@ func (s *LinuxPCAPService) GetStatus() PCAPStatus {
 	// Update duration on the fly if capturing
 	if s.status.IsCapturing {
 		s.status.Duration = time.Since(s.status.StartTime).String()
+		if s.status.Source == "xdp" {
+			s.status.Packets = s.xdpPackets.Load()
+		}
 	}
 	return s.status
 }
@@ -162,7 +323,7 @@ func (s *LinuxPCAPService) GetCaptureFiles() ([]string, error) {
 
 	var filenames []string
 	for _, f := range files {
-		if !f.IsDir() && filepath.Ext(f.Name()) == ".pcap" {
+		if !f.IsDir() && isCaptureFile(f.Name()) {
 			filenames = append(filenames, f.Name())
 		}
 	}
@@ -32,6 +32,12 @@ func (s *WindowsPCAPService) StartCapture(interfaceName string, duration time.Du
 	return "", fmt.Errorf("packet capture is not supported on Windows in this version")
 }
 
+func (s *WindowsPCAPService) StartXDPCapture(duration time.Duration, filter string, sampleRate int) (string, error) {
+	return "", fmt.Errorf("XDP capture is not supported on Windows")
+}
+
+func (s *WindowsPCAPService) SetEBPF(ebpf *EBPFService) {}
+
 func (s *WindowsPCAPService) StopCapture() error {
 	return nil
 }
@@ -0,0 +1,234 @@
+//go:build linux
+
+package services
+
+import (
+	"fmt"
+	"os"
+	"strings"
+	"sync/atomic"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+)
+
+// AF_XDP capture sockets (v2.1)
+// One receive-only socket per RX queue, each with its own UMEM. Every frame
+// is handed to the kernel on the fill ring up front and goes back as soon
+// as its packet has been written out, so a capture holds a fixed
+// xskUmemBudget of memory however fast drops arrive. Sockets are bound in
+// copy mode only: the NIC keeps filling its RX queue from driver memory, so
+// when the writer falls behind the kernel drops sampled packets at the
+// socket's RX ring and other traffic on the queue is unaffected. Zero-copy
+// would refill the NIC from this UMEM and starve the queue instead.
+
+const (
+	xskFrameSize  = 2048
+	xskUmemBudget = 64 << 20 // Across all queues
+	xskMinFrames  = 256
+	xskMaxFrames  = 4096
+	xskMaxQueues  = 64 // CAPTURE_XSKS_MAX in xdp_filter.c
+)
+
+// xskRing is the shared producer/consumer view of one mmapped ring
+type xskRing struct {
+	mem      []byte
+	producer *uint32
+	consumer *uint32
+	descs    unsafe.Pointer
+	mask     uint32
+}
+
+type xskSocket struct {
+	fd     int
+	queue  uint32
+	frames uint32
+	umem   []byte
+	fill   xskRing // uint64 frame addresses
+	rx     xskRing // unix.XDPDesc
+}
+
+// xskQueueCount returns the number of RX queues of iface, capped to the
+// size of capture_xsks
+func xskQueueCount(iface string) int {
+	entries, err := os.ReadDir("/sys/class/net/" + iface + "/queues")
+	if err != nil {
+		return 1
+	}
+	n := 0
+	for _, entry := range entries {
+		if strings.HasPrefix(entry.Name(), "rx-") {
+			n++
+		}
+	}
+	return min(max(n, 1), xskMaxQueues)
+}
+
+// xskFramesPerQueue splits xskUmemBudget across queues, as a power of two
+// since the frame count is also the ring size
+func xskFramesPerQueue(queues int) uint32 {
+	frames := uint32(xskMaxFrames)
+	for frames > xskMinFrames && int(frames)*xskFrameSize*queues > xskUmemBudget {
+		frames >>= 1
+	}
+	return frames
+}
+
+// openXSKSockets opens a capture socket on each of the first queues RX
+// queues of ifindex
+func openXSKSockets(ifindex, queues int) ([]*xskSocket, error) {
+	frames := xskFramesPerQueue(queues)
+	sockets := make([]*xskSocket, 0, queues)
+	for q := 0; q < queues; q++ {
+		s, err := newXSKSocket(ifindex, uint32(q), frames)
+		if err != nil {
+			closeXSKSockets(sockets)
+			return nil, fmt.Errorf("AF_XDP socket on queue %d: %w", q, err)
+		}
+		sockets = append(sockets, s)
+	}
+	return sockets, nil
+}
+
+func closeXSKSockets(sockets []*xskSocket) {
+	for _, s := range sockets {
+		s.close()
+	}
+}
+
+func newXSKSocket(ifindex int, queue, frames uint32) (*xskSocket, error) {
+	fd, err := unix.Socket(unix.AF_XDP, unix.SOCK_RAW|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return nil, fmt.Errorf("socket: %w", err)
+	}
+	s := &xskSocket{fd: fd, queue: queue, frames: frames}
+
+	s.umem, err = unix.Mmap(-1, 0, int(frames)*xskFrameSize, unix.PROT_READ|unix.PROT_WRITE,
+		unix.MAP_PRIVATE|unix.MAP_ANONYMOUS|unix.MAP_POPULATE)
+	if err != nil {
+		s.close()
+		return nil, fmt.Errorf("allocating UMEM: %w", err)
+	}
+	reg := unix.XDPUmemReg{
+		Addr: uint64(uintptr(unsafe.Pointer(&s.umem[0]))),
+		Len:  uint64(len(s.umem)),
+		Size: xskFrameSize,
+	}
+	if err := xskSetsockopt(fd, unix.XDP_UMEM_REG, unsafe.Pointer(&reg), unsafe.Sizeof(reg)); err != nil {
+		s.close()
+		return nil, fmt.Errorf("registering UMEM: %w", err)
+	}
+
+	// The completion ring is never used, but bind requires one
+	for _, ring := range []int{unix.XDP_UMEM_FILL_RING, unix.XDP_UMEM_COMPLETION_RING, unix.XDP_RX_RING} {
+		if err := unix.SetsockoptInt(fd, unix.SOL_XDP, ring, int(frames)); err != nil {
+			s.close()
+			return nil, fmt.Errorf("sizing rings: %w", err)
+		}
+	}
+
+	var off unix.XDPMmapOffsets
+	size := uint32(unsafe.Sizeof(off))
+	if _, _, errno := unix.Syscall6(unix.SYS_GETSOCKOPT, uintptr(fd), unix.SOL_XDP, unix.XDP_MMAP_OFFSETS,
+		uintptr(unsafe.Pointer(&off)), uintptr(unsafe.Pointer(&size)), 0); errno != 0 {
+		s.close()
+		return nil, fmt.Errorf("reading ring offsets: %w", errno)
+	}
+	if s.fill, err = mapXSKRing(fd, unix.XDP_UMEM_PGOFF_FILL_RING, off.Fr, 8, frames); err != nil {
+		s.close()
+		return nil, fmt.Errorf("mapping fill ring: %w", err)
+	}
+	if s.rx, err = mapXSKRing(fd, unix.XDP_PGOFF_RX_RING, off.Rx, uint64(unsafe.Sizeof(unix.XDPDesc{})), frames); err != nil {
+		s.close()
+		return nil, fmt.Errorf("mapping RX ring: %w", err)
+	}
+
+	// Hand every frame to the kernel
+	addrs := unsafe.Slice((*uint64)(s.fill.descs), frames)
+	for i := range addrs {
+		addrs[i] = uint64(i) * xskFrameSize
+	}
+	atomic.StoreUint32(s.fill.producer, frames)
+
+	if err := unix.Bind(fd, &unix.SockaddrXDP{Flags: unix.XDP_COPY, Ifindex: uint32(ifindex), QueueID: queue}); err != nil {
+		s.close()
+		return nil, fmt.Errorf("bind: %w", err)
+	}
+	return s, nil
+}
+
+// xskSetsockopt sets a struct-valued SOL_XDP option
+func xskSetsockopt(fd, opt int, val unsafe.Pointer, size uintptr) error {
+	if _, _, errno := unix.Syscall6(unix.SYS_SETSOCKOPT, uintptr(fd), unix.SOL_XDP, uintptr(opt),
+		uintptr(val), size, 0); errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+func mapXSKRing(fd int, pgoff int64, off unix.XDPRingOffset, entrySize uint64, entries uint32) (xskRing, error) {
+	mem, err := unix.Mmap(fd, pgoff, int(off.Desc+uint64(entries)*entrySize),
+		unix.PROT_READ|unix.PROT_WRITE, unix.MAP_SHARED|unix.MAP_POPULATE)
+	if err != nil {
+		return xskRing{}, err
+	}
+	return xskRing{
+		mem:      mem,
+		producer: (*uint32)(unsafe.Pointer(&mem[off.Producer])),
+		consumer: (*uint32)(unsafe.Pointer(&mem[off.Consumer])),
+		descs:    unsafe.Pointer(&mem[off.Desc]),
+		mask:     entries - 1,
+	}, nil
+}
+
+// receive hands each received packet to fn, returns its frame to the fill
+// ring and reports how many there were. fn must not keep the slice.
+func (s *xskSocket) receive(fn func(packet []byte)) int {
+	cons := *s.rx.consumer
+	n := atomic.LoadUint32(s.rx.producer) - cons
+	if n == 0 {
+		return 0
+	}
+
+	descs := unsafe.Slice((*unix.XDPDesc)(s.rx.descs), s.frames)
+	addrs := unsafe.Slice((*uint64)(s.fill.descs), s.frames)
+	fillProd := *s.fill.producer
+	for i := uint32(0); i < n; i++ {
+		d := descs[(cons+i)&s.rx.mask]
+		if end := d.Addr + uint64(d.Len); end <= uint64(len(s.umem)) {
+			fn(s.umem[d.Addr:end])
+		}
+		addrs[(fillProd+i)&s.fill.mask] = d.Addr &^ (xskFrameSize - 1)
+	}
+	atomic.StoreUint32(s.fill.producer, fillProd+n)
+	atomic.StoreUint32(s.rx.consumer, cons+n)
+	return int(n)
+}
+
+// dropped returns how many packets the kernel could not queue to s
+func (s *xskSocket) dropped() uint64 {
+	var stats unix.XDPStatistics
+	size := uint32(unsafe.Sizeof(stats))
+	if _, _, errno := unix.Syscall6(unix.SYS_GETSOCKOPT, uintptr(s.fd), unix.SOL_XDP, unix.XDP_STATISTICS,
+		uintptr(unsafe.Pointer(&stats)), uintptr(unsafe.Pointer(&size)), 0); errno != 0 {
+		return 0
+	}
+	return stats.Rx_dropped + stats.Rx_ring_full + stats.Rx_fill_ring_empty_descs
+}
+
+func (s *xskSocket) close() {
+	if s.rx.mem != nil {
+		unix.Munmap(s.rx.mem)
+	}
+	if s.fill.mem != nil {
+		unix.Munmap(s.fill.mem)
+	}
+	if s.fd >= 0 {
+		unix.Close(s.fd)
+		s.fd = -1
+	}
+	if s.umem != nil {
+		unix.Munmap(s.umem)
+		s.umem = nil
+	}
+}
@@ -0,0 +1,102 @@
+package services
+
+import (
+	"bufio"
+	"encoding/binary"
+	"io"
+	"time"
+)
+
+// pcapng writer (v2.1)
+// Minimal writer for one Ethernet interface with nanosecond timestamps:
+// a section header, one interface description, then enhanced packet
+// blocks. Packets are written through a fixed buffer without allocating.
+
+const (
+	pcapngBlockSHB = 0x0A0D0D0A
+	pcapngBlockIDB = 0x00000001
+	pcapngBlockEPB = 0x00000006
+	pcapngLinkEth  = 1
+	pcapngSnapLen  = 65535
+	pcapngBufSize  = 1 << 20
+)
+
+type pcapngWriter struct {
+	w       *bufio.Writer
+	scratch [28]byte
+	written int64
+}
+
+// newPCAPNGWriter writes the file header to out
+func newPCAPNGWriter(out io.Writer) (*pcapngWriter, error) {
+	p := &pcapngWriter{w: bufio.NewWriterSize(out, pcapngBufSize)}
+
+	// Section header: byte-order magic, version 1.0, unknown section length
+	shb := make([]byte, 28)
+	le := binary.LittleEndian
+	le.PutUint32(shb[0:], pcapngBlockSHB)
+	le.PutUint32(shb[4:], 28)
+	le.PutUint32(shb[8:], 0x1A2B3C4D)
+	le.PutUint16(shb[12:], 1)
+	le.PutUint16(shb[14:], 0)
+	le.PutUint64(shb[16:], ^uint64(0))
+	le.PutUint32(shb[24:], 28)
+
+	// Interface description with if_tsresol = 9 (nanoseconds)
+	idb := make([]byte, 32)
+	le.PutUint32(idb[0:], pcapngBlockIDB)
+	le.PutUint32(idb[4:], 32)
+	le.PutUint16(idb[8:], pcapngLinkEth)
+	le.PutUint32(idb[12:], pcapngSnapLen)
+	le.PutUint16(idb[16:], 9) // if_tsresol
+	le.PutUint16(idb[18:], 1)
+	idb[20] = 9
+	// idb[24:28] is opt_endofopt
+	le.PutUint32(idb[28:], 32)
+
+	if _, err := p.w.Write(shb); err != nil {
+		return nil, err
+	}
+	if _, err := p.w.Write(idb); err != nil {
+		return nil, err
+	}
+	p.written = int64(len(shb) + len(idb))
+	return p, nil
+}
+
+// writePacket appends one packet seen at ts
+func (p *pcapngWriter) writePacket(ts time.Time, data []byte) error {
+	padded := (len(data) + 3) &^ 3
+	total := uint32(32 + padded)
+	ns := uint64(ts.UnixNano())
+
+	le := binary.LittleEndian
+	le.PutUint32(p.scratch[0:], pcapngBlockEPB)
+	le.PutUint32(p.scratch[4:], total)
+	le.PutUint32(p.scratch[8:], 0) // interface ID
+	le.PutUint32(p.scratch[12:], uint32(ns>>32))
+	le.PutUint32(p.scratch[16:], uint32(ns))
+	le.PutUint32(p.scratch[20:], uint32(len(data)))
+	le.PutUint32(p.scratch[24:], uint32(len(data)))
+	if _, err := p.w.Write(p.scratch[:28]); err != nil {
+		return err
+	}
+	if _, err := p.w.Write(data); err != nil {
+		return err
+	}
+
+	// Pad the data to 32 bits, then repeat the block length
+	pad := padded - len(data)
+	clear(p.scratch[:pad])
+	le.PutUint32(p.scratch[pad:], total)
+	if _, err := p.w.Write(p.scratch[:pad+4]); err != nil {
+		return err
+	}
+	p.written += int64(total)
+	return nil
+}
+
+// flush writes out buffered packets
+func (p *pcapngWriter) flush() error {
+	return p.w.Flush()
+}
@@ -35,6 +35,17 @@ func uint32ToIP(n uint32) net.IP {
 	return ip
 }
 
+// TCEgressStats matches the C struct tc_egress_stats
+type TCEgressStats struct {
+	TotalPackets uint64 `json:"total_packets"`
+	Tracked      uint64 `json:"tracked"`
+	TCPTracked   uint64 `json:"tcp_tracked"`
+	UDPTracked   uint64 `json:"udp_tracked"`
+	FlowInserts  uint64 `json:"flow_inserts"`
+	FlowWrites   uint64 `json:"flow_writes"`
+	FlowSkipped  uint64 `json:"flow_skipped"`
+}
+
 // DetailedTrafficStats extends TrafficSnapshot with breakdown
 type DetailedTrafficStats struct {
 	models.TrafficSnapshot
@@ -43,6 +54,20 @@ type DetailedTrafficStats struct {
 	GeoIPBlockPPS  int64 `json:"geoip_block_pps"`
 	TotalPackets   int64 `json:"total_packets"`   // Cumulative
 	BlockedPackets int64 `json:"blocked_packets"` // Cumulative
+	BlockExpired   int64 `json:"block_expired"`   // Cumulative expired blocks deleted (XDP on hit + userspace sweep)
+	AttackMode     bool  `json:"attack_mode"`     // XDP attack mode overrides are in force
+	// Cumulative packets per XDP verdict reason (whitelist, geoip, ...)
+	VerdictCounts map[string]int64 `json:"verdict_counts,omitempty"`
+	// Cumulative TC egress tracking counters, nil when TC is not attached
+	EgressStats *TCEgressStats `json:"egress_stats,omitempty"`
+	// Interfaces XDP is attached to and the mode each one got
+	XDPAttachments []XDPAttachment `json:"xdp_attachments,omitempty"`
+}
+
+// XDPAttachment reports how XDP is attached to one interface
+type XDPAttachment struct {
+	Interface string `json:"interface"`
+	Mode      string `json:"mode"` // "native" or "generic"
 }
 
 type RawTrafficStats struct {
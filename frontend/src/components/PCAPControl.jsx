@@ -15,7 +15,9 @@ import {
     TableRow,
     IconButton,
     Chip,
-    Alert
+    Alert,
+    Grid,
+    MenuItem
 } from '@mui/material';
 import {
     BugReport as BugIcon,
@@ -33,6 +35,8 @@ const PCAPControl = () => {
     const [interfaceName, setInterfaceName] = useState('');
     const [duration, setDuration] = useState(60);
     const [filter, setFilter] = useState('');
+    const [mode, setMode] = useState('stack');
+    const [sampleRate, setSampleRate] = useState(1);
     const [loading, setLoading] = useState(false);
     const [error, setError] = useState(null);
 
@@ -74,7 +78,9 @@ const PCAPControl = () => {
             await client.post('/pcap/start', {
                 interface: interfaceName,
                 duration: parseInt(duration),
-                filter
+                filter,
+                mode,
+                sample_rate: parseInt(sampleRate)
             });
             fetchStatus();
         } catch (err) {
@@ -124,7 +130,9 @@ const PCAPControl = () => {
                     {status.is_capturing && (
                         <Chip
                             icon={<CircularProgress size={16} color="inherit" />}
-                            label={`Capturing... ${status.duration}`}
+                            label={status.source === 'xdp'
+                                ? `Capturing XDP drops... ${status.duration} (${status.packets || 0} pkts)`
+                                : `Capturing... ${status.duration}`}
                             color="error"
                             variant="outlined"
                         />
@@ -137,14 +145,42 @@ const PCAPControl = () => {
                 <Grid container spacing={2} alignItems="center">
                     <Grid item xs={12} md={3}>
                         <TextField
+                            select
                             fullWidth
-                            label="Interface (Empty=Default)"
+                            label="Source"
                             size="small"
-                            value={interfaceName}
-                            onChange={(e) => setInterfaceName(e.target.value)}
+                            value={mode}
+                            onChange={(e) => setMode(e.target.value)}
                             disabled={status.is_capturing}
-                        />
+                        >
+                            <MenuItem value="stack">All traffic (tcpdump)</MenuItem>
+                            <MenuItem value="xdp">XDP drops (AF_XDP)</MenuItem>
+                        </TextField>
                     </Grid>
+                    {mode === 'xdp' ? (
+                        <Grid item xs={12} md={3}>
+                            <TextField
+                                fullWidth
+                                label="Sample 1 in N"
+                                type="number"
+                                size="small"
+                                value={sampleRate}
+                                onChange={(e) => setSampleRate(e.target.value)}
+                                disabled={status.is_capturing}
+                            />
+                        </Grid>
+                    ) : (
+                        <Grid item xs={12} md={3}>
+                            <TextField
+                                fullWidth
+                                label="Interface (Empty=Default)"
+                                size="small"
+                                value={interfaceName}
+                                onChange={(e) => setInterfaceName(e.target.value)}
+                                disabled={status.is_capturing}
+                            />
+                        </Grid>
+                    )}
                     <Grid item xs={12} md={2}>
                         <TextField
                             fullWidth